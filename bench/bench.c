@@ -0,0 +1,408 @@
+/*
+puredis-bench: drives puredis, apuredis and spuredis objects outside of Pd
+(see pdstub.c) against a local redis-server, one JSON object per workload on
+stdout, connection and object messages on stderr.
+
+usage: puredis-bench [host] [port] [scale]
+
+Every key is created under "puredis-bench:" and deleted afterwards, scale
+multiplies the number of operations of each workload.
+*/
+
+#include "pdstub.h"
+#include "../libpuredis.c"
+
+#define BENCH_PREFIX "puredis-bench:"
+#define BENCH_BURST 1000
+#define BENCH_TIMEOUT 10000
+
+typedef struct _bench {
+    char host[64];
+    int port;
+    int scale;
+    void *target;        /* the object whose outlet is counted */
+    long replies;        /* messages out of its first outlet */
+    long messages;       /* pub/sub messages among them */
+    t_symbol *status;    /* selector of the last status list */
+    long entries;        /* entries of the last csv-load-status */
+    double *lat;         /* per operation latencies in seconds */
+} t_bench;
+
+static t_bench b;
+
+static double bench_time(void)
+{
+    return pdstub_now() / 1000.;
+}
+
+static void bench_hook(void *owner, int outlet, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    if (owner != b.target || outlet != 0) return;
+    b.replies++;
+    if (argc > 0 && argv[0].a_type == A_SYMBOL) {
+        t_symbol *first = argv[0].a_w.w_symbol;
+        if (first == gensym("message")) {
+            b.messages++;
+        } else if (argc >= 5 && (first == gensym("csv-load-status") || first == gensym("csv-load-progress"))) {
+            b.status = first;
+            b.entries = (long)atom_getfloat(argv + 4);
+        }
+    }
+}
+
+static int bench_cmp(const void *a, const void *c)
+{
+    double d = *(const double *)a - *(const double *)c;
+    return d < 0 ? -1 : d > 0;
+}
+
+/* sorts the n latencies and returns the p percentile in microseconds */
+static double bench_percentile(double *lat, long n, double p)
+{
+    long i = (long)(p * n);
+    if (n == 0) return 0;
+    if (i >= n) i = n - 1;
+    return lat[i] * 1000000.;
+}
+
+static void bench_result(const char *name, const char *unit, long ops, double seconds, long nlat)
+{
+    printf("{\"bench\":\"%s\",\"%s\":%ld,\"seconds\":%.6f,\"%s_per_sec\":%.1f",
+        name, unit, ops, seconds, unit, seconds > 0 ? ops / seconds : 0);
+    if (nlat > 0) {
+        qsort(b.lat, nlat, sizeof(double), bench_cmp);
+        printf(",\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f",
+            bench_percentile(b.lat, nlat, .5), bench_percentile(b.lat, nlat, .99),
+            bench_percentile(b.lat, nlat, .999), b.lat[nlat - 1] * 1000000.);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void bench_fail(const char *name, const char *why)
+{
+    printf("{\"bench\":\"%s\",\"error\":\"%s\"}\n", name, why);
+    fflush(stdout);
+}
+
+/* creates an object like the [name host port( box would */
+static t_redis *bench_new(const char *name)
+{
+    t_atom argv[2];
+    SETSYMBOL(&argv[0], gensym(b.host));
+    SETFLOAT(&argv[1], b.port);
+    return (t_redis *)redis_new(gensym(name), 2, argv);
+}
+
+/* runs the scheduler until the counter reaches want, or until it stops
+ * moving for the timeout: a slow server still completes */
+static int bench_wait(long *counter, long want)
+{
+    double until = pdstub_now() + BENCH_TIMEOUT;
+    long last = *counter;
+    while (*counter < want && pdstub_now() < until) {
+        pdstub_step(1);
+        if (*counter != last) {
+            last = *counter;
+            until = pdstub_now() + BENCH_TIMEOUT;
+        }
+    }
+    return *counter >= want;
+}
+
+static int bench_connected(t_redis *x)
+{
+    double until = pdstub_now() + BENCH_TIMEOUT;
+    while (x->conn_state != CONN_UP && pdstub_now() < until) pdstub_step(1);
+    return x->conn_state == CONN_UP;
+}
+
+/* deletes every benchmark key with SCAN and pipelined DEL */
+static void bench_cleanup(void)
+{
+    struct timeval tv = { 2, 0 };
+    redisContext *c = redisConnectWithTimeout(b.host, b.port, tv);
+    redisReply *reply;
+    char cursor[32] = "0";
+    if (c == NULL || c->err) {
+        if (c) redisFree(c);
+        return;
+    }
+    do {
+        size_t i;
+        reply = redisCommand(c, "SCAN %s MATCH %s* COUNT 1000", cursor, BENCH_PREFIX);
+        if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) break;
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        for (i = 0; i < reply->element[1]->elements; i++)
+            redisAppendCommand(c, "DEL %s", reply->element[1]->element[i]->str);
+        for (i = 0; i < reply->element[1]->elements; i++) {
+            void *del;
+            if (redisGetReply(c, &del) == REDIS_OK) freeReplyObject(del);
+        }
+        freeReplyObject(reply);
+        reply = NULL;
+    } while (strcmp(cursor, "0") != 0);
+    if (reply) freeReplyObject(reply);
+    redisFree(c);
+}
+
+/* puredis: one blocking round trip per command */
+static void bench_sync(const char *name, const char *command, long n)
+{
+    t_redis *x = bench_new("puredis");
+    t_atom argv[3];
+    char key[64];
+    long i;
+    double t0;
+    if (x == NULL || x->conn_state != CONN_UP) {
+        bench_fail(name, "no connection");
+        if (x) pd_free((t_pd *)x);
+        return;
+    }
+    b.target = x;
+    b.replies = 0;
+    SETSYMBOL(&argv[0], gensym(command));
+    t0 = bench_time();
+    for (i = 0; i < n; i++) {
+        double t1 = bench_time();
+        snprintf(key, sizeof(key), BENCH_PREFIX "sync:%ld", i % 1000);
+        SETSYMBOL(&argv[1], gensym(key));
+        SETFLOAT(&argv[2], i);
+        redis_command(x, gensym("command"), command[0] == 'S' ? 3 : 2, argv);
+        b.lat[i] = bench_time() - t1;
+    }
+    bench_result(name, "ops", b.replies, bench_time() - t0, n);
+    pd_free((t_pd *)x);
+}
+
+/* apuredis: bursts of pipelined commands drained by the fd poll callback,
+ * the latency is the time to drain a whole burst */
+static void bench_pipeline(long n)
+{
+    t_redis *x = bench_new("apuredis");
+    t_atom argv[2];
+    long i, bursts = 0, sent = 0;
+    double t0;
+    if (x == NULL || !bench_connected(x)) {
+        bench_fail("apuredis_pipeline", "no connection");
+        if (x) pd_free((t_pd *)x);
+        return;
+    }
+    redis_mode(x, gensym("poll"));
+    apuredis_start(x, NULL);
+    b.target = x;
+    b.replies = 0;
+    SETSYMBOL(&argv[0], gensym("INCR"));
+    SETSYMBOL(&argv[1], gensym(BENCH_PREFIX "counter"));
+    t0 = bench_time();
+    while (sent < n) {
+        double t1 = bench_time();
+        for (i = 0; i < BENCH_BURST && sent < n; i++, sent++)
+            redis_command(x, gensym("command"), 2, argv);
+        if (!bench_wait(&b.replies, sent)) break;
+        b.lat[bursts++] = bench_time() - t1;
+    }
+    if (b.replies < n) {
+        bench_fail("apuredis_pipeline", "timeout");
+    } else {
+        bench_result("apuredis_pipeline", "ops", b.replies, bench_time() - t0, bursts);
+    }
+    pd_free((t_pd *)x);
+}
+
+/* spuredis: messages published in pipelined bursts by a plain hiredis
+ * context, the rate is the one of the subscriber output */
+static void bench_pubsub(long n)
+{
+    t_redis *x = bench_new("spuredis");
+    struct timeval tv = { 2, 0 };
+    redisContext *c = redisConnectWithTimeout(b.host, b.port, tv);
+    t_atom channel;
+    long i, sent = 0;
+    double t0;
+    if (x == NULL || c == NULL || c->err || !bench_connected(x)) {
+        bench_fail("spuredis_messages", "no connection");
+        goto done;
+    }
+    redis_mode(x, gensym("poll"));
+    b.target = x;
+    b.replies = b.messages = 0;
+    SETSYMBOL(&channel, gensym(BENCH_PREFIX "channel"));
+    spuredis_subscribe(x, gensym("subscribe"), 1, &channel);
+    if (!bench_wait(&b.replies, 1)) {
+        bench_fail("spuredis_messages", "no subscription");
+        goto done;
+    }
+    t0 = bench_time();
+    while (sent < n) {
+        long burst = n - sent < BENCH_BURST ? n - sent : BENCH_BURST;
+        for (i = 0; i < burst; i++)
+            redisAppendCommand(c, "PUBLISH %s %ld", BENCH_PREFIX "channel", sent + i);
+        for (i = 0; i < burst; i++) {
+            void *reply;
+            if (redisGetReply(c, &reply) == REDIS_OK) freeReplyObject(reply);
+        }
+        sent += burst;
+        pdstub_step(0);
+    }
+    if (!bench_wait(&b.messages, n)) {
+        bench_fail("spuredis_messages", "timeout");
+    } else {
+        bench_result("spuredis_messages", "messages", b.messages, bench_time() - t0, 0);
+    }
+done:
+    if (c) redisFree(c);
+    if (x) pd_free((t_pd *)x);
+}
+
+/* writes a generated csv file of the given type, returns its entries */
+static long bench_csvfile(const char *filename, const char *type, long rows)
+{
+    FILE *f = fopen(filename, "w");
+    long i, j, entries = 0;
+    if (f == NULL) return -1;
+    if (strcmp(type, "hash") == 0) fprintf(f, "PERSON,AGE,CITY\n");
+    for (i = 0; i < rows; i++) {
+        fprintf(f, BENCH_PREFIX "%s:%ld", type, i);
+        if (strcmp(type, "string") == 0) {
+            fprintf(f, ",value-%ld", i);
+        } else if (strcmp(type, "zset") == 0) {
+            for (j = 0; j < 5; j++) fprintf(f, ",%ld,member-%ld", j, j);
+        } else if (strcmp(type, "hash") == 0) {
+            fprintf(f, ",%ld,city-%ld", i % 100, i % 10);
+        } else {
+            for (j = 0; j < 10; j++) fprintf(f, ",item-%ld", j);
+        }
+        fputc('\n', f);
+        entries++;
+    }
+    fclose(f);
+    return entries;
+}
+
+/* puredis csv load, in place or on worker threads */
+static void bench_csv(const char *type, long rows, int threads)
+{
+    char name[64], filename[256];
+    t_redis *x = bench_new("puredis");
+    t_atom argv[2];
+    double t0;
+    snprintf(name, sizeof(name), threads ? "csv_%s_threaded" : "csv_%s", type);
+    snprintf(filename, sizeof(filename), "/tmp/puredis-bench-%s.csv", type);
+    if (x == NULL || x->conn_state != CONN_UP) {
+        bench_fail(name, "no connection");
+        if (x) pd_free((t_pd *)x);
+        return;
+    }
+    if (bench_csvfile(filename, type, rows) < 0) {
+        bench_fail(name, "can not write csv file");
+        pd_free((t_pd *)x);
+        return;
+    }
+    puredis_csvopt(x, gensym("threads"), threads);
+    b.target = x;
+    b.status = NULL;
+    b.entries = 0;
+    SETSYMBOL(&argv[0], gensym(filename));
+    SETSYMBOL(&argv[1], gensym(type));
+    t0 = bench_time();
+    puredis_csv(x, gensym("csv"), 2, argv);
+    while (b.status != gensym("csv-load-status") && x->csvload) pdstub_step(10);
+    if (b.status != gensym("csv-load-status")) {
+        bench_fail(name, "no csv-load-status");
+    } else {
+        bench_result(name, "entries", b.entries, bench_time() - t0, 0);
+    }
+    pd_free((t_pd *)x);
+    remove(filename);
+}
+
+/* appends a bulk string to a RESP buffer */
+static char *bench_bulk(char *p, long value)
+{
+    char digits[32];
+    int len = snprintf(digits, sizeof(digits), "v%ld", value);
+    return p + sprintf(p, "$%d\r\n%s\r\n", len, digits);
+}
+
+/* reply flattening: large flat and nested array replies are read from RESP
+ * buffers, only redis_parseReply is timed and the server is not used */
+static void bench_flatten(const char *name, long count, long nested, int iterations)
+{
+    t_redis *x = bench_new("puredis");
+    char *buf = malloc((count * (nested ? nested : 1)) * 32 + count * 16 + 32), *p = buf;
+    long i, j, elements = 0;
+    int k, done = 0;
+    double total = 0;
+    if (x == NULL || buf == NULL) {
+        bench_fail(name, "no memory");
+        free(buf);
+        if (x) pd_free((t_pd *)x);
+        return;
+    }
+    p += sprintf(p, "*%ld\r\n", count);
+    for (i = 0; i < count; i++) {
+        if (nested) {
+            p += sprintf(p, "*%ld\r\n", nested);
+            for (j = 0; j < nested; j++) p = bench_bulk(p, j);
+        } else {
+            p = bench_bulk(p, i);
+        }
+    }
+    elements = count * (nested ? nested : 1);
+    b.target = x;
+    for (k = 0; k < iterations; k++) {
+        redisReader *reader = redisReaderCreate();
+        void *reply = NULL;
+        double t0;
+        redisReaderFeed(reader, buf, p - buf);
+        if (redisReaderGetReply(reader, &reply) != REDIS_OK || reply == NULL) {
+            redisReaderFree(reader);
+            break;
+        }
+        t0 = bench_time();
+        redis_parseReply(x, (redisReply *)reply);
+        b.lat[k] = bench_time() - t0;
+        total += b.lat[k];
+        redisReaderFree(reader);
+        done++;
+    }
+    if (done < iterations) {
+        bench_fail(name, "could not read reply");
+    } else {
+        bench_result(name, "elements", elements * done, total, done);
+    }
+    free(buf);
+    pd_free((t_pd *)x);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *types[] = { "string", "list", "set", "zset", "hash" };
+    long n;
+    size_t i;
+    snprintf(b.host, sizeof(b.host), "%s", argc > 1 ? argv[1] : "127.0.0.1");
+    b.port = argc > 2 ? atoi(argv[2]) : 6379;
+    b.scale = argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 1;
+    n = 20000L * b.scale;
+    b.lat = malloc(n * sizeof(double));
+    if (b.lat == NULL) return 1;
+
+    pdstub_sethook(bench_hook);
+    puredis_setup();
+
+    bench_sync("puredis_set", "SET", n);
+    bench_sync("puredis_get", "GET", n);
+    bench_pipeline(n * 5);
+    bench_pubsub(n * 5);
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        bench_csv(types[i], n / 2, 0);
+    bench_csv("string", n * 5, 4);
+    bench_flatten("flatten_flat", 100000, 0, 10 * b.scale);
+    bench_flatten("flatten_nested", 10000, 10, 10 * b.scale);
+
+    bench_cleanup();
+    free(b.lat);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+Minimal m_pd.h for the puredis benchmark harness: only what libpuredis.c
+uses, implemented by pdstub.c.  Never installed nor used by the externals,
+which build against the real Pd headers.
+*/
+
+#ifndef M_PD_H
+#define M_PD_H
+
+#include <stddef.h>
+
+#define PD_MAJOR_VERSION 0
+#define PD_MINOR_VERSION 43
+#define MAXPDSTRING 1000
+#define EXTERN extern
+
+typedef float t_float;
+typedef float t_floatarg;
+typedef float t_sample;
+typedef long t_int;
+
+typedef struct _class t_class;
+typedef t_class *t_pd;
+typedef struct _outlet t_outlet;
+typedef struct _inlet t_inlet;
+typedef struct _clock t_clock;
+typedef struct _garray t_garray;
+typedef struct _binbuf t_binbuf;
+
+typedef struct _symbol {
+    char *s_name;
+    t_pd *s_thing;
+    struct _symbol *s_next;
+} t_symbol;
+
+typedef struct _gobj {
+    t_pd g_pd;
+    struct _gobj *g_next;
+} t_gobj;
+
+typedef struct _text {
+    t_gobj te_g;
+    t_binbuf *te_binbuf;
+    t_outlet *te_outlet;
+    t_inlet *te_inlet;
+} t_text;
+
+#define ob_outlet te_outlet
+#define ob_pd te_g.g_pd
+typedef t_text t_object;
+
+typedef enum {
+    A_NULL, A_FLOAT, A_SYMBOL, A_POINTER, A_SEMI, A_COMMA,
+    A_DEFFLOAT, A_DEFSYM, A_DOLLAR, A_DOLLSYM, A_GIMME, A_CANT
+} t_atomtype;
+
+typedef union word {
+    t_float w_float;
+    t_symbol *w_symbol;
+    int w_index;
+} t_word;
+
+typedef struct _atom {
+    t_atomtype a_type;
+    union word a_w;
+} t_atom;
+
+typedef void *(*t_newmethod)(void);
+typedef void (*t_method)(void);
+typedef t_int *(*t_perfroutine)(t_int *args);
+typedef void (*t_fdpollfn)(void *ptr, int fd);
+
+typedef struct _signal {
+    int s_n;
+    t_sample *s_vec;
+    t_float s_sr;
+} t_signal;
+
+#define CLASS_DEFAULT 0
+#define SETFLOAT(atom, f) ((atom)->a_type = A_FLOAT, (atom)->a_w.w_float = (f))
+#define SETSYMBOL(atom, s) ((atom)->a_type = A_SYMBOL, (atom)->a_w.w_symbol = (s))
+
+EXTERN t_symbol s_, s_list, s_float, s_symbol, s_bang, s_signal;
+EXTERN t_class *garray_class;
+
+EXTERN t_symbol *gensym(const char *s);
+EXTERN void post(const char *fmt, ...);
+EXTERN void error(const char *fmt, ...);
+EXTERN void pd_error(void *object, const char *fmt, ...);
+
+EXTERN t_pd *pd_new(t_class *cls);
+EXTERN void pd_free(t_pd *x);
+EXTERN t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+    size_t size, int flags, t_atomtype arg1, ...);
+EXTERN void class_addmethod(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...);
+EXTERN void class_addbang(t_class *c, t_method fn);
+EXTERN void class_sethelpsymbol(t_class *c, t_symbol *s);
+EXTERN void class_domainsignalin(t_class *c, int onset);
+#define class_addbang(x, y) class_addbang((x), (t_method)(y))
+#define CLASS_MAINSIGNALIN(c, type, field) class_domainsignalin(c, (char *)(&((type *)0)->field) - (char *)0)
+
+EXTERN t_outlet *outlet_new(t_object *owner, t_symbol *s);
+EXTERN void outlet_bang(t_outlet *x);
+EXTERN void outlet_float(t_outlet *x, t_float f);
+EXTERN void outlet_symbol(t_outlet *x, t_symbol *s);
+EXTERN void outlet_list(t_outlet *x, t_symbol *s, int argc, t_atom *argv);
+EXTERN void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv);
+EXTERN void pd_float(t_pd *x, t_float f);
+EXTERN void pd_symbol(t_pd *x, t_symbol *s);
+EXTERN void pd_list(t_pd *x, t_symbol *s, int argc, t_atom *argv);
+
+EXTERN t_clock *clock_new(void *owner, t_method fn);
+EXTERN void clock_set(t_clock *x, double systime);
+EXTERN void clock_delay(t_clock *x, double delaytime);
+EXTERN void clock_unset(t_clock *x);
+EXTERN void clock_free(t_clock *x);
+EXTERN double clock_getlogicaltime(void);
+EXTERN double clock_gettimesince(double prevsystime);
+EXTERN double sys_getrealtime(void);
+EXTERN void sys_addpollfn(int fd, t_fdpollfn fn, void *ptr);
+EXTERN void sys_rmpollfn(int fd);
+
+EXTERN void atom_string(t_atom *a, char *buf, unsigned int bufsize);
+EXTERN t_float atom_getfloat(t_atom *a);
+EXTERN t_int atom_getint(t_atom *a);
+EXTERN t_symbol *atom_getsymbol(t_atom *a);
+EXTERN t_float atom_getfloatarg(int which, int argc, t_atom *argv);
+EXTERN t_symbol *atom_getsymbolarg(int which, int argc, t_atom *argv);
+
+EXTERN t_pd *pd_findbyclass(t_symbol *s, t_class *c);
+EXTERN int garray_getfloatwords(t_garray *x, int *size, t_word **vec);
+EXTERN void garray_redraw(t_garray *x);
+EXTERN int garray_npoints(t_garray *x);
+EXTERN void garray_resize(t_garray *x, t_floatarg f);
+EXTERN void dsp_add(t_perfroutine f, int n, ...);
+EXTERN t_float sys_getsr(void);
+
+#endif /* M_PD_H */
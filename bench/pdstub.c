@@ -0,0 +1,458 @@
+/*
+pdstub: just enough of the Pd API to run puredis objects outside of Pd for
+the benchmark harness.  Methods are called directly by the benchmark, outlets
+and receivers go to a single hook, clocks run on the real time and polled
+fds are watched with select() by pdstub_step.
+*/
+
+#include "pdstub.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/select.h>
+
+#define SYMTAB_SIZE 4096
+#define POLL_MAX 64
+
+struct _class {
+    t_symbol *c_name;
+    size_t c_size;
+    t_method c_free;
+};
+
+struct _outlet {
+    t_object *o_owner;
+    int o_index;
+    struct _outlet *o_next;
+};
+
+struct _clock {
+    void *c_owner;
+    t_method c_fn;
+    double c_settime;
+    int c_set;
+    unsigned long c_tick;
+    struct _clock *c_next;
+};
+
+typedef struct _pollfn {
+    int p_fd;
+    t_fdpollfn p_fn;
+    void *p_ptr;
+} t_pollfn;
+
+t_symbol s_ = {"", 0, 0};
+t_symbol s_list = {"list", 0, 0};
+t_symbol s_float = {"float", 0, 0};
+t_symbol s_symbol = {"symbol", 0, 0};
+t_symbol s_bang = {"bang", 0, 0};
+t_symbol s_signal = {"signal", 0, 0};
+t_class *garray_class = NULL;
+
+static t_symbol *symtab[SYMTAB_SIZE];
+static t_outlet *outlets = NULL;
+static t_clock *clocks = NULL;
+static t_pollfn polls[POLL_MAX];
+static int npolls = 0;
+static t_pdstub_hook hook = NULL;
+static double start = -1;
+static unsigned long ticks = 0;
+
+void pdstub_sethook(t_pdstub_hook fn)
+{
+    hook = fn;
+}
+
+double pdstub_now(void)
+{
+    struct timespec ts;
+    double now;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000. + ts.tv_nsec / 1000000.;
+    if (start < 0) start = now;
+    return now - start;
+}
+
+/* symbols */
+
+t_symbol *gensym(const char *s)
+{
+    unsigned int hash = 5381;
+    const char *p;
+    t_symbol *sym;
+    for (p = s; *p; p++) hash = hash * 33 + (unsigned char)*p;
+    for (sym = symtab[hash % SYMTAB_SIZE]; sym; sym = sym->s_next) {
+        if (strcmp(sym->s_name, s) == 0) return sym;
+    }
+    sym = calloc(1, sizeof(t_symbol));
+    sym->s_name = strdup(s);
+    sym->s_next = symtab[hash % SYMTAB_SIZE];
+    symtab[hash % SYMTAB_SIZE] = sym;
+    return sym;
+}
+
+/* console */
+
+void post(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+void error(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fputs("error: ", stderr);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+void pd_error(void *object, const char *fmt, ...)
+{
+    va_list ap;
+    (void)object;
+    va_start(ap, fmt);
+    fputs("error: ", stderr);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/* classes and objects, methods are called directly so only the
+ * allocation size and the free method are kept */
+
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+    size_t size, int flags, t_atomtype arg1, ...)
+{
+    t_class *c = calloc(1, sizeof(t_class));
+    (void)newmethod; (void)flags; (void)arg1;
+    c->c_name = name;
+    c->c_size = size;
+    c->c_free = freemethod;
+    return c;
+}
+
+void class_addmethod(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...)
+{
+    (void)c; (void)fn; (void)sel; (void)arg1;
+}
+
+void (class_addbang)(t_class *c, t_method fn)
+{
+    (void)c; (void)fn;
+}
+
+void class_sethelpsymbol(t_class *c, t_symbol *s)
+{
+    (void)c; (void)s;
+}
+
+void class_domainsignalin(t_class *c, int onset)
+{
+    (void)c; (void)onset;
+}
+
+t_pd *pd_new(t_class *cls)
+{
+    t_pd *x = calloc(1, cls->c_size);
+    *x = cls;
+    return x;
+}
+
+void pd_free(t_pd *x)
+{
+    t_outlet **o = &outlets;
+    if ((*x)->c_free) ((void (*)(t_pd *))(*x)->c_free)(x);
+    while (*o) {
+        if ((t_pd *)(*o)->o_owner == x) {
+            t_outlet *dead = *o;
+            *o = dead->o_next;
+            free(dead);
+        } else {
+            o = &(*o)->o_next;
+        }
+    }
+    free(x);
+}
+
+/* outlets and receivers all end in the hook */
+
+t_outlet *outlet_new(t_object *owner, t_symbol *s)
+{
+    t_outlet *o = calloc(1, sizeof(t_outlet)), *p;
+    (void)s;
+    o->o_owner = owner;
+    for (p = outlets; p; p = p->o_next) {
+        if (p->o_owner == owner) o->o_index++;
+    }
+    o->o_next = outlets;
+    outlets = o;
+    if (owner->te_outlet == NULL) owner->te_outlet = o;
+    return o;
+}
+
+void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+{
+    if (hook) hook(x->o_owner, x->o_index, s, argc, argv);
+}
+
+void outlet_list(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+{
+    outlet_anything(x, s, argc, argv);
+}
+
+void outlet_bang(t_outlet *x)
+{
+    outlet_anything(x, &s_bang, 0, NULL);
+}
+
+void outlet_float(t_outlet *x, t_float f)
+{
+    t_atom a;
+    SETFLOAT(&a, f);
+    outlet_anything(x, &s_float, 1, &a);
+}
+
+void outlet_symbol(t_outlet *x, t_symbol *s)
+{
+    t_atom a;
+    SETSYMBOL(&a, s);
+    outlet_anything(x, &s_symbol, 1, &a);
+}
+
+void pd_list(t_pd *x, t_symbol *s, int argc, t_atom *argv)
+{
+    if (hook) hook(x, -1, s, argc, argv);
+}
+
+void pd_float(t_pd *x, t_float f)
+{
+    t_atom a;
+    SETFLOAT(&a, f);
+    pd_list(x, &s_float, 1, &a);
+}
+
+void pd_symbol(t_pd *x, t_symbol *s)
+{
+    t_atom a;
+    SETSYMBOL(&a, s);
+    pd_list(x, &s_symbol, 1, &a);
+}
+
+/* clocks, the logical time is the real time in ms */
+
+t_clock *clock_new(void *owner, t_method fn)
+{
+    t_clock *x = calloc(1, sizeof(t_clock));
+    x->c_owner = owner;
+    x->c_fn = fn;
+    x->c_next = clocks;
+    clocks = x;
+    return x;
+}
+
+void clock_set(t_clock *x, double systime)
+{
+    x->c_settime = systime;
+    x->c_set = 1;
+    x->c_tick = ticks;
+}
+
+void clock_delay(t_clock *x, double delaytime)
+{
+    clock_set(x, pdstub_now() + (delaytime > 0 ? delaytime : 0));
+}
+
+void clock_unset(t_clock *x)
+{
+    x->c_set = 0;
+}
+
+void clock_free(t_clock *x)
+{
+    t_clock **c;
+    for (c = &clocks; *c; c = &(*c)->c_next) {
+        if (*c == x) {
+            *c = x->c_next;
+            break;
+        }
+    }
+    free(x);
+}
+
+double clock_getlogicaltime(void)
+{
+    return pdstub_now();
+}
+
+double clock_gettimesince(double prevsystime)
+{
+    return pdstub_now() - prevsystime;
+}
+
+double sys_getrealtime(void)
+{
+    return pdstub_now() / 1000.;
+}
+
+/* polled fds */
+
+void sys_addpollfn(int fd, t_fdpollfn fn, void *ptr)
+{
+    int i;
+    for (i = 0; i < npolls && polls[i].p_fd != fd; i++);
+    if (i == npolls) {
+        if (npolls == POLL_MAX) {
+            error("pdstub: too many polled fds"); return;
+        }
+        npolls++;
+    }
+    polls[i].p_fd = fd;
+    polls[i].p_fn = fn;
+    polls[i].p_ptr = ptr;
+}
+
+void sys_rmpollfn(int fd)
+{
+    int i;
+    for (i = 0; i < npolls; i++) {
+        if (polls[i].p_fd == fd) {
+            polls[i] = polls[--npolls];
+            return;
+        }
+    }
+}
+
+/* one scheduler tick: fd callbacks of a snapshot of the polled fds, since
+ * they may add or remove fds, then the clocks that are due, a clock set
+ * during the tick waits for the next one */
+void pdstub_step(double ms)
+{
+    t_pollfn ready[POLL_MAX];
+    struct timeval tv;
+    fd_set readset;
+    t_clock *c;
+    double now = pdstub_now(), wait = ms;
+    int i, nready = 0, maxfd = -1;
+
+    for (c = clocks; c; c = c->c_next) {
+        if (c->c_set && c->c_settime - now < wait) wait = c->c_settime - now;
+    }
+    if (wait < 0) wait = 0;
+
+    FD_ZERO(&readset);
+    for (i = 0; i < npolls; i++) {
+        FD_SET(polls[i].p_fd, &readset);
+        if (polls[i].p_fd > maxfd) maxfd = polls[i].p_fd;
+    }
+    tv.tv_sec = (long)(wait / 1000);
+    tv.tv_usec = (long)((wait - tv.tv_sec * 1000.) * 1000);
+    if (select(maxfd + 1, &readset, NULL, NULL, &tv) > 0) {
+        for (i = 0; i < npolls; i++) {
+            if (FD_ISSET(polls[i].p_fd, &readset)) ready[nready++] = polls[i];
+        }
+        for (i = 0; i < nready; i++) {
+            int j;
+            /* skip the fds a previous callback removed */
+            for (j = 0; j < npolls && polls[j].p_fd != ready[i].p_fd; j++);
+            if (j < npolls) polls[j].p_fn(polls[j].p_ptr, polls[j].p_fd);
+        }
+    }
+
+    now = pdstub_now();
+    ticks++;
+    for (c = clocks; c; c = c ? c->c_next : clocks) {
+        if (c->c_set && c->c_tick != ticks && c->c_settime <= now) {
+            c->c_set = 0;
+            ((void (*)(void *))c->c_fn)(c->c_owner);
+            /* the callback may have freed clocks, start over */
+            c = NULL;
+        }
+    }
+}
+
+/* atoms */
+
+t_float atom_getfloat(t_atom *a)
+{
+    return a->a_type == A_FLOAT ? a->a_w.w_float : 0;
+}
+
+t_int atom_getint(t_atom *a)
+{
+    return (t_int)atom_getfloat(a);
+}
+
+t_symbol *atom_getsymbol(t_atom *a)
+{
+    return a->a_type == A_SYMBOL ? a->a_w.w_symbol : &s_float;
+}
+
+t_float atom_getfloatarg(int which, int argc, t_atom *argv)
+{
+    return which < argc ? atom_getfloat(argv + which) : 0;
+}
+
+t_symbol *atom_getsymbolarg(int which, int argc, t_atom *argv)
+{
+    return which < argc ? atom_getsymbol(argv + which) : &s_;
+}
+
+void atom_string(t_atom *a, char *buf, unsigned int bufsize)
+{
+    if (a->a_type == A_FLOAT) {
+        snprintf(buf, bufsize, "%g", a->a_w.w_float);
+    } else if (a->a_type == A_SYMBOL) {
+        snprintf(buf, bufsize, "%s", a->a_w.w_symbol->s_name);
+    } else if (bufsize) {
+        buf[0] = '\0';
+    }
+}
+
+/* no arrays and no dsp outside of Pd */
+
+t_pd *pd_findbyclass(t_symbol *s, t_class *c)
+{
+    (void)s; (void)c;
+    return NULL;
+}
+
+int garray_getfloatwords(t_garray *x, int *size, t_word **vec)
+{
+    (void)x; (void)size; (void)vec;
+    return 0;
+}
+
+void garray_redraw(t_garray *x)
+{
+    (void)x;
+}
+
+int garray_npoints(t_garray *x)
+{
+    (void)x;
+    return 0;
+}
+
+void garray_resize(t_garray *x, t_floatarg f)
+{
+    (void)x; (void)f;
+}
+
+void dsp_add(t_perfroutine f, int n, ...)
+{
+    (void)f; (void)n;
+}
+
+t_float sys_getsr(void)
+{
+    return 44100;
+}
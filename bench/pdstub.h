@@ -0,0 +1,22 @@
+/*
+pdstub: the scheduler side of the headless Pd API used by the benchmark.
+*/
+
+#ifndef PDSTUB_H
+#define PDSTUB_H
+
+#include "m_pd.h"
+
+/* every outlet and receiver message, outlet is -1 for a receiver */
+typedef void (*t_pdstub_hook)(void *owner, int outlet, t_symbol *s, int argc, t_atom *argv);
+
+void pdstub_sethook(t_pdstub_hook fn);
+
+/* waits at most ms for a polled fd or the next clock, then runs the fd
+ * callbacks of readable fds and the clocks that are due */
+void pdstub_step(double ms);
+
+/* milliseconds since the first call, also the logical time */
+double pdstub_now(void);
+
+#endif /* PDSTUB_H */
@@ -20,15 +20,100 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "m_pd.h"
 #include <hiredis.h>
 #include <async.h>
+#include <sds.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <csv.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define PUREDIS_MAJOR 0
 #define PUREDIS_MINOR 5
 #define PUREDIS_PATCH 3
 
-#define MAX_ARRAY_SIZE 512
+#define MAX_ARRAY_SIZE 512          /* initial and resting size of the reply atom buffer */
+#define CHUNK_DEPTH 16              /* nesting walked by the chunked reply iterator */
+#define DRAIN_MAX_REPLIES 1000      /* apuredis/spuredis default replies per tick */
+#define DRAIN_BUDGET_USEC 500       /* apuredis/spuredis default time budget per tick */
+#define THREAD_RING_SIZE 1024       /* puredis io thread default queue size */
+#define CSV_WINDOW 1000             /* csv loader default commands in flight */
+#define CSV_ARGCAP 1024             /* csv loader default arguments per command */
+#define CSV_PROGRESS 250            /* threaded csv loader default progress period in ms */
+#define CSVDUMP_COUNT 1000          /* csv dump keys asked per SCAN */
+#define CSVDUMP_BUFFER 65536        /* csv dump write buffer */
+#define ARRAY_BATCH 4096            /* fromarray list values per RPUSH */
+#define SHARD_VNODES 160            /* consistent hash ring points per shard */
+#define CLUSTER_SLOTS 16384         /* redis cluster hash slots */
+#define CLUSTER_REDIRECTS 5         /* MOVED/ASK hops followed per command */
+#define CLUSTER_REFRESH 1000        /* minimum ms between slot map refreshes */
+#define SEQ_DISCARD ((unsigned long)-1)  /* shard reply dropped, ASKING */
+#define SEQ_SLOTS ((unsigned long)-2)    /* shard reply is the CLUSTER SLOTS slot map */
+#define CONNECT_TIMEOUT 1000        /* default ms allowed for a connection attempt */
+#define CONNECT_POLL 10             /* ms between checks of a connection in progress */
+#define RECONNECT_MIN 100           /* first reconnection delay in ms, doubled per failure */
+#define RECONNECT_MAX 10000         /* longest reconnection delay in ms */
+#define REPLAY_MAX 1024             /* default commands kept while disconnected */
+#define STREAM_RING 65536           /* redisstream~/redisplay~ sample ring size */
+#define STREAM_BATCH 1024           /* redisstream~ default samples per stream entry */
+#define STREAM_MAXLEN 1000          /* redisstream~ default approximate stream length */
+#define STREAM_JITTER 50            /* redisplay~ default prebuffer in ms */
+#define XREAD_COUNT 100             /* xpuredis default entries per XREADGROUP */
+#define XACK_GROUP 64               /* xpuredis entry ids per pipelined XACK */
+#define STATS_COMMANDS 64           /* command names with their own latency histogram */
+#define STATS_SUB_BITS 3            /* histogram buckets per power of two, 1 << bits */
+#define STATS_BUCKETS 512           /* covers every 64 bit microsecond value */
+#define SYMBOLS_MAX 65536           /* distinct symbols counted by symbols on */
+
+/* reply destinations of commands in flight */
+#define REPLY_OUTLET 0
+#define REPLY_ARRAY 1
+#define REPLY_DISCARD 2
+#define REPLY_BATCH 3
+
+/* batch flags */
+#define BATCH_MULTI 1
+#define BATCH_TAGGED 2
+
+/* connection states of single server objects */
+#define CONN_DOWN 0
+#define CONN_CONNECTING 1
+#define CONN_UP 2
+
+/* key spec flags */
+#define KEYS_STREAMS 1      /* keys: the first half of the arguments after STREAMS */
+#define KEYS_STORE 2        /* one more key after a STORE or STOREDIST argument */
+#define KEYS_REJECT 4       /* neither one shard nor every shard can answer it */
+
+/* replies expected on the xpuredis ack connection */
+#define XS_ACK 0
+#define XS_INFO 1
+
+/* csv load types */
+#define LOAD_STRING 0
+#define LOAD_LIST 1
+#define LOAD_SET 2
+#define LOAD_ZSET 3
+#define LOAD_HASH 4
 
 /************************************
  * Puredis                          *
@@ -51,6 +136,334 @@ static t_class *apuredis_class;
  ************************************/
 static t_class *spuredis_class;
 
+/************************************
+ * Xpuredis                         *
+ *  Redis Streams consumer for PD   *
+ *                                  *
+ ************************************/
+static t_class *xpuredis_class;
+
+/************************************
+ * Redisstream~ / Redisplay~        *
+ *  Redis Streams signal externals  *
+ *                                  *
+ ************************************/
+static t_class *redisstream_class;
+static t_class *redisplay_class;
+
+/* single producer / single consumer lock-free ring of pointers */
+typedef struct _redis_ring {
+    void ** slots;
+    unsigned int mask;
+    unsigned int head;      /* written by the producer only */
+    unsigned int tail;      /* written by the consumer only */
+} t_redis_ring;
+
+/* csv loader state: each csv row becomes one variadic command */
+typedef struct _redis_loader {
+    redisContext * redis;
+    t_symbol * ltype;
+    int lkind;
+    const char * lcmd;
+    int lnumload;
+    int lnumerror;
+    int lnew;
+    int lskip;
+    int lcount;
+    int lheader;
+    /* worker vars */
+    int lworker;
+    int * labort;
+    size_t lbytes;
+    int lpublines;
+    int lpubload;
+    int lpuberror;
+    size_t lpubbytes;
+    int lerrcount;
+    char lerrstr[MAXPDSTRING];
+    /* pipeline vars */
+    int lwindow;
+    int linflight;
+    int * lvalues;
+    int lvhead;
+    /* command builder vars */
+    int largcap;
+    int largc;
+    int largsize;
+    int lvals;
+    const char ** largv;
+    size_t * llengths;
+    size_t * loffsets;
+    char * larena;
+    size_t larenasize;
+    size_t larenapos;
+    size_t lkeyend;
+    /* hash loader vars */
+    int hargc;
+    char ** hheaders;
+    size_t * hlengths;
+    int hbufsize;
+    int hcount;
+    /* zset loader vars */
+    int zcount;
+} t_redis_loader;
+
+/* csv load worker: one chunk of the file sent on its own connection */
+typedef struct _redis_csvworker {
+    pthread_t thread;
+    t_redis_loader loader;
+    const char * data;
+    size_t size;
+    const char * host;
+    int port;
+    int done;
+} t_redis_csvworker;
+
+/* csv load split among worker threads */
+typedef struct _redis_csvload {
+    const char * map;
+    size_t mapsize;
+    int nworkers;
+    int running;
+    t_redis_csvworker * workers;
+    int headerlines;
+    int skipped;            /* lines left without a worker, counted as errors */
+    int abort;
+    double last;
+    size_t lastbytes;
+} t_redis_csvload;
+
+/* csv dump: the keyspace walked with SCAN on a worker thread, each key of
+ * the dumped type written as one row of the csv loader format */
+typedef struct _redis_csvdump {
+    pthread_t thread;
+    redisContext * redis;
+    const char * host;
+    int port;
+    int kind;
+    const char * type;
+    char * pattern;
+    FILE * out;
+    FILE * body;            /* hash rows wait here until the header is known */
+    char * buf;
+    size_t buflen;
+    char * match;           /* keys of the SCAN batch holding the dumped type */
+    size_t matchsize;
+    /* keys already dumped, SCAN may return one twice: open addressing set */
+    char ** seen;
+    size_t * seenlengths;
+    size_t seencount;
+    size_t seensize;
+    /* hash header: the fields of every dumped hash in order of appearance */
+    char ** hfields;
+    size_t * hlengths;
+    redisReply ** hrow;
+    int hcount;
+    int hsize;
+    /* worker counters and their copies published to the pd thread */
+    int keys;
+    int rows;
+    int entries;
+    int errors;
+    size_t bytes;
+    int pubkeys;
+    int pubrows;
+    int pubentries;
+    int puberrors;
+    size_t pubbytes;
+    int abort;
+    int done;
+    char errstr[MAXPDSTRING];
+    double last;
+    size_t lastbytes;
+} t_redis_csvdump;
+
+/* reply destination of a command in flight, sharded commands wait in it
+ * until every shard they were sent to has replied */
+typedef struct _redis_entry {
+    int kind;
+    t_symbol * array;
+    int slots;
+    redisReply * reply;
+    char * cmd;             /* kept to follow cluster redirects or as EVAL after NOSCRIPT */
+    size_t cmdlen;
+    int redirects;
+    int batch;              /* batch flags, reply collects every batch reply */
+    int stat;               /* latency histogram + 1, 0 when not measured */
+    double start;
+} t_redis_entry;
+
+/* latency histogram of one command name, buckets allocated on first use */
+typedef struct _redis_stat {
+    char name[24];
+    uint32_t * hist;
+    double count;
+    uint64_t max;
+} t_redis_stat;
+
+/* object waiting for a reply on a shared connection, NULL drops it */
+typedef struct _redis_owner {
+    struct _redis * owner;
+    unsigned long seq;
+} t_redis_owner;
+
+/* connection shared by every object created with the same shared
+ * host:port:db, opened on first use, replies go back in command order */
+typedef struct _redis_shared {
+    t_symbol * key;
+    char * host;
+    int port;
+    int db;
+    int refs;
+    redisContext * redis;
+    int connecting;
+    double started;
+    int poll_fd;
+    t_clock * clock;
+    t_redis_owner * owners;
+    int owners_size;
+    int owners_head;
+    int owners_count;
+    struct _redis_shared * next;
+} t_redis_shared;
+
+/* lua script uploaded by script load, called by its sha1 */
+typedef struct _redis_script {
+    t_symbol * name;
+    t_symbol * sha;
+    char * body;
+    size_t len;
+} t_redis_script;
+
+/* formatted command kept for later: replayed once connected or sent with its batch */
+typedef struct _redis_replay {
+    char * cmd;
+    size_t len;
+    int kind;
+    t_symbol * array;
+} t_redis_replay;
+
+/* MOVED or ASK redirect waiting to be followed */
+typedef struct _redis_redirect {
+    unsigned long seq;
+    int ask;
+    int slot;
+    char host[64];
+    int port;
+} t_redis_redirect;
+
+/* one server of a sharded object, replies come back in the order of its
+ * sequence numbers of pending entries */
+typedef struct _redis_conn {
+    redisContext * redis;
+    char * host;
+    int port;
+    int poll_fd;
+    unsigned long * seqs;
+    int seq_size;
+    int seq_head;
+    int seq_count;
+} t_redis_conn;
+
+/* consistent hash ring point */
+typedef struct _redis_point {
+    uint32_t hash;
+    int conn;
+} t_redis_point;
+
+/* key positions of a command: first and last key (-1 to the end, -2 all
+ * but the last argument), key step, the position of a numkeys argument and
+ * KEYS_ flags, step 0 marks keyless commands sent to every shard */
+typedef struct _redis_keyspec {
+    const char * name;
+    int first;
+    int last;
+    int step;
+    int numkeys;
+    int flags;
+} t_redis_keyspec;
+
+static const t_redis_keyspec redis_keyspecs[] = {
+    { "mget", 1, -1, 1, 0, 0 }, { "mset", 1, -1, 2, 0, 0 }, { "msetnx", 1, -1, 2, 0, 0 },
+    { "del", 1, -1, 1, 0, 0 }, { "exists", 1, -1, 1, 0, 0 }, { "unlink", 1, -1, 1, 0, 0 },
+    { "touch", 1, -1, 1, 0, 0 }, { "rename", 1, 2, 1, 0, 0 }, { "renamenx", 1, 2, 1, 0, 0 },
+    { "rpoplpush", 1, 2, 1, 0, 0 }, { "brpoplpush", 1, 2, 1, 0, 0 }, { "lmove", 1, 2, 1, 0, 0 },
+    { "smove", 1, 2, 1, 0, 0 }, { "blpop", 1, -2, 1, 0, 0 }, { "brpop", 1, -2, 1, 0, 0 },
+    { "sdiff", 1, -1, 1, 0, 0 }, { "sinter", 1, -1, 1, 0, 0 }, { "sunion", 1, -1, 1, 0, 0 },
+    { "sdiffstore", 1, -1, 1, 0, 0 }, { "sinterstore", 1, -1, 1, 0, 0 }, { "sunionstore", 1, -1, 1, 0, 0 },
+    { "pfcount", 1, -1, 1, 0, 0 }, { "pfmerge", 1, -1, 1, 0, 0 }, { "bitop", 2, -1, 1, 0, 0 },
+    { "copy", 1, 2, 1, 0, 0 }, { "lcs", 1, 2, 1, 0, 0 }, { "blmove", 1, 2, 1, 0, 0 },
+    { "zrangestore", 1, 2, 1, 0, 0 }, { "geosearchstore", 1, 2, 1, 0, 0 },
+    { "bzpopmin", 1, -2, 1, 0, 0 }, { "bzpopmax", 1, -2, 1, 0, 0 }, { "watch", 1, -1, 1, 0, 0 },
+    { "zunionstore", 1, 1, 1, 2, 0 }, { "zinterstore", 1, 1, 1, 2, 0 }, { "zdiffstore", 1, 1, 1, 2, 0 },
+    { "zunion", 2, 1, 1, 1, 0 }, { "zinter", 2, 1, 1, 1, 0 }, { "zdiff", 2, 1, 1, 1, 0 },
+    { "zintercard", 2, 1, 1, 1, 0 }, { "sintercard", 2, 1, 1, 1, 0 },
+    { "lmpop", 2, 1, 1, 1, 0 }, { "zmpop", 2, 1, 1, 1, 0 }, { "blmpop", 3, 2, 1, 2, 0 }, { "bzmpop", 3, 2, 1, 2, 0 },
+    { "eval", 3, 2, 1, 2, 0 }, { "evalsha", 3, 2, 1, 2, 0 }, { "eval_ro", 3, 2, 1, 2, 0 },
+    { "evalsha_ro", 3, 2, 1, 2, 0 }, { "fcall", 3, 2, 1, 2, 0 }, { "fcall_ro", 3, 2, 1, 2, 0 },
+    { "object", 2, 2, 1, 0, 0 }, { "memory", 2, 2, 1, 0, 0 },
+    { "xread", 0, 0, 1, 0, KEYS_STREAMS }, { "xreadgroup", 0, 0, 1, 0, KEYS_STREAMS },
+    { "sort", 1, 1, 1, 0, KEYS_STORE }, { "georadius", 1, 1, 1, 0, KEYS_STORE },
+    { "georadiusbymember", 1, 1, 1, 0, KEYS_STORE },
+    { "scan", 0, 0, 1, 0, KEYS_REJECT }, { "randomkey", 0, 0, 1, 0, KEYS_REJECT },
+    { "migrate", 0, 0, 1, 0, KEYS_REJECT }, { "multi", 0, 0, 1, 0, KEYS_REJECT },
+    { "exec", 0, 0, 1, 0, KEYS_REJECT }, { "discard", 0, 0, 1, 0, KEYS_REJECT },
+    { "subscribe", 0, 0, 1, 0, KEYS_REJECT }, { "psubscribe", 0, 0, 1, 0, KEYS_REJECT },
+    { "monitor", 0, 0, 1, 0, KEYS_REJECT },
+    { "ping", 0, 0, 0, 0, 0 }, { "echo", 0, 0, 0, 0, 0 }, { "info", 0, 0, 0, 0, 0 },
+    { "dbsize", 0, 0, 0, 0, 0 }, { "flushdb", 0, 0, 0, 0, 0 }, { "flushall", 0, 0, 0, 0, 0 },
+    { "keys", 0, 0, 0, 0, 0 }, { "select", 0, 0, 0, 0, 0 }, { "save", 0, 0, 0, 0, 0 },
+    { "bgsave", 0, 0, 0, 0, 0 }, { "bgrewriteaof", 0, 0, 0, 0, 0 }, { "config", 0, 0, 0, 0, 0 },
+    { "script", 0, 0, 0, 0, 0 }, { "time", 0, 0, 0, 0, 0 }, { "lastsave", 0, 0, 0, 0, 0 },
+    { NULL, 0, 0, 0, 0, 0 }
+};
+
+/* spuredis channel or pattern delivered to a pd receive name */
+typedef struct _redis_bind {
+    t_symbol * name;
+    t_symbol * recv;
+} t_redis_bind;
+
+/* spuredis message waiting for the end of a drain in conflate mode */
+typedef struct _redis_conflated {
+    t_symbol * pattern;     /* NULL for a channel message */
+    t_symbol * channel;
+    redisReply * reply;
+} t_redis_conflated;
+
+/* key walk state of redis_shardRoute */
+typedef struct _redis_route {
+    struct _redis * x;
+    int shard;
+} t_redis_route;
+
+/* client side cache entry of a GET or HGET reply, key, field and value
+ * in one allocation, chained by key hash and in least recently used order */
+typedef struct _redis_cached {
+    char * key;
+    size_t keylen;
+    size_t fieldlen;
+    int hget;
+    int type;               /* REDIS_REPLY_STRING or REDIS_REPLY_NIL */
+    char * str;
+    size_t len;
+    uint32_t hash;
+    int next;
+    int older;
+    int newer;
+} t_redis_cached;
+
+/* command handed to the puredis io thread, the reply travels back in it */
+typedef struct _redis_job {
+    int argc;
+    const char ** argv;
+    size_t * lengths;
+    redisReply * reply;
+    double written;
+    double read;
+    char errstr[128];
+} t_redis_job;
+
 typedef struct _redis {
     t_object x_obj;
     redisContext * redis;
@@ -58,7 +471,27 @@ typedef struct _redis {
     char * r_host;
     int r_port;
     int out_count;
-    t_atom out[MAX_ARRAY_SIZE];
+    size_t out_size;
+    t_atom * out;
+    int out_busy;
+    
+    /* chunked output vars */
+    int chunk_size;
+    redisReply * chunk_reply;
+    int chunk_depth;
+    redisReply * chunk_stack[CHUNK_DEPTH];
+    size_t chunk_pos[CHUNK_DEPTH];
+    size_t chunk_total;
+    t_clock * chunk_clock;
+    
+    /* reply decoding vars */
+    int decode_numeric;
+    int sym_track;
+    t_symbol ** sym_set;
+    size_t sym_setsize;
+    size_t sym_count;
+    double sym_calls;
+    double sym_numeric;
     
     /* async vars */
     int async;
@@ -67,62 +500,406 @@ typedef struct _redis {
     int async_prev_num;
     int async_run;
     t_clock  *async_clock;
+    int drain_max;
+    double drain_budget;
+    int drain_more;
+    
+    /* pending reply vars */
+    t_redis_entry * pend;
+    int pend_size;
+    int pend_head;
+    int pend_count;
+    unsigned long pend_seq;
+    
+    /* stats vars, latency per command name and counters since the last dump */
+    t_redis_stat * stats;
+    int stats_count;
+    int stat_cmd;
+    double stat_start;
+    double stat_since;
+    double stat_commands;
+    double stat_errors;
+    double stat_written;
+    double stat_read;
+    int stat_peak;
+    
+    /* sharding vars */
+    int nconns;
+    t_redis_conn * conns;
+    t_redis_point * shard_points;
+    int shard_npoints;
+    
+    /* cluster vars */
+    int cluster;
+    short * slot_conn;
+    int slots_stale;
+    int slots_pending;
+    redisReply * slots_reply;
+    double slots_time;
+    t_clock * cluster_clock;
+    t_redis_redirect * redirects;
+    int nredirects;
+    int redirects_size;
+    
+    /* batch vars */
+    int batch_on;
+    int batch_flags;
+    t_redis_replay * batch;
+    int batch_count;
+    int batch_size;
+    
+    /* script cache */
+    t_redis_script * scripts;
+    int nscripts;
+    
+    /* shared connection */
+    t_redis_shared * shared;
+    
+    /* connection vars */
+    int conn_state;
+    int conn_timeout;
+    double conn_started;
+    double conn_delay;
+    int conn_attempts;
+    t_clock * conn_clock;
+    t_outlet * c_out;
+    t_redis_replay * replay;
+    int replay_count;
+    int replay_size;
+    int replay_max;
+    int replay_dropped;
+    t_symbol ** subs;
+    int nsubs;
+    int subs_size;
+    t_symbol ** psubs;
+    int npsubs;
+    int psubs_size;
+    
+    /* spuredis receiver bindings, open addressing on the channel symbol */
+    t_redis_bind * binds;
+    int binds_count;
+    int binds_size;
+    
+    /* spuredis conflation, newest message per channel within a drain */
+    int conflate;
+    t_redis_conflated * conflated;
+    int * conflate_order;
+    int conflate_count;
+    int conflate_size;
+    int conflate_busy;
+    double conflate_dropped;
+    
+    /* xpuredis stream consumer vars */
+    t_symbol * xs_stream;
+    t_symbol * xs_group;
+    t_symbol * xs_consumer;
+    int xs_count;
+    int xs_batch;
+    int xs_autoack;
+    int xs_reading;         /* XREADGROUP in flight */
+    int xs_skip;            /* XGROUP CREATE reply ahead of it */
+    int xs_history;         /* own pending entries are read first, from xs_from */
+    char xs_from[64];
+    char ** xs_acks;
+    int xs_nacks;
+    int xs_acks_size;
+    redisContext * xs_ack;  /* second connection for XACK and XINFO */
+    int xs_ack_fd;
+    int * xs_kinds;
+    int xs_kinds_head;
+    int xs_kinds_count;
+    int xs_kinds_size;
+    t_clock * xs_clock;
+    double xs_read;
+    double xs_acked;
+    
+    /* fd polling vars */
+    int poll_mode;
+    int poll_fd;
+    int flush_more;
+    
+    /* command builder vars */
+    int cmd_size;
+    const char ** cmd_argv;
+    size_t * cmd_lengths;
+    char * cmd_buf;
+    size_t cmd_bufsize;
+    
+    /* io thread vars */
+    int thread_on;
+    int thread_stop;
+    pthread_t thread;
+    pthread_mutex_t thread_mutex;
+    pthread_cond_t thread_cond;
+    t_redis_ring thread_cmds;
+    t_redis_ring thread_replies;
+    
+    /* client cache vars */
+    int cache_max;
+    int cache_count;
+    t_redis_cached * cached;
+    int * cache_buckets;
+    int cache_mask;
+    int cache_free;
+    int cache_newest;
+    int cache_oldest;
+    redisContext * cache_redis;
+    long long cache_id;
+    int cache_fd;
+    double cache_hits;
+    double cache_misses;
+    double cache_evictions;
+    double cache_invalidations;
+    int cache_multi;
     
     /* loader vars */
-    t_symbol * ltype;
-    int lnumload;
-    int lnumerror;
-    char * lcmd;
-    char * lkey;
-    int lnew;
-    int lcount;
-    /* hash loader vars */
-    int hargc;
-    char ** hheaders;
-    int hbufsize;
-    int hcount;
-    /* zset loader vars */
-    int zcount;
-    char * zscore;
+    t_redis_loader loader;
+    int lthreads;
+    int lprogress;
+    t_redis_csvload * csvload;
+    t_clock * csv_clock;
+    t_redis_csvdump * csvdump;
+    t_clock * dump_clock;
 } t_redis;
 
+/* single producer / single consumer lock-free ring of samples */
+typedef struct _redis_sring {
+    t_sample * buf;
+    size_t mask;
+    size_t head;            /* written by the producer only */
+    size_t tail;            /* written by the consumer only */
+} t_redis_sring;
+
+/* redisstream~ writes signal blocks to a stream, redisplay~ plays one back,
+ * the dsp side only touches the sample ring, a thread does the network */
+typedef struct _redisstream {
+    t_object x_obj;
+    t_float x_f;
+    t_outlet * s_out;
+    char * r_host;
+    int r_port;
+    t_symbol * key;
+    t_redis_sring ring;
+    int batch;
+    int maxlen;
+    int jitter_ms;
+    size_t jitter;
+    int playing;
+    /* counters, updated with atomics */
+    size_t entries;
+    size_t dropped;
+    size_t underruns;
+    size_t errors;
+    /* thread vars */
+    int thread_on;
+    int thread_stop;
+    pthread_t thread;
+} t_redisstream;
+
 /* declarations */
 void puredis_setup(void);
 
 /* memory */
-static void freeVectorAndLengths(int argc, char ** vector, size_t * lengths);
+static int redis_reserveCommand(t_redis *x, int argc, size_t bufsize);
+static int redis_buildCommand(t_redis *x, t_symbol *prefix, int argc, t_atom *argv);
+static int redis_pendPush(t_redis *x, int kind, t_symbol * array);
+static void redis_pendPop(t_redis *x, t_redis_entry * entry);
+static int ring_init(t_redis_ring * r, unsigned int size);
+static void ring_free(t_redis_ring * r);
+static int ring_push(t_redis_ring * r, void * item);
+static void * ring_pop(t_redis_ring * r);
 void redis_free(t_redis *x);
 
 /* general */
+static void redis_address(int argc, t_atom *argv, char * host, int * port);
+static int redis_shardNew(t_redis *x, int argc, t_atom *argv);
+static void redis_shardFree(t_redis *x);
+static uint32_t redis_hash(const char * s, size_t len);
+static void redis_hashTag(const char ** s, size_t * len);
+static int redis_pointCompare(const void * a, const void * b);
+static int redis_shardOf(t_redis *x, const char * key, size_t len);
+static const t_redis_keyspec * redis_keyspec(const char * cmd, size_t len);
+static int redis_shardRoute(t_redis *x, int argc, const char ** vector, const size_t * lengths);
+static int redis_routeKey(void * data, const char * key, size_t len);
+static int redis_eachKey(int argc, const char ** vector, const size_t * lengths, int (*fn)(void *, const char *, size_t), void * data);
+static int redis_seqPush(t_redis_conn * c, unsigned long seq);
+static redisReply * redis_errorReply(const char * msg);
+static redisReply * redis_mergeReply(redisReply * a, redisReply * b);
+static void redis_shardSend(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array);
+static void redis_shardReply(t_redis *x, t_redis_conn * c, redisReply * reply);
+static void redis_shardReplyAt(t_redis *x, unsigned long seq, redisReply * reply);
+static void redis_shardOutput(t_redis *x);
+static void redis_shardYield(t_redis *x);
+static int redis_connOpen(t_redis *x, t_redis_conn * c);
+static void redis_connError(t_redis *x, t_redis_conn * c);
+static void redis_shardWait(t_redis *x);
+static uint16_t redis_crc16(const char * s, size_t len);
+static int redis_keySlot(const char * key, size_t len);
+static int redis_clusterNew(t_redis *x, int argc, t_atom *argv);
+static int redis_clusterConn(t_redis *x, const char * host, int port);
+static void redis_clusterRefresh(t_redis *x);
+static void redis_clusterSlots(t_redis *x);
+static int redis_clusterRedirect(t_redis *x, unsigned long seq, redisReply * reply);
+static int redis_clusterFollow(t_redis *x);
+static void redis_appendRaw(redisContext * c, const char * cmd, size_t len);
+static int redis_bufferRead(redisContext * c, double * bytes);
+static int redis_bufferWrite(redisContext * c, int * done, double * bytes);
+static int redis_getReply(redisContext * c, void ** reply, double * written, double * read);
+static redisReply * redis_commandSync(t_redis *x, int argc, const char ** vector, const size_t * lengths);
+static t_redis_shared * redis_sharedGet(const char * host, int port, int db);
+static void redis_sharedRelease(t_redis *x);
+static int redis_sharedOpen(t_redis_shared * s);
+static int redis_sharedPush(t_redis_shared * s, t_redis * owner, unsigned long seq);
+static void redis_sharedSend(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array);
+static void redis_sharedWait(t_redis_shared * s, t_redis *x);
+static void redis_sharedFlush(t_redis_shared * s);
+static void redis_sharedRead(t_redis_shared * s);
+static void redis_sharedPollread(t_redis_shared * s, int fd);
+static void redis_sharedNotify(t_redis * owner);
+static void redis_sharedError(t_redis_shared * s, const char * reason);
 void *redis_new(t_symbol *s, int argc, t_atom *argv);
+static void redis_status(t_redis *x, const char * event, int argc, t_float value);
+static void redis_connect(t_redis *x, int wait);
+static int redis_connReady(int fd, int * err);
+static void redis_connTick(t_redis *x);
+static void redis_connUp(t_redis *x);
+static void redis_connFailed(t_redis *x, const char * reason);
+static void redis_connLost(t_redis *x);
+static void redis_replayPush(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array);
+static int redis_keep(t_redis_replay ** list, int * count, int * size, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array);
+static void redis_replaySend(t_redis *x);
+void redis_timeout(t_redis *x, t_floatarg ms);
+void redis_replay(t_redis *x, t_floatarg max);
 void redis_command(t_redis *x, t_symbol *s, int argc, t_atom *argv);
-static void redis_postCommandAsync(t_redis * x, int argc, char ** vector, size_t * lengths);
-static void redis_prepareOutList(t_redis *x, redisReply * reply);
+void redis_batch(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static void redis_batchSend(t_redis *x);
+static redisReply * redis_arrayReply(size_t size);
+static void redis_batchOutput(t_redis *x, int flags, redisReply * replies);
+void redis_script(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static void redis_sha1(const unsigned char * data, size_t len, char * hex);
+static void redis_scriptLoad(t_redis *x, t_symbol * name, const char * filename);
+static void redis_scriptUpload(t_redis *x, t_redis_script * script);
+static void redis_scriptCall(t_redis *x, t_symbol * name, int argc, t_atom *argv);
+static void redis_send(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array);
+static void redis_handleReply(t_redis *x, int kind, t_symbol * array, redisReply * reply);
+static void redis_dispatchReply(t_redis *x, redisReply * reply);
+void redis_mode(t_redis *x, t_symbol *s);
+static void redis_pollon(t_redis *x, t_fdpollfn fn);
+static void redis_polloff(t_redis *x);
+static void redis_ioerror(t_redis *x);
+static int redis_hasOutput(t_redis *x);
+static void redis_flush(t_redis *x);
+static void redis_postCommandAsync(t_redis * x, int argc, const char ** vector, const size_t * lengths);
+static int redis_isNumeric(const char * s, size_t len);
+static t_symbol * redis_gensym(t_redis *x, const char * s);
+static void redis_decodeString(t_redis *x, redisReply * reply, t_atom * a);
+void redis_decode(t_redis *x, t_symbol *s);
+void redis_symbols(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static void redis_statBegin(t_redis *x, const char * command, size_t len);
+static void redis_statEnd(t_redis *x, int stat, double start, redisReply * reply);
+static int redis_statBucket(uint64_t usec);
+static double redis_statValue(int bucket);
+static double redis_statPercentile(t_redis_stat * st, double q);
+void redis_stats(t_redis *x);
+static size_t redis_countReply(redisReply * reply);
+static t_atom * redis_reserveOut(t_redis *x, size_t count);
+static void redis_shrinkOut(t_redis *x);
+static int redis_prepareOutList(t_redis *x, redisReply * reply, t_atom * out, int n);
 static void redis_parseReply(t_redis *x, redisReply * reply);
+static int redis_chunkStart(t_redis *x, redisReply * reply);
+static void redis_chunkOut(t_redis *x);
+static void redis_chunkTick(t_redis *x);
+static void redis_chunkFlush(t_redis *x);
+void redis_chunk(t_redis *x, t_floatarg size);
+static t_garray * redis_findArray(t_symbol * name, int * size, t_word ** vec);
+static void redis_packFloats(const t_word * vec, int n, unsigned char * buf);
+static void redis_unpackFloats(const unsigned char * buf, int n, t_word * vec);
+static void redis_writeArray(t_redis *x, t_symbol * name, redisReply * reply);
+void redis_toarray(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+void redis_fromarray(t_redis *x, t_symbol *s, int argc, t_atom *argv);
 
 /* puredis */
 static void setup_puredis(void);
-static void puredis_postCommandSync(t_redis * x, int argc, char ** vector, size_t * lengths);
-static void puredis_csv_postCommand(t_redis * x, int argc, char ** vector, size_t * lengths);
-static void puredis_csv_parse(t_redis *x, int argc, void *s, size_t i);
+static int puredis_postCommandThread(t_redis * x, int argc, const char ** vector, const size_t * lengths);
+static void * puredis_thread_main(void * data);
+static void puredis_thread_run(t_redis *x);
+static void puredis_thread_stop(t_redis *x);
+void puredis_thread(t_redis *x, t_floatarg on, t_floatarg size);
+void puredis_cache(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static int puredis_cacheOn(t_redis *x, int max);
+static void puredis_cacheOff(t_redis *x);
+static void puredis_cacheTrack(t_redis *x);
+static void puredis_cacheClear(t_redis *x);
+static int puredis_cacheFind(t_redis *x, int hget, const char * key, size_t keylen, const char * field, size_t fieldlen, uint32_t hash);
+static uint32_t puredis_cacheHash(const char * key, size_t len);
+static void puredis_cacheUnlink(t_redis *x, int i);
+static void puredis_cacheLink(t_redis *x, int i);
+static void puredis_cacheRemove(t_redis *x, int i);
+static int puredis_cacheGet(t_redis *x, int argc, const char ** vector, const size_t * lengths);
+static void puredis_cachePut(t_redis *x, int argc, const char ** vector, const size_t * lengths, redisReply * reply);
+static void puredis_cacheWrite(t_redis *x, int argc, const char ** vector, const size_t * lengths);
+static int puredis_cacheKey(void * data, const char * key, size_t len);
+static void puredis_cacheInvalidate(t_redis *x, const char * key, size_t len);
+static void puredis_cachePollread(t_redis *x, int fd);
+static void puredis_csv_error(t_redis_loader * l, const char * fmt, ...);
+static void puredis_csv_publish(t_redis_loader * l);
+static void puredis_csv_postCommand(t_redis_loader * l);
+static void puredis_csv_reap(t_redis_loader * l);
+static int puredis_csv_arg(t_redis_loader * l, const char * s, size_t i, int copy);
+static void puredis_csv_parse(t_redis_loader * l, const char * s, size_t i, int copy);
+static void puredis_csv_endrow(t_redis_loader * l);
+static void puredis_csv_header(t_redis_loader * l, const char * s, size_t i);
+static void puredis_csv_field(t_redis_loader * l, const char * s, size_t i, int copy);
+static void puredis_csv_row(t_redis_loader * l);
 static void puredis_csv_cb1 (void *s, size_t i, void *userdata);
 static void puredis_csv_cb2 (int c, void *userdata);
-static void puredis_csv_init(t_redis *x);
-static void puredis_csv_free(t_redis *x);
+static const char * puredis_csv_find(const char * p, const char * end, char c1, char c2, char c3);
+static int puredis_csv_scan(t_redis_loader * l, struct csv_parser * p, const char * data, size_t size);
+static const char * puredis_csv_map(const char * filename, size_t * size);
+static void puredis_csv_unmap(const char * data, size_t size);
+static int puredis_csv_mmap(t_redis_loader * l, struct csv_parser * p, const char * filename);
+static int puredis_csv_read(t_redis_loader * l, struct csv_parser * p, const char * filename);
+static int puredis_csv_init(t_redis_loader * l);
+static void puredis_csv_free(t_redis_loader * l);
+static void * puredis_csv_worker(void * data);
+static int puredis_csv_threaded(t_redis *x, const char * filename);
+static void puredis_csv_progress(t_redis *x);
+static void puredis_csv_unload(t_redis *x);
+static void puredis_csv_status(t_redis *x, t_symbol *s, int lines, int entries, int errors);
 void puredis_csv(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+void puredis_csvopt(t_redis *x, t_symbol *s, t_floatarg value);
+static void puredis_csvdump_error(t_redis_csvdump * d, const char * fmt, ...);
+static void puredis_csvdump_publish(t_redis_csvdump * d);
+static void puredis_csvdump_flush(t_redis_csvdump * d);
+static void puredis_csvdump_write(t_redis_csvdump * d, const char * s, size_t len);
+static void puredis_csvdump_field(t_redis_csvdump * d, const char * s, size_t len, int first);
+static int puredis_csvdump_column(t_redis_csvdump * d, const char * s, size_t len, int hint);
+static int puredis_csvdump_seen(t_redis_csvdump * d, const char * key, size_t len);
+static void puredis_csvdump_row(t_redis_csvdump * d, redisReply * key, redisReply * reply);
+static int puredis_csvdump_batch(t_redis_csvdump * d, redisReply * keys);
+static void puredis_csvdump_header(t_redis_csvdump * d);
+static void * puredis_csvdump_worker(void * data);
+static void puredis_csvdump_free(t_redis_csvdump * d);
+static void puredis_csvdump_progress(t_redis *x);
+static void puredis_csvdump_unload(t_redis *x);
+void puredis_csvdump(t_redis *x, t_symbol *s, int argc, t_atom *argv);
 
 /* async redis */
 static void setup_apuredis(void);
 static void apuredis_yield(t_redis * x);
+static void apuredis_pollread(t_redis *x, int fd);
 static void apuredis_q_out(t_redis * x);
 static void apuredis_run(t_redis *x);
 static void apuredis_schedule(t_redis *x);
 void apuredis_bang(t_redis *x);
 void apuredis_start(t_redis *x, t_symbol *s);
 void apuredis_stop(t_redis *x, t_symbol *s);
+void apuredis_drain(t_redis *x, t_symbol *s, int argc, t_atom *argv);
 
 /* subscriber redis */
 static void setup_spuredis(void);
+static void spuredis_yield(t_redis *x);
+static void spuredis_pollread(t_redis *x, int fd);
 static void spuredis_run(t_redis *x);
 static void spuredis_schedule(t_redis *x);
 static void spuredis_manage(t_redis *x, t_symbol *s, int argc);
@@ -130,6 +907,61 @@ void spuredis_bang(t_redis *x);
 void spuredis_start(t_redis *x, t_symbol *s);
 void spuredis_stop(t_redis *x, t_symbol *s);
 void spuredis_subscribe(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static void spuredis_keep(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static void spuredis_dispatch(t_redis *x, redisReply * reply);
+static int spuredis_bindSlot(t_redis *x, t_symbol * name);
+void spuredis_bind(t_redis *x, t_symbol *name, t_symbol *recv);
+void spuredis_unbind(t_redis *x, t_symbol *name);
+void spuredis_conflate(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+static void spuredis_conflateKeep(t_redis *x, redisReply * reply);
+static int spuredis_conflateSlot(t_redis *x, t_symbol * pattern, t_symbol * channel);
+static void spuredis_conflateOut(t_redis *x);
+
+/* stream redis */
+static int sring_init(t_redis_sring * r, size_t size);
+static void sring_free(t_redis_sring * r);
+static size_t sring_count(t_redis_sring * r);
+static int sring_write(t_redis_sring * r, const t_sample * in, size_t n);
+static size_t sring_read(t_redis_sring * r, t_sample * out, size_t n);
+static void redis_packSamples(const t_sample * in, size_t n, unsigned char * buf);
+static void redis_unpackSamples(const unsigned char * buf, size_t n, t_sample * out);
+static void setup_redisstream(void);
+static void * redisstream_new(t_symbol *s, int argc, t_atom *argv);
+static void redisstream_free(t_redisstream *x);
+static int redisstream_start(t_redisstream *x, void * (*fn)(void *));
+static int redisstream_connect(t_redisstream *x, redisContext ** redis);
+static void * redisstream_writer(void * data);
+static t_int * redisstream_perform(t_int *w);
+static void redisstream_dsp(t_redisstream *x, t_signal **sp);
+void redisstream_bang(t_redisstream *x);
+void redisstream_maxlen(t_redisstream *x, t_floatarg maxlen);
+static void * redisplay_reader(void * data);
+static t_int * redisplay_perform(t_int *w);
+static void redisplay_dsp(t_redisstream *x, t_signal **sp);
+void redisplay_bang(t_redisstream *x);
+void redisplay_jitter(t_redisstream *x, t_floatarg ms);
+static void setup_xpuredis(void);
+static void xpuredis_free(t_redis *x);
+static void xpuredis_resume(t_redis *x);
+static void xpuredis_read(t_redis *x);
+static void xpuredis_pollread(t_redis *x, int fd);
+static void xpuredis_entries(t_redis *x, redisReply * reply);
+static int xpuredis_entryAtoms(t_redis *x, redisReply * entry, t_atom * out, int counted);
+static void xpuredis_tick(t_redis *x);
+static void xpuredis_ackPush(t_redis *x, const char * id, size_t len);
+static int xpuredis_ackOpen(t_redis *x);
+static void xpuredis_ackFlush(t_redis *x);
+static void xpuredis_ackPollread(t_redis *x, int fd);
+static void xpuredis_ackError(t_redis *x);
+static void xpuredis_kindPush(t_redis *x, int kind);
+static void xpuredis_infoOut(t_redis *x, redisReply * reply);
+void xpuredis_start(t_redis *x);
+void xpuredis_stop(t_redis *x);
+void xpuredis_ack(t_redis *x, t_symbol *s, int argc, t_atom *argv);
+void xpuredis_autoack(t_redis *x, t_floatarg on);
+void xpuredis_count(t_redis *x, t_floatarg count);
+void xpuredis_output(t_redis *x, t_symbol *s);
+void xpuredis_info(t_redis *x);
 
 
 /* implementation */
@@ -140,679 +972,5982 @@ void puredis_setup(void)
     setup_puredis();
     setup_apuredis();
     setup_spuredis();
+    setup_redisstream();
+    setup_xpuredis();
     post("Puredis %i.%i.%i (MIT) 2011 Louis-Philippe Perron <lp@spiralix.org>", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH);
     post("Puredis: compiled for pd-%d.%d on %s %s", PD_MAJOR_VERSION, PD_MINOR_VERSION, __DATE__, __TIME__);
 }
 
 /* memory management methods */
 
-static void freeVectorAndLengths(int argc, char ** vector, size_t * lengths)
+/* grows the command builder to argc arguments and bufsize bytes of formatted values */
+static int redis_reserveCommand(t_redis *x, int argc, size_t bufsize)
 {
-    int i;
-    for (i = 0; i < argc; i++) free(vector[i]);
-    free(vector);
-    free(lengths);
+    if (argc > x->cmd_size) {
+        const char ** vector = realloc(x->cmd_argv, argc * sizeof(char*));
+        size_t * lengths = vector ? realloc(x->cmd_lengths, argc * sizeof(size_t)) : NULL;
+        if (vector) x->cmd_argv = vector;
+        if (lengths == NULL) {
+            post("puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        x->cmd_lengths = lengths;
+        x->cmd_size = argc;
+    }
+    if (bufsize > x->cmd_bufsize) {
+        char * buf = realloc(x->cmd_buf, bufsize);
+        if (buf == NULL) {
+            post("puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        x->cmd_buf = buf;
+        x->cmd_bufsize = bufsize;
+    }
+    return 1;
+}
+
+/* builds the command argument vector in the object arena, reused by every command:
+ * symbols are passed as is, floats are formatted like atom_string does */
+static int redis_buildCommand(t_redis *x, t_symbol *prefix, int argc, t_atom *argv)
+{
+    int i, n = argc + (prefix != NULL);
+    size_t pos = 0;
+    
+    if (!redis_reserveCommand(x, n, (size_t)argc * 32)) return 0;
+    
+    n = 0;
+    if (prefix) {
+        x->cmd_argv[n] = prefix->s_name;
+        x->cmd_lengths[n++] = strlen(prefix->s_name);
+    }
+    for (i = 0; i < argc; i++, n++) {
+        if (argv[i].a_type == A_SYMBOL) {
+            x->cmd_argv[n] = argv[i].a_w.w_symbol->s_name;
+            x->cmd_lengths[n] = strlen(x->cmd_argv[n]);
+        } else {
+            char * part = x->cmd_buf + pos;
+            if (argv[i].a_type == A_FLOAT) {
+                snprintf(part, 32, "%g", argv[i].a_w.w_float);
+            } else {
+                atom_string(argv+i, part, 32);
+            }
+            x->cmd_argv[n] = part;
+            x->cmd_lengths[n] = strlen(part);
+            pos += x->cmd_lengths[n] + 1;
+        }
+    }
+    return n;
+}
+
+/* queues the reply destination of a command sent async or to the io thread */
+static int redis_pendPush(t_redis *x, int kind, t_symbol * array)
+{
+    t_redis_entry * e;
+    if (x->pend_count == x->pend_size) {
+        int i, size = x->pend_size ? x->pend_size * 2 : 64;
+        t_redis_entry * pend = malloc(size * sizeof(t_redis_entry));
+        if (pend == NULL) {
+            post("puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        for (i = 0; i < x->pend_count; i++) {
+            pend[i] = x->pend[(x->pend_head + i) % x->pend_size];
+        }
+        free(x->pend);
+        x->pend = pend;
+        x->pend_size = size;
+        x->pend_head = 0;
+    }
+    e = &x->pend[(x->pend_head + x->pend_count) % x->pend_size];
+    e->kind = kind;
+    e->array = array;
+    e->slots = 1;
+    e->reply = NULL;
+    e->cmd = NULL;
+    e->cmdlen = 0;
+    e->redirects = 0;
+    e->batch = 0;
+    e->stat = x->stat_cmd;
+    e->start = x->stat_start;
+    x->stat_cmd = 0;
+    x->pend_count++;
+    if (x->pend_count > x->stat_peak) x->stat_peak = x->pend_count;
+    return 1;
+}
+
+/* takes the oldest reply destination, replies without one go to the outlet */
+static void redis_pendPop(t_redis *x, t_redis_entry * entry)
+{
+    t_redis_entry e = { REPLY_OUTLET, NULL, 0, NULL, NULL, 0, 0, 0, 0, 0 };
+    if (x->pend_count > 0) {
+        e = x->pend[x->pend_head];
+        x->pend_head = (x->pend_head + 1) % x->pend_size;
+        x->pend_count--;
+        x->pend_seq++;
+    }
+    if (entry) *entry = e;
+}
+
+/* rings sizes are rounded up to a power of two */
+static int ring_init(t_redis_ring * r, unsigned int size)
+{
+    unsigned int n = 2;
+    while (n < size) n <<= 1;
+    if ((r->slots = calloc(n, sizeof(void*))) == NULL) return 0;
+    r->mask = n - 1;
+    r->head = 0; r->tail = 0;
+    return 1;
+}
+
+static void ring_free(t_redis_ring * r)
+{
+    free(r->slots);
+    r->slots = NULL;
+}
+
+/* producer side, returns 0 when the ring is full */
+static int ring_push(t_redis_ring * r, void * item)
+{
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) return 0;
+    r->slots[head & r->mask] = item;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* consumer side, returns NULL when the ring is empty */
+static void * ring_pop(t_redis_ring * r)
+{
+    unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    void * item;
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) return NULL;
+    item = r->slots[tail & r->mask];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
 }
 
 void redis_free(t_redis *x)
 {
-    redisFree(x->redis);
+    int i;
+    
+    free(x->cmd_argv);
+    free(x->cmd_lengths);
+    free(x->cmd_buf);
+    if (x->chunk_reply) freeReplyObject(x->chunk_reply);
+    if (x->chunk_clock) clock_free(x->chunk_clock);
+    free(x->out);
+    free(x->sym_set);
+    while (x->pend_count > 0) {
+        t_redis_entry e;
+        redis_pendPop(x, &e);
+        if (e.reply) freeReplyObject(e.reply);
+        free(e.cmd);
+    }
+    free(x->pend);
+    while (x->batch_count > 0) free(x->batch[--x->batch_count].cmd);
+    free(x->batch);
+    while (x->nscripts > 0) free(x->scripts[--x->nscripts].body);
+    free(x->scripts);
+    if (x->thread_on) puredis_thread_stop(x);
+    if (x->csvload) puredis_csv_unload(x);
+    if (x->csv_clock) clock_free(x->csv_clock);
+    if (x->csvdump) puredis_csvdump_unload(x);
+    if (x->dump_clock) clock_free(x->dump_clock);
+    if (x->cache_max) puredis_cacheOff(x);
+    redis_polloff(x);
+    if (x->async_clock) clock_free(x->async_clock);
+    if (x->conn_clock) clock_free(x->conn_clock);
+    if (x->shared) redis_sharedRelease(x);
+    while (x->replay_count > 0) free(x->replay[--x->replay_count].cmd);
+    free(x->replay);
+    free(x->subs);
+    free(x->psubs);
+    free(x->binds);
+    free(x->conflated);
+    free(x->conflate_order);
+    for (i = 0; x->stats && i < STATS_COMMANDS; i++) free(x->stats[i].hist);
+    free(x->stats);
+    if (x->x_obj.ob_pd == xpuredis_class) xpuredis_free(x);
+    if (x->conns) redis_shardFree(x);
+    if (x->cluster_clock) clock_free(x->cluster_clock);
+    if (x->slots_reply) freeReplyObject(x->slots_reply);
+    free(x->slot_conn);
+    free(x->redirects);
+    if (x->redis) redisFree(x->redis);
 }
 
 /* common methods */
 
-/* constructor used by Puredis, Apuredis and Spuredis */
-void *redis_new(t_symbol *s, int argc, t_atom *argv)
+/* parses [host] [port] init arguments */
+static void redis_address(int argc, t_atom *argv, char * host, int * port)
 {
-    t_redis *x = NULL;
-    
-    int port = 6379;                /* default port */
-    char host[16] = "127.0.0.1";    /* default IP address */
+    *port = 6379;                   /* default port */
+    strcpy(host, "127.0.0.1");      /* default IP address */
     switch(argc){   /* parsing init arguments */
         default:
             break;
         case 2:
-            port = (int)atom_getint(argv+1);
+            *port = (int)atom_getint(argv+1);
         case 1:
             atom_string(argv, host, 16);
             break;
         case 0:
             break;
     }
+}
+
+/* constructor used by Puredis, Apuredis, Spuredis and Xpuredis */
+void *redis_new(t_symbol *s, int argc, t_atom *argv)
+{
+    t_redis *x = NULL;
+    
+    int port;
+    char host[16];
+    int stream = s == gensym("xpuredis");
+    int cluster = !stream && argc > 1 && atom_getsymbol(argv) == gensym("cluster");
+    int shared = !stream && argc > 0 && atom_getsymbol(argv) == gensym("shared");
+    int sharded = cluster || (!stream && argc > 0 && argv[0].a_type == A_SYMBOL && strchr(argv[0].a_w.w_symbol->s_name, ':'));
+    if (stream) {
+        /* stream group consumer [host] [port] */
+        if (argc < 3) {
+            post("xpuredis: stream, group and consumer needed"); return NULL;
+        }
+        redis_address(argc - 3, argv + 3, host, &port);
+    } else if (shared) {
+        redis_address(argc > 3 ? 2 : argc - 1, argv + 1, host, &port);
+    } else {
+        redis_address(sharded ? 0 : argc, argv, host, &port);
+    }
+    
+    if (sharded && s == gensym("spuredis")) {
+        post("spuredis: sharding is not available for subscribers"); return NULL;
+    }
+    if (shared && s == gensym("spuredis")) {
+        post("spuredis: shared connections are not available for subscribers"); return NULL;
+    }
     
     /* class initialisation */
-    if (s == gensym("apuredis")) {
+    if (sharded) {
+        x = (t_redis*)pd_new(s == gensym("apuredis") ? apuredis_class : puredis_class);
+        x->async = (s == gensym("apuredis"));
+        if (x->async) {
+            x->drain_max = DRAIN_MAX_REPLIES;
+            x->drain_budget = DRAIN_BUDGET_USEC / 1000000.;
+            x->async_clock = clock_new(x, (t_method)apuredis_run);
+        }
+    } else if (s == gensym("apuredis")) {
         x = (t_redis*)pd_new(apuredis_class);
-        x->redis = redisConnectNonBlock((char*)host,port);
         x->async = 1; x->async_num = 0;
         x->async_prev_num = 0; x->async_run = 0;
+        x->drain_max = DRAIN_MAX_REPLIES;
+        x->drain_budget = DRAIN_BUDGET_USEC / 1000000.;
         x->async_clock = clock_new(x, (t_method)apuredis_run);
     } else if (s == gensym("spuredis")) {
         x = (t_redis*)pd_new(spuredis_class);
-        x->redis = redisConnectNonBlock((char*)host,port);
         x->async_clock = clock_new(x, (t_method)spuredis_run);
         x->async_num = 0; x->async_run = 0;
+        x->drain_max = DRAIN_MAX_REPLIES;
+        x->drain_budget = DRAIN_BUDGET_USEC / 1000000.;
+    } else if (stream) {
+        x = (t_redis*)pd_new(xpuredis_class);
+        x->xs_stream = atom_getsymbol(argv);
+        x->xs_group = atom_getsymbol(argv + 1);
+        x->xs_consumer = atom_getsymbol(argv + 2);
+        x->xs_count = XREAD_COUNT;
+        x->xs_autoack = 1;
+        x->xs_ack_fd = -1;
+        x->xs_clock = clock_new(x, (t_method)xpuredis_tick);
     } else {
         x = (t_redis*)pd_new(puredis_class);
-        x->redis = redisConnect((char*)host,port);
         x->async = 0;
+        x->loader.lwindow = CSV_WINDOW;
+        x->loader.largcap = CSV_ARGCAP;
+        x->lprogress = CSV_PROGRESS;
     }
-    x->r_host = (char*)host;
+    x->r_host = gensym(host)->s_name;
     x->r_port = port;
+    x->poll_mode = 1; x->poll_fd = -1;
     outlet_new(&x->x_obj, NULL);
     if (x->async) {
         x->q_out = outlet_new(&x->x_obj, &s_float);
     }
+    x->c_out = outlet_new(&x->x_obj, NULL);
+    x->conn_timeout = CONNECT_TIMEOUT;
+    x->conn_delay = RECONNECT_MIN;
+    x->replay_max = REPLAY_MAX;
     
-    if (x->redis->err) {
-        post("could not connect to redis...");
+    if (sharded) {
+        if (cluster ? !redis_clusterNew(x, argc - 1, argv + 1) : !redis_shardNew(x, argc, argv)) {
+            pd_free((t_pd*)x);
+            return NULL;
+        }
+        return (void*)x;
+    }
+    if (shared) {
+        if ((x->shared = redis_sharedGet(host, port, argc > 3 ? (int)atom_getint(argv + 3) : 0)) == NULL) {
+            pd_free((t_pd*)x);
+            return NULL;
+        }
+        return (void*)x;
+    }
+    x->conn_clock = clock_new(x, (t_method)redis_connTick);
+    redis_connect(x, 1);
+    if (x->redis == NULL) {
+        post("puredis: can not proceed!!  Memory Error!");
+        pd_free((t_pd*)x);
         return NULL;
     }
-    post("Puredis %i.%i.%i connected to redis host: %s port: %u", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH, x->r_host, x->r_port);
     
     return (void*)x;
 }
 
-/* redis command parsing -- Puredis/Apuredis */
-void redis_command(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+/* outputs a connection event from the rightmost outlet */
+static void redis_status(t_redis *x, const char * event, int argc, t_float value)
 {
-    (void)s;
-    if (argc < 1) {
-        post("puredis: wrong command"); return;
-    }
-    
-    int i;
-    char ** vector = NULL;
-    size_t * lengths = NULL;
+    t_atom a;
+    SETFLOAT(&a, value);
+    outlet_anything(x->c_out, gensym(event), argc, &a);
+}
+
+/* connection: objects on one server connect without blocking pd (puredis
+ * waits at most the timeout when created, wait), reconnect with exponential
+ * backoff on the pd clock and keep the commands issued meanwhile for replay */
+static void redis_connect(t_redis *x, int wait)
+{
+    redisContext * c;
     
-    if (((vector = malloc(argc*sizeof(char*))) == NULL) || ((lengths = malloc(argc*sizeof(size_t))) == NULL)) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
+    x->conn_attempts++;
+    redis_status(x, "connecting", 1, x->conn_attempts);
+    if (!wait || x->async || x->x_obj.ob_pd == spuredis_class || x->x_obj.ob_pd == xpuredis_class) {
+        c = redisConnectNonBlock(x->r_host, x->r_port);
+    } else {
+        struct timeval timeout = { x->conn_timeout / 1000, (x->conn_timeout % 1000) * 1000 };
+        c = redisConnectWithTimeout(x->r_host, x->r_port, timeout);
     }
-    
-    for (i = 0; i < argc; i++) {
-        char cmdpart[256];
-        atom_string(argv+i, cmdpart, 256);
-        
-        if ((vector[i] = malloc(strlen(cmdpart)+1)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
-        }
-        
-        strcpy(vector[i], (char*)cmdpart);
-        lengths[i] = strlen(vector[i]);
+    if (c == NULL) {
+        redis_connFailed(x, "out of memory");
+        return;
     }
-    if (x->async) {
-        redis_postCommandAsync(x, argc, vector, lengths);
-        x->async_num++;
-        apuredis_q_out(x);
-        apuredis_schedule(x);
+    if (x->redis) redisFree(x->redis);
+    x->redis = c;
+    
+    if (c->err) {
+        redis_connFailed(x, c->errstr);
+    } else if (c->flags & REDIS_BLOCK) {
+        redis_connUp(x);
     } else {
-        puredis_postCommandSync(x, argc, vector, lengths);
+        x->conn_state = CONN_CONNECTING;
+        x->conn_started = clock_getlogicaltime();
+        clock_delay(x->conn_clock, CONNECT_POLL);
     }
 }
 
-/* sends command async to Redis */
-static void redis_postCommandAsync(t_redis * x, int argc, char ** vector, size_t * lengths)
+/* 1 once a non blocking connect has completed, -1 with its errno if it failed */
+static int redis_connReady(int fd, int * err)
 {
-    redisAppendCommandArgv(x->redis, argc, (const char**)vector, (const size_t *)lengths);
-    freeVectorAndLengths(argc, vector, lengths);
+    fd_set wfds;
+    struct timeval now = { 0, 0 };
+    socklen_t len = sizeof(*err);
+    
+    FD_ZERO(&wfds);
+    FD_SET(fd, &wfds);
+    *err = 0;
+    if (select(fd + 1, NULL, &wfds, NULL, &now) <= 0) return 0;
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)err, &len) < 0 || *err != 0) return -1;
+    return 1;
 }
 
-/* recursive redis reply parsing as pd list */
-static void redis_prepareOutList(t_redis *x, redisReply * reply)
+/* connection clock: starts a new attempt or checks the one in progress */
+static void redis_connTick(t_redis *x)
 {
-    if (reply->type == REDIS_REPLY_ERROR) {
-        SETSYMBOL(&x->out[x->out_count],gensym(reply->str));
-        x->out_count++;
-    } else if (reply->type == REDIS_REPLY_STATUS) {
-        SETSYMBOL(&x->out[x->out_count],gensym(reply->str));
-        x->out_count++;
-    } else if (reply->type == REDIS_REPLY_STRING) {
-        SETSYMBOL(&x->out[x->out_count],gensym(reply->str));
-        x->out_count++;
-    } else if (reply->type == REDIS_REPLY_ARRAY) {
-        int i;
-        for (i = 0; i < (int)reply->elements; i++) {
-            redis_prepareOutList(x,reply->element[i]);
+    int err;
+    if (x->conn_state == CONN_DOWN) {
+        redis_connect(x, 0);
+    } else if (x->conn_state == CONN_CONNECTING) {
+        switch (redis_connReady(x->redis->fd, &err)) {
+            case 1:
+                if (x->x_obj.ob_pd == puredis_class) {
+                    /* puredis reads its replies blocking */
+                    int flags = fcntl(x->redis->fd, F_GETFL);
+                    if (flags < 0 || fcntl(x->redis->fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+                        redis_connFailed(x, strerror(errno));
+                        break;
+                    }
+                    x->redis->flags |= REDIS_BLOCK;
+                }
+                redis_connUp(x);
+                break;
+            case -1:
+                redis_connFailed(x, err ? strerror(err) : "connection refused");
+                break;
+            default:
+                if (clock_gettimesince(x->conn_started) >= x->conn_timeout) {
+                    redis_connFailed(x, "connection timeout");
+                } else {
+                    clock_delay(x->conn_clock, CONNECT_POLL);
+                }
         }
-    } else if (reply->type == REDIS_REPLY_INTEGER) {
-        SETFLOAT(&x->out[x->out_count],reply->integer);
-        x->out_count++;
-    } else if (reply->type == REDIS_REPLY_NIL) {
-        SETSYMBOL(&x->out[x->out_count],gensym("nil"));
-        x->out_count++;
     }
 }
 
-/* sends redis reply to outlet */
-static void redis_parseReply(t_redis *x, redisReply * reply)
+/* connected: replays the commands kept meanwhile, spuredis subscribes again */
+static void redis_connUp(t_redis *x)
 {
-    if (reply->type == REDIS_REPLY_ERROR) {
-        outlet_symbol(x->x_obj.ob_outlet, gensym(reply->str));
-    } else if (reply->type == REDIS_REPLY_STATUS) {
-        outlet_symbol(x->x_obj.ob_outlet, gensym(reply->str));
-    } else if (reply->type == REDIS_REPLY_STRING) {
-        outlet_symbol(x->x_obj.ob_outlet, gensym(reply->str));
-    } else if (reply->type == REDIS_REPLY_ARRAY) {
-        x->out_count = 0;
-        redis_prepareOutList(x,reply);
-        outlet_list(x->x_obj.ob_outlet, &s_list, x->out_count, &x->out[0]);
-    } else if (reply->type == REDIS_REPLY_INTEGER) {
-        t_atom value;
-        SETFLOAT(&value, reply->integer);
-        outlet_float(x->x_obj.ob_outlet, atom_getfloat(&value));
-    } else if (reply->type == REDIS_REPLY_NIL) {
-        outlet_symbol(x->x_obj.ob_outlet, gensym("nil"));
+    x->conn_state = CONN_UP;
+    x->conn_attempts = 0;
+    x->conn_delay = RECONNECT_MIN;
+    post("Puredis %i.%i.%i connected to redis host: %s port: %u", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH, x->r_host, x->r_port);
+    redis_status(x, "connected", 0, 0);
+    
+    if (x->x_obj.ob_pd == xpuredis_class) {
+        xpuredis_resume(x);
+        return;
+    } else if (x->x_obj.ob_pd != spuredis_class) {
+        int i;
+        if (x->cache_max) puredis_cacheTrack(x);
+        for (i = 0; i < x->nscripts; i++) redis_scriptUpload(x, &x->scripts[i]);
+    } else {
+        int i;
+        for (i = 0; i < x->nsubs; i++) redisAppendCommand(x->redis, "SUBSCRIBE %s", x->subs[i]->s_name);
+        for (i = 0; i < x->npsubs; i++) redisAppendCommand(x->redis, "PSUBSCRIBE %s", x->psubs[i]->s_name);
+        if (x->poll_mode) redis_flush(x);
+        spuredis_schedule(x);
+        return;
     }
-    freeReplyObject(reply);
+    redis_replaySend(x);
 }
 
-/* puredis */
-
-/* puredis setup method */
-static void setup_puredis(void)
+/* a failed attempt schedules the next one, twice as late as the last */
+static void redis_connFailed(t_redis *x, const char * reason)
 {
-    puredis_class = class_new(gensym("puredis"),
-        (t_newmethod)redis_new,
-        (t_method)redis_free,
-        sizeof(t_redis),
-        CLASS_DEFAULT,
-        A_GIMME, 0);
-    
-    class_addmethod(puredis_class,
-        (t_method)redis_command, gensym("command"),
-        A_GIMME, 0);
-    class_addmethod(puredis_class,
-        (t_method)puredis_csv, gensym("csv"),
-        A_GIMME, 0);
-    class_sethelpsymbol(puredis_class, gensym("puredis-help"));
+    x->conn_state = CONN_DOWN;
+    post("puredis: could not connect to redis host: %s port: %u: %s, retry in %g ms",
+        x->r_host, x->r_port, reason, x->conn_delay);
+    redis_status(x, "retry", 1, x->conn_delay);
+    clock_delay(x->conn_clock, x->conn_delay);
+    x->conn_delay *= 2;
+    if (x->conn_delay > RECONNECT_MAX) x->conn_delay = RECONNECT_MAX;
 }
 
-/* sends command sync to Redis */
-static void puredis_postCommandSync(t_redis * x, int argc, char ** vector, size_t * lengths)
+/* a dropped connection fails the commands in flight, they may have run,
+ * and starts reconnecting */
+static void redis_connLost(t_redis *x)
 {
-    redisReply * reply = redisCommandArgv(x->redis, argc, (const char**)vector, (const size_t *)lengths);
-    freeVectorAndLengths(argc, vector, lengths);
-    redis_parseReply(x,reply);
+    int lost = x->async_num;
+    
+    if (x->conn_state != CONN_UP) return;
+    post("puredis: redis connection lost: %s", x->redis->errstr[0] ? x->redis->errstr : "connection closed");
+    redis_polloff(x);
+    if (x->async) {
+        while (x->pend_count > 0) {
+            t_redis_entry e;
+            redis_pendPop(x, &e);
+            if (e.reply) freeReplyObject(e.reply);
+            free(e.cmd);
+        }
+        x->async_num = 0;
+        apuredis_q_out(x);
+        if (lost > 0) post("puredis: %d commands in flight lost", lost);
+    }
+    redis_status(x, "disconnected", 1, lost);
+    x->conn_state = CONN_DOWN;
+    x->xs_reading = 0;
+    x->xs_skip = 0;
+    /* tracking ends with the connection, so does a transaction */
+    if (x->cache_max) puredis_cacheClear(x);
+    x->cache_multi = 0;
+    clock_delay(x->conn_clock, x->conn_delay);
 }
 
-/* sends command sync to redis for csv data loading */
-static void puredis_csv_postCommand(t_redis * x, int argc, char ** vector, size_t * lengths)
+/* keeps a command for replay, formatted once */
+static void redis_replayPush(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array)
 {
-    redisReply * reply = redisCommandArgv(x->redis, argc, (const char**)vector, (const size_t *)lengths);
-    freeVectorAndLengths(argc, vector, lengths);
-    x->lnumload++;
-    if (reply->type == REDIS_REPLY_ERROR) {
-        x->lnumerror++;
-        x->lnumload--;
-        post("Puredis csv load Redis error: %s", reply->str);
+    if (x->replay_count >= x->replay_max) {
+        x->replay_dropped++;
+        post("puredis: not connected, replay buffer full, command dropped");
+        redis_status(x, "dropped", 1, x->replay_dropped);
+        return;
     }
-    freeReplyObject(reply);
+    redis_keep(&x->replay, &x->replay_count, &x->replay_size, argc, vector, lengths, kind, array);
 }
 
-/* parse csv data and loads it in redis */
-static void puredis_csv_parse(t_redis *x, int argc, void *s, size_t i)
+/* formats a command at the end of a list of kept commands */
+static int redis_keep(t_redis_replay ** list, int * count, int * size, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array)
 {
-    char ** vector = NULL;
-    size_t * lengths = NULL;
-    char * item = (char*)s;
+    t_redis_replay * r;
+    char * cmd = NULL;
+    int len;
     
-    if (((vector = malloc(argc*sizeof(char*))) == NULL) || ((lengths = malloc(argc*sizeof(size_t))) == NULL)) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
+    if (*count == *size) {
+        int newsize = *size ? *size * 2 : 16;
+        t_redis_replay * grown = realloc(*list, newsize * sizeof(t_redis_replay));
+        if (grown == NULL) {
+            post("puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        *list = grown;
+        *size = newsize;
     }
-    
-    if ((vector[0] = malloc(strlen(x->lcmd)+1)) == NULL) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
+    if ((len = redisFormatCommandArgv(&cmd, argc, vector, lengths)) < 0) {
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
     }
-    strcpy(vector[0], x->lcmd);
-    lengths[0] = strlen(vector[0]);
+    r = &(*list)[(*count)++];
+    r->cmd = cmd;
+    r->len = (size_t)len;
+    r->kind = kind;
+    r->array = array;
+    return 1;
+}
+
+/* sends the kept commands in order: apuredis pipelines them, puredis
+ * outputs each reply in turn */
+static void redis_replaySend(t_redis *x)
+{
+    t_redis_replay * replay = x->replay;
+    int i, n = x->replay_count, sent = 0;
     
-    if ((vector[1] = malloc(strlen(x->lkey)+1)) == NULL) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
-    }
-    strcpy(vector[1], x->lkey);
-    lengths[1] = strlen(vector[1]);
+    if (n == 0) return;
+    /* detached, a reply output may issue commands or drop the link again */
+    x->replay = NULL;
+    x->replay_count = x->replay_size = 0;
     
-    if (x->ltype == gensym("hash")) {
-        if ((vector[2] = malloc(strlen(x->hheaders[x->hcount])+1)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
+    for (i = 0; i < n && x->conn_state == CONN_UP; i++) {
+        t_redis_replay * r = &replay[i];
+        if (x->async) {
+            if (redis_pendPush(x, r->kind, r->array)) {
+                redis_appendRaw(x->redis, r->cmd, r->len);
+                x->async_num++;
+                sent++;
+            }
+        } else {
+            void * reply = NULL;
+            redis_appendRaw(x->redis, r->cmd, r->len);
+            if (redis_getReply(x->redis, &reply, &x->stat_written, &x->stat_read) == REDIS_ERR) reply = NULL;
+            redis_handleReply(x, r->kind, r->array, (redisReply*)reply);
+            if (reply == NULL && x->redis->err) redis_connLost(x);
+            sent++;
         }
-        strcpy(vector[2], x->hheaders[x->hcount]);
-        lengths[2] = strlen(vector[2]);
-    } else if (x->ltype == gensym("zset")) {
-        if ((vector[2] = malloc(strlen(x->zscore)+1)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
+        free(r->cmd);
+    }
+    if (i < n) {
+        /* lost again: the rest goes back before the commands issued meanwhile */
+        int rest = n - i;
+        t_redis_replay * merged;
+        memmove(replay, replay + i, rest * sizeof(t_redis_replay));
+        if ((merged = realloc(replay, (rest + x->replay_count) * sizeof(t_redis_replay))) == NULL) {
+            post("puredis: can not proceed!!  Memory Error!");
+            while (rest > 0) free(replay[--rest].cmd);
+            free(replay);
+        } else {
+            memcpy(merged + rest, x->replay, x->replay_count * sizeof(t_redis_replay));
+            free(x->replay);
+            x->replay = merged;
+            x->replay_count = x->replay_size = rest + x->replay_count;
         }
-        strcpy(vector[2], x->zscore);
-        lengths[2] = strlen(vector[2]);
+    } else {
+        free(replay);
     }
     
-    if ((vector[argc-1] = malloc(i+1)) == NULL) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
+    if (sent > 0) redis_status(x, "replayed", 1, sent);
+    if (x->async && sent > 0) {
+        apuredis_q_out(x);
+        apuredis_schedule(x);
     }
-    strcpy(vector[argc-1], item);
-    lengths[argc-1] = i;
-    
-    puredis_csv_postCommand(x, argc, vector, lengths);
 }
 
-/* libcsv callback for each values in csv data */
-static void puredis_csv_cb1 (void *s, size_t i, void *userdata)
+/* timeout message method: ms allowed for a connection attempt */
+void redis_timeout(t_redis *x, t_floatarg ms)
 {
-    t_redis *x = (t_redis *)userdata;
-    
-    if (x->lnew && x->lkey[0] == '#') return;
-    
-    if (x->ltype == gensym("hash")) {
-        if (x->lcount > 0) {
-            if (x->lnew) {
-                x->hcount++;
-                puredis_csv_parse(x, 4, s,i);
+    x->conn_timeout = ms < 1 ? 1 : (int)ms;
+}
+
+/* replay message method: commands kept while disconnected, 0 drops them */
+void redis_replay(t_redis *x, t_floatarg max)
+{
+    x->replay_max = max < 0 ? 0 : (int)max;
+}
+
+/* redis command parsing -- Puredis/Apuredis */
+void redis_command(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    if (argc < 1) {
+        post("puredis: wrong command"); return;
+    }
+    
+    if (!redis_buildCommand(x, NULL, argc, argv)) return;
+    if (x->batch_on) {
+        /* batched writes never pass puredis_cachePut, their keys go now */
+        if (x->cache_max) puredis_cacheWrite(x, argc, x->cmd_argv, x->cmd_lengths);
+        redis_keep(&x->batch, &x->batch_count, &x->batch_size, argc, x->cmd_argv, x->cmd_lengths, REPLY_OUTLET, NULL);
+        return;
+    }
+    redis_send(x, argc, x->cmd_argv, x->cmd_lengths, REPLY_OUTLET, NULL);
+}
+
+/* batch message method -- Puredis/Apuredis
+ * batch begin [multi] queues the following commands, batch end [tagged]
+ * writes them at once, optionally inside MULTI/EXEC, and outputs their
+ * replies as one list or as one list per command led by its index */
+void redis_batch(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    t_symbol * op = argc > 0 ? atom_getsymbol(argv) : &s_;
+    t_symbol * opt = argc > 1 ? atom_getsymbol(argv + 1) : &s_;
+    (void)s;
+    
+    if (op == gensym("begin")) {
+        if (x->nconns || x->shared || x->thread_on) {
+            post("puredis: batches are not available with shards, shared connections or thread mode"); return;
+        }
+        if (x->batch_on) post("puredis: batch already begun, commands are added to it");
+        x->batch_on = 1;
+        x->batch_flags = (opt == gensym("multi")) ? BATCH_MULTI : 0;
+    } else if (op == gensym("end")) {
+        if (!x->batch_on) {
+            post("puredis: batch end without batch begin"); return;
+        }
+        x->batch_on = 0;
+        if (opt == gensym("tagged")) x->batch_flags |= BATCH_TAGGED;
+        redis_batchSend(x);
+    } else if (op == gensym("cancel")) {
+        x->batch_on = 0;
+        while (x->batch_count > 0) free(x->batch[--x->batch_count].cmd);
+    } else {
+        post("puredis: batch begin [multi], batch end [tagged] or batch cancel");
+    }
+}
+
+/* writes the queued commands in one go, the replies are collected in one
+ * array reply: by the pending entry for apuredis, right away for puredis */
+static void redis_batchSend(t_redis *x)
+{
+    int i, stat, n = x->batch_count;
+    int total = n + ((x->batch_flags & BATCH_MULTI) ? 2 : 0);
+    redisReply * replies;
+    
+    if (n == 0) {
+        post("puredis: empty batch"); return;
+    }
+    if (x->conn_state != CONN_UP || (replies = redis_arrayReply(total)) == NULL) {
+        post("puredis: %s, batch of %d commands dropped", x->conn_state != CONN_UP ? "not connected" : "out of memory", n);
+        while (x->batch_count > 0) free(x->batch[--x->batch_count].cmd);
+        outlet_symbol(x->x_obj.ob_outlet, gensym("error"));
+        return;
+    }
+    
+    /* timed as one command, counted as many */
+    redis_statBegin(x, "batch", 5);
+    x->stat_commands += n - 1;
+    if (x->batch_flags & BATCH_MULTI) redis_appendRaw(x->redis, "*1\r\n$5\r\nMULTI\r\n", 15);
+    for (i = 0; i < n; i++) {
+        redis_appendRaw(x->redis, x->batch[i].cmd, x->batch[i].len);
+        free(x->batch[i].cmd);
+    }
+    if (x->batch_flags & BATCH_MULTI) redis_appendRaw(x->redis, "*1\r\n$4\r\nEXEC\r\n", 14);
+    x->batch_count = 0;
+    
+    if (x->async) {
+        t_redis_entry * e;
+        if (!redis_pendPush(x, REPLY_BATCH, NULL)) {
+            /* the commands are out, their replies are dropped one by one */
+            freeReplyObject(replies);
+            for (i = 0; i < total && redis_pendPush(x, REPLY_DISCARD, NULL); i++);
+            x->async_num += i;
+            if (i < total) {
+                /* replies without an entry would go to later commands */
+                post("puredis: can not proceed!!  Memory Error!");
+                redis_ioerror(x);
+            }
+            return;
+        }
+        e = &x->pend[(x->pend_head + x->pend_count - 1) % x->pend_size];
+        e->slots = total;
+        e->reply = replies;
+        e->batch = x->batch_flags;
+        x->async_num += total;
+        apuredis_q_out(x);
+        apuredis_schedule(x);
+        return;
+    }
+    
+    if (x->chunk_reply && !x->out_busy) redis_chunkFlush(x);
+    stat = x->stat_cmd;
+    x->stat_cmd = 0;
+    for (i = 0; i < total; i++) {
+        void * reply = NULL;
+        if (redis_getReply(x->redis, &reply, &x->stat_written, &x->stat_read) == REDIS_ERR) {
+            post("puredis: redis error: %s", x->redis->errstr);
+            redis_statEnd(x, stat, x->stat_start, NULL);
+            freeReplyObject(replies);
+            outlet_symbol(x->x_obj.ob_outlet, gensym("error"));
+            redis_connLost(x);
+            return;
+        }
+        replies->element[replies->elements++] = (redisReply*)reply;
+    }
+    redis_statEnd(x, stat, x->stat_start, replies);
+    redis_batchOutput(x, x->batch_flags, replies);
+}
+
+/* empty array reply with room for size elements, freed by freeReplyObject */
+static redisReply * redis_arrayReply(size_t size)
+{
+    redisReply * r = calloc(1, sizeof(redisReply));
+    if (r == NULL) return NULL;
+    r->type = REDIS_REPLY_ARRAY;
+    if ((r->element = malloc((size ? size : 1) * sizeof(redisReply*))) == NULL) {
+        free(r); return NULL;
+    }
+    return r;
+}
+
+/* scripts: script load <name> <file> keeps a lua script and uploads it,
+ * script call <name> keys... -- args... sends EVALSHA with its locally
+ * computed sha1, scripts are uploaded again on every connection */
+void redis_script(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    t_symbol * op = argc > 0 ? atom_getsymbol(argv) : &s_;
+    (void)s;
+    
+    if (op == gensym("load") && argc == 3) {
+        char filename[MAXPDSTRING];
+        atom_string(argv + 2, filename, MAXPDSTRING);
+        redis_scriptLoad(x, atom_getsymbol(argv + 1), filename);
+    } else if (op == gensym("call") && argc >= 2) {
+        redis_scriptCall(x, atom_getsymbol(argv + 1), argc - 2, argv + 2);
+    } else {
+        post("puredis: script load <name> <file> or script call <name> keys... -- args...");
+    }
+}
+
+/* SHA-1 (FIPS 180-1) of a buffer as 40 lowercase hex digits, the name
+ * redis gives a script */
+static void redis_sha1(const unsigned char * data, size_t len, char * hex)
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    unsigned char block[64];
+    uint64_t bits = (uint64_t)len * 8;
+    size_t pos = 0;
+    int i, done = 0, padded = 0;
+    
+    while (!done) {
+        uint32_t w[80], a, b, c, d, e, t;
+        size_t n = len - pos < 64 ? len - pos : 64;
+        
+        memcpy(block, data + pos, n);
+        pos += n;
+        if (n < 64) {
+            /* 0x80 once after the data, the bit length in the last 8 bytes */
+            memset(block + n, 0, 64 - n);
+            if (!padded) block[n] = 0x80;
+            padded = 1;
+            if (n < 56) {
+                for (i = 0; i < 8; i++) block[63 - i] = (unsigned char)(bits >> (8 * i));
+                done = 1;
+            }
+        }
+        for (i = 0; i < 16; i++) {
+            w[i] = (uint32_t)block[4*i] << 24 | (uint32_t)block[4*i+1] << 16 | (uint32_t)block[4*i+2] << 8 | block[4*i+3];
+        }
+        for (i = 16; i < 80; i++) {
+            t = w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16];
+            w[i] = (t << 1) | (t >> 31);
+        }
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+        for (i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d; d = c; c = (b << 30) | (b >> 2); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (i = 0; i < 5; i++) sprintf(hex + 8 * i, "%08x", (unsigned int)h[i]);
+}
+
+/* reads a script file, keeps it under its name and uploads it */
+static void redis_scriptLoad(t_redis *x, t_symbol * name, const char * filename)
+{
+    t_redis_script * script = NULL;
+    char hex[41];
+    char * body;
+    long size;
+    FILE * f;
+    int i;
+    
+    if ((f = fopen(filename, "rb")) == NULL) {
+        post("puredis: could not open script %s", filename); return;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || (body = malloc(size + 1)) == NULL) {
+        fclose(f);
+        post("puredis: can not proceed!!  Memory Error!"); return;
+    }
+    if (fread(body, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(body);
+        post("puredis: could not read script %s", filename); return;
+    }
+    fclose(f);
+    body[size] = '\0';
+    
+    for (i = 0; i < x->nscripts; i++) {
+        if (x->scripts[i].name == name) script = &x->scripts[i];
+    }
+    if (script == NULL) {
+        t_redis_script * scripts = realloc(x->scripts, (x->nscripts + 1) * sizeof(t_redis_script));
+        if (scripts == NULL) {
+            free(body);
+            post("puredis: can not proceed!!  Memory Error!"); return;
+        }
+        x->scripts = scripts;
+        script = &x->scripts[x->nscripts++];
+        script->name = name;
+    } else {
+        free(script->body);
+    }
+    redis_sha1((const unsigned char*)body, (size_t)size, hex);
+    script->sha = gensym(hex);
+    script->body = body;
+    script->len = (size_t)size;
+    redis_scriptUpload(x, script);
+}
+
+/* SCRIPT LOAD, only errors are reported */
+static void redis_scriptUpload(t_redis *x, t_redis_script * script)
+{
+    const char * vector[3] = { "SCRIPT", "LOAD", script->body };
+    size_t lengths[3] = { 6, 4, script->len };
+    redis_send(x, 3, vector, lengths, REPLY_DISCARD, NULL);
+}
+
+/* EVALSHA, on NOSCRIPT puredis retries at once with EVAL and apuredis
+ * sends the EVAL kept in the pending entry */
+static void redis_scriptCall(t_redis *x, t_symbol * name, int argc, t_atom *argv)
+{
+    t_redis_script * script = NULL;
+    t_atom * atoms;
+    int i, n = 2, numkeys = -1;
+    
+    for (i = 0; i < x->nscripts; i++) {
+        if (x->scripts[i].name == name) script = &x->scripts[i];
+    }
+    if (script == NULL) {
+        post("puredis: no script %s, use script load first", name->s_name); return;
+    }
+    if ((atoms = malloc((argc + 2) * sizeof(t_atom))) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return;
+    }
+    /* sha numkeys keys... args... */
+    for (i = 0; i < argc; i++) {
+        if (argv[i].a_type == A_SYMBOL && argv[i].a_w.w_symbol == gensym("--") && numkeys < 0) {
+            numkeys = n - 2;
+            continue;
+        }
+        atoms[n++] = argv[i];
+    }
+    SETSYMBOL(&atoms[0], script->sha);
+    SETFLOAT(&atoms[1], numkeys < 0 ? n - 2 : numkeys);
+    i = redis_buildCommand(x, gensym("EVALSHA"), n, atoms);
+    free(atoms);
+    if (!i) return;
+    n++;
+    /* the declared keys may be written */
+    if (x->cache_max) puredis_cacheWrite(x, n, x->cmd_argv, x->cmd_lengths);
+    
+    if (x->batch_on) {
+        redis_keep(&x->batch, &x->batch_count, &x->batch_size, n, x->cmd_argv, x->cmd_lengths, REPLY_OUTLET, NULL);
+    } else if (!x->async && !x->thread_on && !x->nconns && !x->shared && x->conn_state == CONN_UP) {
+        redisReply * reply;
+        int stat;
+        if (x->chunk_reply && !x->out_busy) redis_chunkFlush(x);
+        redis_statBegin(x, x->cmd_argv[0], x->cmd_lengths[0]);
+        stat = x->stat_cmd;
+        x->stat_cmd = 0;
+        reply = redis_commandSync(x, n, x->cmd_argv, x->cmd_lengths);
+        if (reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0) {
+            freeReplyObject(reply);
+            x->cmd_argv[0] = "EVAL"; x->cmd_lengths[0] = 4;
+            x->cmd_argv[1] = script->body; x->cmd_lengths[1] = script->len;
+            reply = redis_commandSync(x, n, x->cmd_argv, x->cmd_lengths);
+        }
+        redis_statEnd(x, stat, x->stat_start, reply);
+        redis_handleReply(x, REPLY_OUTLET, NULL, reply);
+        if (reply == NULL && x->redis->err) redis_connLost(x);
+    } else {
+        int count = x->pend_count;
+        redis_send(x, n, x->cmd_argv, x->cmd_lengths, REPLY_OUTLET, NULL);
+        if (x->async && !x->nconns && !x->shared && x->pend_count > count) {
+            t_redis_entry * e = &x->pend[(x->pend_head + x->pend_count - 1) % x->pend_size];
+            int len;
+            x->cmd_argv[0] = "EVAL"; x->cmd_lengths[0] = 4;
+            x->cmd_argv[1] = script->body; x->cmd_lengths[1] = script->len;
+            if ((len = redisFormatCommandArgv(&e->cmd, n, x->cmd_argv, x->cmd_lengths)) > 0) e->cmdlen = (size_t)len;
+        }
+    }
+}
+
+/* outputs the collected replies of a batch, a transaction is its EXEC reply */
+static void redis_batchOutput(t_redis *x, int flags, redisReply * replies)
+{
+    size_t i;
+    
+    if ((flags & BATCH_MULTI) && replies->elements > 0) {
+        /* +OK, QUEUED... then the EXEC reply: an array, nil if aborted by WATCH or an error */
+        redisReply * exec = replies->element[--replies->elements];
+        freeReplyObject(replies);
+        replies = exec;
+    }
+    if (!(flags & BATCH_TAGGED) || replies->type != REDIS_REPLY_ARRAY) {
+        redis_handleReply(x, REPLY_OUTLET, NULL, replies);
+        return;
+    }
+    for (i = 0; i < replies->elements; i++) {
+        redisReply * tagged = redis_arrayReply(2);
+        redisReply * index = calloc(1, sizeof(redisReply));
+        if (tagged == NULL || index == NULL) {
+            post("puredis: can not proceed!!  Memory Error!");
+            free(index);
+            if (tagged) freeReplyObject(tagged);
+            break;
+        }
+        index->type = REDIS_REPLY_INTEGER;
+        index->integer = (long long)i;
+        tagged->element[0] = index;
+        tagged->element[1] = replies->element[i];
+        tagged->elements = 2;
+        replies->element[i] = NULL;
+        redis_parseReply(x, tagged);
+    }
+    freeReplyObject(replies);
+}
+
+/* sends a command async, to the io thread or sync, its reply going to kind/array */
+static void redis_send(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array)
+{
+    redis_statBegin(x, vector[0], lengths[0]);
+    /* an idle apuredis only notices a dropped connection by reading it, the
+     * command is then kept for replay instead of lost in flight */
+    if (x->async && !x->nconns && !x->shared && x->conn_state == CONN_UP && x->async_num < 1 &&
+        redis_bufferRead(x->redis, &x->stat_read) == REDIS_ERR) {
+        redis_ioerror(x);
+    }
+    if (x->nconns) {
+        redis_shardSend(x, argc, vector, lengths, kind, array);
+    } else if (x->shared) {
+        redis_sharedSend(x, argc, vector, lengths, kind, array);
+    } else if (x->conn_state != CONN_UP && !x->thread_on) {
+        redis_replayPush(x, argc, vector, lengths, kind, array);
+    } else if (x->async) {
+        if (!redis_pendPush(x, kind, array)) return;
+        redis_postCommandAsync(x, argc, vector, lengths);
+        x->async_num++;
+        apuredis_q_out(x);
+        apuredis_schedule(x);
+    } else if (x->thread_on) {
+        if (puredis_postCommandThread(x, argc, vector, lengths))
+            redis_pendPush(x, kind, array);
+    } else {
+        redisReply * reply;
+        if (x->chunk_reply && !x->out_busy) redis_chunkFlush(x);
+        int stat = x->stat_cmd;
+        x->stat_cmd = 0;
+        if (x->cache_max && !x->cache_multi && kind == REPLY_OUTLET && puredis_cacheGet(x, argc, vector, lengths)) return;
+        reply = redis_commandSync(x, argc, vector, lengths);
+        redis_statEnd(x, stat, x->stat_start, reply);
+        if (x->cache_max && reply) puredis_cachePut(x, argc, vector, lengths, reply);
+        redis_handleReply(x, kind, array, reply);
+        if (reply == NULL && x->redis->err) redis_connLost(x);
+    }
+    x->stat_cmd = 0;
+}
+
+/* outputs, writes to an array or drops a reply */
+static void redis_handleReply(t_redis *x, int kind, t_symbol * array, redisReply * reply)
+{
+    if (reply == NULL) {
+        post("puredis: redis error: %s", x->redis->errstr);
+    } else if (kind == REPLY_ARRAY) {
+        redis_writeArray(x, array, reply);
+    } else if (kind == REPLY_DISCARD) {
+        if (reply->type == REDIS_REPLY_ERROR) post("puredis: %s", reply->str);
+        freeReplyObject(reply);
+    } else {
+        redis_parseReply(x, reply);
+    }
+}
+
+/* handles a reply read in command order -- Apuredis/Puredis io thread */
+static void redis_dispatchReply(t_redis *x, redisReply * reply)
+{
+    t_redis_entry e;
+    if (x->pend_count > 0 && x->pend[x->pend_head].kind == REPLY_BATCH) {
+        t_redis_entry * b = &x->pend[x->pend_head];
+        b->reply->element[b->reply->elements++] = reply;
+        if (--b->slots > 0) return;
+        redis_pendPop(x, &e);
+        redis_batchOutput(x, e.batch, e.reply);
+        return;
+    }
+    if (reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0 &&
+        x->pend_count > 0 && x->pend[x->pend_head].cmd != NULL && x->redis) {
+        /* the script cache was flushed, EVAL loads it again at the end of the pipeline */
+        t_redis_entry * retry;
+        redis_pendPop(x, &e);
+        freeReplyObject(reply);
+        if (!redis_pendPush(x, e.kind, e.array)) {
+            free(e.cmd);
+            outlet_symbol(x->x_obj.ob_outlet, gensym("error"));
+            return;
+        }
+        retry = &x->pend[(x->pend_head + x->pend_count - 1) % x->pend_size];
+        retry->cmd = e.cmd;
+        retry->cmdlen = e.cmdlen;
+        retry->stat = e.stat;
+        retry->start = e.start;
+        redis_appendRaw(x->redis, e.cmd, e.cmdlen);
+        x->async_num++;
+        return;
+    }
+    redis_pendPop(x, &e);
+    free(e.cmd);
+    redis_statEnd(x, e.stat, e.start, reply);
+    redis_handleReply(x, e.kind, e.array, reply);
+}
+
+/* sends command async to Redis */
+static void redis_postCommandAsync(t_redis * x, int argc, const char ** vector, const size_t * lengths)
+{
+    redisAppendCommandArgv(x->redis, argc, vector, lengths);
+}
+
+/* selects socket polling (mode poll, default) or timed polling (mode clock) -- Apuredis/Spuredis */
+void redis_mode(t_redis *x, t_symbol *s)
+{
+    redis_polloff(x);
+    if (s == gensym("clock")) {
+        x->poll_mode = 0;
+    } else if (s == gensym("poll")) {
+        x->poll_mode = 1;
+    } else {
+        post("puredis: unknown mode %s, use poll or clock", s->s_name);
+    }
+    if (x->async) {
+        apuredis_schedule(x);
+    } else {
+        if (x->async_run) clock_delay(x->async_clock, 0);
+        spuredis_schedule(x);
+    }
+}
+
+/* registers the redis socket with pd scheduler fd polling */
+static void redis_pollon(t_redis *x, t_fdpollfn fn)
+{
+    int i;
+    for (i = 0; i < x->nconns; i++) {
+        t_redis_conn * c = &x->conns[i];
+        if (c->poll_fd < 0 && c->redis->fd >= 0 && !c->redis->err) {
+            c->poll_fd = c->redis->fd;
+            sys_addpollfn(c->poll_fd, fn, x);
+        }
+    }
+    if (x->nconns || x->conn_state != CONN_UP) return;
+    if (x->poll_fd < 0 && x->redis->fd >= 0 && !x->redis->err) {
+        x->poll_fd = x->redis->fd;
+        sys_addpollfn(x->poll_fd, fn, x);
+    }
+}
+
+/* unregisters the redis socket from pd scheduler fd polling */
+static void redis_polloff(t_redis *x)
+{
+    int i;
+    for (i = 0; i < x->nconns; i++) {
+        if (x->conns[i].poll_fd >= 0) {
+            sys_rmpollfn(x->conns[i].poll_fd);
+            x->conns[i].poll_fd = -1;
+        }
+    }
+    if (x->poll_fd >= 0) {
+        sys_rmpollfn(x->poll_fd);
+        x->poll_fd = -1;
+    }
+}
+
+/* stops polling a broken connection, a readable EOF would otherwise spin,
+ * and reconnects */
+static void redis_ioerror(t_redis *x)
+{
+    redis_polloff(x);
+    redis_connLost(x);
+}
+
+/* true when commands are waiting in the hiredis output buffer */
+static int redis_hasOutput(t_redis *x)
+{
+    int i;
+    for (i = 0; i < x->nconns; i++) {
+        if (x->conns[i].redis->obuf != NULL && sdslen(x->conns[i].redis->obuf) > 0) return 1;
+    }
+    return x->redis != NULL && x->redis->obuf != NULL && sdslen(x->redis->obuf) > 0;
+}
+
+/* writes pending commands, flush_more is set if the socket could not take them all */
+static void redis_flush(t_redis *x)
+{
+    int i, wdone = 1;
+    if (x->nconns) {
+        x->flush_more = 0;
+        for (i = 0; i < x->nconns; i++) {
+            t_redis_conn * c = &x->conns[i];
+            if (c->redis->err || c->redis->obuf == NULL || sdslen(c->redis->obuf) == 0) continue;
+            wdone = 1;
+            if (redis_bufferWrite(c->redis, &wdone, &x->stat_written) == REDIS_ERR) {
+                redis_connError(x, c);
+            } else if (!wdone) {
+                x->flush_more = 1;
+            }
+        }
+        return;
+    }
+    if (redis_hasOutput(x) && redis_bufferWrite(x->redis, &wdone, &x->stat_written) == REDIS_ERR) {
+        redis_ioerror(x);
+        wdone = 1;
+    }
+    x->flush_more = !wdone;
+}
+
+/* true when a bulk string is a plain decimal number, hex, inf and nan stay symbols */
+static int redis_isNumeric(const char * s, size_t len)
+{
+    size_t i = 0;
+    int digits = 0;
+    
+    if (i < len && (s[i] == '-' || s[i] == '+')) i++;
+    while (i < len && s[i] >= '0' && s[i] <= '9') { i++; digits++; }
+    if (i < len && s[i] == '.') {
+        i++;
+        while (i < len && s[i] >= '0' && s[i] <= '9') { i++; digits++; }
+    }
+    if (!digits) return 0;
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < len && (s[i] == '-' || s[i] == '+')) i++;
+        if (i >= len || s[i] < '0' || s[i] > '9') return 0;
+        while (i < len && s[i] >= '0' && s[i] <= '9') i++;
+    }
+    return i == len;
+}
+
+/* gensym for reply strings, counting calls, and with symbols on the distinct
+ * symbols in an open addressing set of symbol pointers, up to SYMBOLS_MAX */
+static t_symbol * redis_gensym(t_redis *x, const char * s)
+{
+    t_symbol * sym = gensym(s);
+    size_t i;
+    
+    x->sym_calls++;
+    if (!x->sym_track || x->sym_count >= SYMBOLS_MAX) return sym;
+    if (x->sym_count * 2 >= x->sym_setsize) {
+        size_t size = x->sym_setsize ? x->sym_setsize * 2 : 256;
+        t_symbol ** set = calloc(size, sizeof(t_symbol*));
+        if (set == NULL) return sym;
+        for (i = 0; i < x->sym_setsize; i++) {
+            if (x->sym_set[i]) {
+                size_t j = ((size_t)x->sym_set[i] >> 3) * 2654435761u & (size - 1);
+                while (set[j]) j = (j + 1) & (size - 1);
+                set[j] = x->sym_set[i];
+            }
+        }
+        free(x->sym_set);
+        x->sym_set = set;
+        x->sym_setsize = size;
+    }
+    i = ((size_t)sym >> 3) * 2654435761u & (x->sym_setsize - 1);
+    while (x->sym_set[i] && x->sym_set[i] != sym) i = (i + 1) & (x->sym_setsize - 1);
+    if (x->sym_set[i] == NULL) {
+        x->sym_set[i] = sym;
+        x->sym_count++;
+    }
+    return sym;
+}
+
+/* stats: every command sent through redis_send, a script call or a batch
+ * is counted and timed until its reply is handled, in a log bucketed
+ * histogram per command name (HDR style, 1 << STATS_SUB_BITS buckets per
+ * power of two microseconds, within 12.5%), recording is a table probe and
+ * a clock read.  Bytes are counted where they cross the socket */
+static void redis_statBegin(t_redis *x, const char * command, size_t len)
+{
+    char name[24];
+    uint32_t hash = 2166136261u;
+    size_t i;
+    int slot;
+    
+    if (len > sizeof(name) - 1) len = sizeof(name) - 1;
+    for (i = 0; i < len; i++) {
+        name[i] = (command[i] >= 'A' && command[i] <= 'Z') ? command[i] + 32 : command[i];
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    name[len] = '\0';
+    x->stat_commands++;
+    x->stat_start = sys_getrealtime();
+    if (x->stat_since == 0) x->stat_since = x->stat_start;
+    x->stat_cmd = 0;
+    
+    if (x->stats == NULL) {
+        if ((x->stats = calloc(STATS_COMMANDS, sizeof(t_redis_stat))) == NULL) return;
+    }
+    slot = hash & (STATS_COMMANDS - 1);
+    while (x->stats[slot].name[0] && strcmp(x->stats[slot].name, name) != 0) slot = (slot + 1) & (STATS_COMMANDS - 1);
+    if (x->stats[slot].name[0] == '\0' && x->stats_count >= STATS_COMMANDS * 3 / 4) {
+        /* the table stays a quarter empty, later names share "other" */
+        strcpy(name, "other");
+        len = 5;
+        for (hash = 2166136261u, i = 0; i < len; i++) hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+        slot = hash & (STATS_COMMANDS - 1);
+        while (x->stats[slot].name[0] && strcmp(x->stats[slot].name, name) != 0) slot = (slot + 1) & (STATS_COMMANDS - 1);
+    }
+    if (x->stats[slot].name[0] == '\0') {
+        if ((x->stats[slot].hist = calloc(STATS_BUCKETS, sizeof(uint32_t))) == NULL) return;
+        memcpy(x->stats[slot].name, name, len + 1);
+        x->stats_count++;
+    }
+    x->stat_cmd = slot + 1;
+}
+
+/* records the latency and errors of a handled reply */
+static void redis_statEnd(t_redis *x, int stat, double start, redisReply * reply)
+{
+    if (reply == NULL || reply->type == REDIS_REPLY_ERROR) x->stat_errors++;
+    if (stat > 0) {
+        t_redis_stat * st = &x->stats[stat - 1];
+        double elapsed = (sys_getrealtime() - start) * 1000000.;
+        uint64_t usec = elapsed > 0 ? (uint64_t)elapsed : 0;
+        st->hist[redis_statBucket(usec)]++;
+        st->count++;
+        if (usec > st->max) st->max = usec;
+    }
+}
+
+/* values below 1 << STATS_SUB_BITS have their own bucket, above the top
+ * STATS_SUB_BITS bits after the leading one pick it within its power of two */
+static int redis_statBucket(uint64_t usec)
+{
+    int e;
+    if (usec < (1u << STATS_SUB_BITS)) return (int)usec;
+    e = 63 - __builtin_clzll(usec);
+    return ((e - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+        (int)((usec >> (e - STATS_SUB_BITS)) & ((1u << STATS_SUB_BITS) - 1));
+}
+
+/* lowest microsecond value of a bucket */
+static double redis_statValue(int bucket)
+{
+    int e = bucket >> STATS_SUB_BITS;
+    int m = bucket & ((1 << STATS_SUB_BITS) - 1);
+    if (e == 0) return m;
+    return (double)((uint64_t)((1 << STATS_SUB_BITS) + m) << (e - 1));
+}
+
+static double redis_statPercentile(t_redis_stat * st, double q)
+{
+    double seen = 0, target = q * st->count;
+    int b;
+    for (b = 0; b < STATS_BUCKETS; b++) {
+        seen += st->hist[b];
+        if (seen > 0 && seen >= target) return redis_statValue(b);
+    }
+    return (double)st->max;
+}
+
+/* stats message method: one "stats <command> count <n> p50 <us> p99 <us>
+ * p999 <us> max <us>" per command name, then "stats total commands <n> rate
+ * <per s> errors <n> written <bytes> read <bytes> peak <queue>", and resets */
+void redis_stats(t_redis *x)
+{
+    double now = sys_getrealtime();
+    double elapsed = x->stat_since ? now - x->stat_since : 0;
+    t_atom out[13];
+    int i;
+    
+    for (i = 0; x->stats && i < STATS_COMMANDS; i++) {
+        t_redis_stat * st = &x->stats[i];
+        if (st->name[0] == '\0' || st->count == 0) continue;
+        SETSYMBOL(&out[0], gensym(st->name));
+        SETSYMBOL(&out[1], gensym("count")); SETFLOAT(&out[2], st->count);
+        SETSYMBOL(&out[3], gensym("p50")); SETFLOAT(&out[4], redis_statPercentile(st, 0.5));
+        SETSYMBOL(&out[5], gensym("p99")); SETFLOAT(&out[6], redis_statPercentile(st, 0.99));
+        SETSYMBOL(&out[7], gensym("p999")); SETFLOAT(&out[8], redis_statPercentile(st, 0.999));
+        SETSYMBOL(&out[9], gensym("max")); SETFLOAT(&out[10], (t_float)st->max);
+        outlet_anything(x->x_obj.ob_outlet, gensym("stats"), 11, out);
+        memset(st->hist, 0, STATS_BUCKETS * sizeof(uint32_t));
+        st->count = 0;
+        st->max = 0;
+    }
+    SETSYMBOL(&out[0], gensym("total"));
+    SETSYMBOL(&out[1], gensym("commands")); SETFLOAT(&out[2], x->stat_commands);
+    SETSYMBOL(&out[3], gensym("rate")); SETFLOAT(&out[4], elapsed > 0 ? x->stat_commands / elapsed : 0);
+    SETSYMBOL(&out[5], gensym("errors")); SETFLOAT(&out[6], x->stat_errors);
+    SETSYMBOL(&out[7], gensym("written")); SETFLOAT(&out[8], x->stat_written);
+    SETSYMBOL(&out[9], gensym("read")); SETFLOAT(&out[10], x->stat_read);
+    SETSYMBOL(&out[11], gensym("peak")); SETFLOAT(&out[12], x->stat_peak);
+    outlet_anything(x->x_obj.ob_outlet, gensym("stats"), 13, out);
+    x->stat_commands = 0;
+    x->stat_errors = 0;
+    x->stat_written = 0;
+    x->stat_read = 0;
+    x->stat_peak = x->pend_count;
+    x->stat_since = now;
+}
+
+/* bulk string reply as atom, a float in numeric decode mode when it reads as one */
+static void redis_decodeString(t_redis *x, redisReply * reply, t_atom * a)
+{
+    if (x->decode_numeric && redis_isNumeric(reply->str, reply->len)) {
+        x->sym_numeric++;
+        SETFLOAT(a, strtod(reply->str, NULL));
+    } else {
+        SETSYMBOL(a, redis_gensym(x, reply->str));
+    }
+}
+
+/* decode message method: numeric outputs numeric strings as floats, symbol (default) as symbols */
+void redis_decode(t_redis *x, t_symbol *s)
+{
+    if (s == gensym("numeric")) {
+        x->decode_numeric = 1;
+    } else if (s == gensym("symbol")) {
+        x->decode_numeric = 0;
+    } else {
+        post("puredis: decode numeric or symbol");
+    }
+}
+
+/* symbols message method: on/off (1/0) start and stop counting distinct
+ * symbols, alone outputs the symbols interned, gensym calls and strings
+ * decoded as floats, and clears the distinct symbols */
+void redis_symbols(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    t_atom stats[7];
+    (void)s;
+    if (argc > 0) {
+        t_symbol *mode = atom_getsymbol(argv);
+        if (argv[0].a_type == A_FLOAT) x->sym_track = atom_getfloat(argv) != 0;
+        else if (mode == gensym("on")) x->sym_track = 1;
+        else if (mode == gensym("off")) x->sym_track = 0;
+        else post("puredis: symbols on, off or nothing to report");
+        if (!x->sym_track) {
+            free(x->sym_set);
+            x->sym_set = NULL;
+            x->sym_setsize = 0;
+            x->sym_count = 0;
+        }
+        return;
+    }
+    SETSYMBOL(&stats[0], gensym("symbols"));
+    SETSYMBOL(&stats[1], gensym("interned"));
+    SETFLOAT(&stats[2], x->sym_count);
+    SETSYMBOL(&stats[3], gensym("calls"));
+    SETFLOAT(&stats[4], x->sym_calls);
+    SETSYMBOL(&stats[5], gensym("numeric"));
+    SETFLOAT(&stats[6], x->sym_numeric);
+    if (x->sym_set) memset(x->sym_set, 0, x->sym_setsize * sizeof(t_symbol*));
+    x->sym_count = 0;
+    outlet_list(x->x_obj.ob_outlet, &s_list, 7, &stats[0]);
+}
+
+/* number of atoms a reply expands to */
+static size_t redis_countReply(redisReply * reply)
+{
+    if (reply->type == REDIS_REPLY_ARRAY) {
+        size_t i, count = 0;
+        for (i = 0; i < reply->elements; i++) {
+            count += redis_countReply(reply->element[i]);
+        }
+        return count;
+    }
+    return 1;
+}
+
+/* grows the reply atom buffer, allocated on first use, to hold count atoms */
+static t_atom * redis_reserveOut(t_redis *x, size_t count)
+{
+    if (count > x->out_size) {
+        size_t size = x->out_size ? x->out_size : MAX_ARRAY_SIZE;
+        t_atom * out;
+        while (size < count) size *= 2;
+        if ((out = realloc(x->out, size * sizeof(t_atom))) == NULL) return NULL;
+        x->out = out;
+        x->out_size = size;
+    }
+    return x->out;
+}
+
+/* gives memory back once a reply spike is over */
+static void redis_shrinkOut(t_redis *x)
+{
+    if (x->out_size > MAX_ARRAY_SIZE && (size_t)x->out_count < x->out_size / 4) {
+        size_t size = MAX_ARRAY_SIZE;
+        t_atom * out;
+        while (size < (size_t)x->out_count * 2) size *= 2;
+        if ((out = realloc(x->out, size * sizeof(t_atom))) == NULL) return;
+        x->out = out;
+        x->out_size = size;
+    }
+}
+
+/* recursive redis reply parsing as pd list, returns the new atom count */
+static int redis_prepareOutList(t_redis *x, redisReply * reply, t_atom * out, int n)
+{
+    if (reply->type == REDIS_REPLY_ERROR) {
+        SETSYMBOL(&out[n],redis_gensym(x,reply->str));
+        n++;
+    } else if (reply->type == REDIS_REPLY_STATUS) {
+        SETSYMBOL(&out[n],redis_gensym(x,reply->str));
+        n++;
+    } else if (reply->type == REDIS_REPLY_STRING) {
+        redis_decodeString(x,reply,&out[n]);
+        n++;
+    } else if (reply->type == REDIS_REPLY_ARRAY) {
+        size_t i;
+        for (i = 0; i < reply->elements; i++) {
+            n = redis_prepareOutList(x,reply->element[i],out,n);
+        }
+    } else if (reply->type == REDIS_REPLY_INTEGER) {
+        SETFLOAT(&out[n],reply->integer);
+        n++;
+    } else if (reply->type == REDIS_REPLY_NIL) {
+        SETSYMBOL(&out[n],redis_gensym(x,"nil"));
+        n++;
+    }
+    return n;
+}
+
+/* sends redis reply to outlet */
+static void redis_parseReply(t_redis *x, redisReply * reply)
+{
+    if (reply->type == REDIS_REPLY_ERROR) {
+        outlet_symbol(x->x_obj.ob_outlet, redis_gensym(x,reply->str));
+    } else if (reply->type == REDIS_REPLY_STATUS) {
+        outlet_symbol(x->x_obj.ob_outlet, redis_gensym(x,reply->str));
+    } else if (reply->type == REDIS_REPLY_STRING) {
+        t_atom value;
+        redis_decodeString(x, reply, &value);
+        if (value.a_type == A_FLOAT) {
+            outlet_float(x->x_obj.ob_outlet, atom_getfloat(&value));
+        } else {
+            outlet_symbol(x->x_obj.ob_outlet, atom_getsymbol(&value));
+        }
+    } else if (reply->type == REDIS_REPLY_ARRAY) {
+        size_t count = redis_countReply(reply);
+        if (x->chunk_size > 0 && count > (size_t)x->chunk_size &&
+            !x->out_busy && !x->chunk_reply && redis_chunkStart(x, reply)) {
+            return;
+        } else if (x->out_busy) {
+            /* reentered from our own outlet, the shared buffer is in use */
+            t_atom * out = malloc((count ? count : 1) * sizeof(t_atom));
+            if (out == NULL) {
+                post("puredis: can not proceed!!  Memory Error!");
+            } else {
+                int n = redis_prepareOutList(x, reply, out, 0);
+                outlet_list(x->x_obj.ob_outlet, &s_list, n, out);
+                free(out);
+            }
+        } else if (redis_reserveOut(x, count) == NULL) {
+            post("puredis: can not proceed!!  Memory Error!");
+        } else {
+            x->out_count = redis_prepareOutList(x, reply, x->out, 0);
+            x->out_busy = 1;
+            outlet_list(x->x_obj.ob_outlet, &s_list, x->out_count, x->out);
+            x->out_busy = 0;
+            redis_shrinkOut(x);
+        }
+    } else if (reply->type == REDIS_REPLY_INTEGER) {
+        t_atom value;
+        SETFLOAT(&value, reply->integer);
+        outlet_float(x->x_obj.ob_outlet, atom_getfloat(&value));
+    } else if (reply->type == REDIS_REPLY_NIL) {
+        outlet_symbol(x->x_obj.ob_outlet, redis_gensym(x,"nil"));
+    }
+    freeReplyObject(reply);
+}
+
+/* chunked output: a large array reply is walked in place and sent as
+ * "chunk" lists of at most chunk_size atoms, one per dsp block, followed by
+ * "chunk-end <atoms>", replies behind it wait until it is done */
+static int redis_chunkStart(t_redis *x, redisReply * reply)
+{
+    if (redis_reserveOut(x, x->chunk_size) == NULL) return 0;
+    if (x->chunk_clock == NULL) x->chunk_clock = clock_new(x, (t_method)redis_chunkTick);
+    x->chunk_reply = reply;
+    x->chunk_stack[0] = reply;
+    x->chunk_pos[0] = 0;
+    x->chunk_depth = 1;
+    x->chunk_total = 0;
+    redis_chunkOut(x);
+    if (x->chunk_reply) clock_delay(x->chunk_clock, 64 * 1000. / sys_getsr());
+    return 1;
+}
+
+/* outputs the next chunk of the reply in progress, ends it when walked */
+static void redis_chunkOut(t_redis *x)
+{
+    int n = 0;
+    
+    while (x->chunk_depth > 0 && n < x->chunk_size) {
+        int d = x->chunk_depth - 1;
+        redisReply * e;
+        if (x->chunk_pos[d] >= x->chunk_stack[d]->elements) {
+            x->chunk_depth--;
+            continue;
+        }
+        e = x->chunk_stack[d]->element[x->chunk_pos[d]++];
+        if (e->type == REDIS_REPLY_ARRAY && x->chunk_depth < CHUNK_DEPTH) {
+            x->chunk_stack[x->chunk_depth] = e;
+            x->chunk_pos[x->chunk_depth] = 0;
+            x->chunk_depth++;
+        } else if (e->type == REDIS_REPLY_ARRAY) {
+            /* nested deeper than the iterator goes, flattened at once */
+            if (redis_reserveOut(x, n + redis_countReply(e)) == NULL) break;
+            n = redis_prepareOutList(x, e, x->out, n);
+        } else {
+            n = redis_prepareOutList(x, e, x->out, n);
+        }
+    }
+    
+    x->chunk_total += n;
+    x->out_count = n;
+    if (n > 0) {
+        x->out_busy = 1;
+        outlet_anything(x->x_obj.ob_outlet, gensym("chunk"), n, x->out);
+        x->out_busy = 0;
+    }
+    if (x->chunk_depth > 0 && n > 0) return;
+    
+    {
+        t_atom total;
+        freeReplyObject(x->chunk_reply);
+        x->chunk_reply = NULL;
+        x->chunk_depth = 0;
+        SETFLOAT(&total, x->chunk_total);
+        outlet_anything(x->x_obj.ob_outlet, gensym("chunk-end"), 1, &total);
+        redis_shrinkOut(x);
+    }
+}
+
+/* chunk clock callback, resumes reply output once the chunked reply is done */
+static void redis_chunkTick(t_redis *x)
+{
+    redis_chunkOut(x);
+    if (x->chunk_reply) {
+        clock_delay(x->chunk_clock, 64 * 1000. / sys_getsr());
+    } else if (x->async) {
+        if (x->async_run) apuredis_run(x);
+    } else if (x->thread_on) {
+        puredis_thread_run(x);
+    }
+}
+
+/* outputs the rest of a chunked reply at once */
+static void redis_chunkFlush(t_redis *x)
+{
+    while (x->chunk_reply) redis_chunkOut(x);
+    clock_unset(x->chunk_clock);
+}
+
+/* chunk message method: largest list sent for an array reply, 0 sends it whole -- Puredis/Apuredis */
+void redis_chunk(t_redis *x, t_floatarg size)
+{
+    x->chunk_size = size < 0 ? 0 : (int)size;
+    if (x->chunk_reply && !x->out_busy) {
+        redis_chunkFlush(x);
+        if (x->async && x->async_run) apuredis_run(x);
+        else if (x->thread_on) puredis_thread_run(x);
+    }
+}
+
+/* finds a pd array by name */
+static t_garray * redis_findArray(t_symbol * name, int * size, t_word ** vec)
+{
+    t_garray * a = (t_garray*)pd_findbyclass(name, garray_class);
+    if (a == NULL) {
+        post("puredis: %s: no such array", name->s_name); return NULL;
+    }
+    if (!garray_getfloatwords(a, size, vec)) {
+        post("puredis: %s: bad template for array", name->s_name); return NULL;
+    }
+    return a;
+}
+
+/* array values to little endian float32, the SSE2 path gathers the floats
+ * out of the t_word slots four at a time */
+static void redis_packFloats(const t_word * vec, int n, unsigned char * buf)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    if (sizeof(t_float) == 4 && sizeof(t_word) == 8) {
+        for (; i + 4 <= n; i += 4) {
+            __m128 a = _mm_loadu_ps((const float*)(vec + i));
+            __m128 b = _mm_loadu_ps((const float*)(vec + i + 2));
+            _mm_storeu_ps((float*)(buf + 4 * i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        float f = vec[i].w_float;
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        buf[4 * i] = bits & 0xff;
+        buf[4 * i + 1] = (bits >> 8) & 0xff;
+        buf[4 * i + 2] = (bits >> 16) & 0xff;
+        buf[4 * i + 3] = (bits >> 24) & 0xff;
+    }
+}
+
+/* little endian float32 to array values */
+static void redis_unpackFloats(const unsigned char * buf, int n, t_word * vec)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    if (sizeof(t_float) == 4 && sizeof(t_word) == 8) {
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps((const float*)(buf + 4 * i));
+            _mm_storeu_ps((float*)(vec + i), _mm_unpacklo_ps(v, _mm_setzero_ps()));
+            _mm_storeu_ps((float*)(vec + i + 2), _mm_unpackhi_ps(v, _mm_setzero_ps()));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        float f;
+        uint32_t bits = (uint32_t)buf[4 * i] | (uint32_t)buf[4 * i + 1] << 8 |
+            (uint32_t)buf[4 * i + 2] << 16 | (uint32_t)buf[4 * i + 3] << 24;
+        memcpy(&f, &bits, 4);
+        vec[i].w_float = f;
+    }
+}
+
+/* writes a reply to an array: a string as packed float32, an array element
+ * by element, then outputs toarray <array> <points written> */
+static void redis_writeArray(t_redis *x, t_symbol * name, redisReply * reply)
+{
+    t_garray * a;
+    t_word * vec;
+    int size, n = 0;
+    t_atom status[2];
+    
+    if (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_ARRAY) {
+        redis_parseReply(x, reply); return;
+    }
+    if ((a = redis_findArray(name, &size, &vec)) == NULL) {
+        freeReplyObject(reply); return;
+    }
+    if (reply->type == REDIS_REPLY_STRING) {
+        n = reply->len / 4 < size ? reply->len / 4 : size;
+        redis_unpackFloats((const unsigned char*)reply->str, n, vec);
+    } else {
+        size_t i;
+        for (i = 0; i < reply->elements && n < size; i++, n++) {
+            redisReply * e = reply->element[i];
+            if (e->type == REDIS_REPLY_INTEGER) {
+                vec[n].w_float = e->integer;
+            } else if (e->type == REDIS_REPLY_STRING) {
+                vec[n].w_float = strtod(e->str, NULL);
+            } else {
+                vec[n].w_float = 0;
+            }
+        }
+    }
+    freeReplyObject(reply);
+    garray_redraw(a);
+    
+    SETSYMBOL(&status[0], name);
+    SETFLOAT(&status[1], n);
+    outlet_anything(x->x_obj.ob_outlet, gensym("toarray"), 2, status);
+}
+
+/* toarray message method: toarray <array> <command...> writes the reply to the array -- Puredis/Apuredis */
+void redis_toarray(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    if (argc < 2 || argv[0].a_type != A_SYMBOL) {
+        post("puredis: toarray <array> <command...>"); return;
+    }
+    if (x->batch_on) {
+        post("puredis: toarray is not available in a batch"); return;
+    }
+    if (!redis_buildCommand(x, NULL, argc - 1, argv + 1)) return;
+    redis_send(x, argc - 1, x->cmd_argv, x->cmd_lengths, REPLY_ARRAY, argv[0].a_w.w_symbol);
+}
+
+/* fromarray message method: fromarray <array> <key> [list|packed]
+ * list replaces the key with RPUSHes of the values, packed SETs the key to
+ * the values as little endian float32 -- Puredis/Apuredis */
+void redis_fromarray(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    t_symbol * mode = atom_getsymbolarg(2, argc, argv);
+    t_word * vec;
+    char buf[MAXPDSTRING];
+    const char * key = buf;
+    int i, size;
+    
+    (void)s;
+    if (argc < 2 || argv[0].a_type != A_SYMBOL) {
+        post("puredis: fromarray <array> <key> [list|packed]"); return;
+    }
+    if (x->batch_on) {
+        post("puredis: fromarray is not available in a batch"); return;
+    }
+    if (mode != &s_ && mode != gensym("list") && mode != gensym("packed")) {
+        post("puredis: fromarray mode list or packed"); return;
+    }
+    if (redis_findArray(argv[0].a_w.w_symbol, &size, &vec) == NULL) return;
+    /* atom_string would escape spaces, commas and dollars */
+    if (argv[1].a_type == A_SYMBOL) {
+        key = argv[1].a_w.w_symbol->s_name;
+    } else {
+        atom_string(argv + 1, buf, MAXPDSTRING);
+    }
+    
+    if (mode == gensym("packed")) {
+        if (!redis_reserveCommand(x, 3, (size_t)size * 4 + 1)) return;
+        redis_packFloats(vec, size, (unsigned char*)x->cmd_buf);
+        x->cmd_argv[0] = "SET"; x->cmd_lengths[0] = 3;
+        x->cmd_argv[1] = key; x->cmd_lengths[1] = strlen(key);
+        x->cmd_argv[2] = x->cmd_buf; x->cmd_lengths[2] = (size_t)size * 4;
+        redis_send(x, 3, x->cmd_argv, x->cmd_lengths, REPLY_OUTLET, NULL);
+        return;
+    }
+    
+    /* only the reply of the last command is output */
+    if (!redis_reserveCommand(x, ARRAY_BATCH + 2, ARRAY_BATCH * 32)) return;
+    x->cmd_argv[0] = "DEL"; x->cmd_lengths[0] = 3;
+    x->cmd_argv[1] = key; x->cmd_lengths[1] = strlen(key);
+    redis_send(x, 2, x->cmd_argv, x->cmd_lengths, size ? REPLY_DISCARD : REPLY_OUTLET, NULL);
+    for (i = 0; i < size; ) {
+        int n = 2;
+        size_t pos = 0;
+        x->cmd_argv[0] = "RPUSH"; x->cmd_lengths[0] = 5;
+        for (; i < size && n < ARRAY_BATCH + 2; i++, n++) {
+            char * part = x->cmd_buf + pos;
+            x->cmd_lengths[n] = snprintf(part, 32, "%.9g", vec[i].w_float);
+            x->cmd_argv[n] = part;
+            pos += x->cmd_lengths[n] + 1;
+        }
+        redis_send(x, n, x->cmd_argv, x->cmd_lengths, i < size ? REPLY_DISCARD : REPLY_OUTLET, NULL);
+    }
+}
+
+/* sharding: an object created with several host:port arguments routes
+ * each command to the shard of its keys on a consistent hash ring, every
+ * shard has its own pipeline and replies are output in command order */
+static int redis_shardNew(t_redis *x, int argc, t_atom *argv)
+{
+    int i, j;
+    
+    if ((x->conns = calloc(argc, sizeof(t_redis_conn))) == NULL ||
+        (x->shard_points = malloc(argc * SHARD_VNODES * sizeof(t_redis_point))) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    for (i = 0; i < argc; i++) {
+        t_redis_conn * c = &x->conns[x->nconns];
+        char host[MAXPDSTRING];
+        char * colon;
+        
+        atom_string(argv + i, host, MAXPDSTRING);
+        if ((colon = strrchr(host, ':')) == NULL) {
+            post("puredis: shard %s is not host:port", host); return 0;
+        }
+        *colon = '\0';
+        c->host = gensym(host)->s_name;
+        c->port = atoi(colon + 1);
+        c->poll_fd = -1;
+        if (!redis_connOpen(x, c)) {
+            post("puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        x->nconns++;
+        /* a shard that is down keeps its place on the ring, its commands
+         * are answered with the connection error */
+        if (c->redis->err) post("puredis: could not connect to redis shard %s:%d: %s", c->host, c->port, c->redis->errstr);
+        for (j = 0; j < SHARD_VNODES; j++) {
+            char point[MAXPDSTRING + 32];
+            int len = snprintf(point, sizeof(point), "%s:%d-%d", c->host, c->port, j);
+            x->shard_points[x->shard_npoints].hash = redis_hash(point, len);
+            x->shard_points[x->shard_npoints].conn = i;
+            x->shard_npoints++;
+        }
+        if (!c->redis->err) post("Puredis %i.%i.%i connected to redis shard host: %s port: %u", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH, c->host, c->port);
+    }
+    qsort(x->shard_points, x->shard_npoints, sizeof(t_redis_point), redis_pointCompare);
+    x->r_host = x->conns[0].host;
+    x->r_port = x->conns[0].port;
+    return 1;
+}
+
+static void redis_shardFree(t_redis *x)
+{
+    int i;
+    for (i = 0; i < x->nconns; i++) {
+        if (x->conns[i].redis) redisFree(x->conns[i].redis);
+        free(x->conns[i].seqs);
+    }
+    free(x->conns);
+    free(x->shard_points);
+    x->nconns = 0;
+}
+
+/* 32 bit FNV-1a with a murmur finalizer, spreads the ring points evenly */
+static uint32_t redis_hash(const char * s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16; h *= 0x85ebca6bu;
+    h ^= h >> 13; h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/* narrows a key to its hash tag, the part between the first { and the
+ * next } when not empty, so related keys can share a shard */
+static void redis_hashTag(const char ** s, size_t * len)
+{
+    const char * open = memchr(*s, '{', *len);
+    if (open) {
+        size_t rest = *len - (open + 1 - *s);
+        const char * close = memchr(open + 1, '}', rest);
+        if (close && close > open + 1) {
+            *s = open + 1;
+            *len = close - open - 1;
+        }
+    }
+}
+
+static int redis_pointCompare(const void * a, const void * b)
+{
+    uint32_t ha = ((const t_redis_point*)a)->hash;
+    uint32_t hb = ((const t_redis_point*)b)->hash;
+    return ha < hb ? -1 : ha > hb;
+}
+
+/* shard of a key: the first ring point at or after its hash */
+static int redis_shardOf(t_redis *x, const char * key, size_t len)
+{
+    uint32_t h;
+    int lo = 0, hi = x->shard_npoints;
+    
+    redis_hashTag(&key, &len);
+    h = redis_hash(key, len);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (x->shard_points[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return x->shard_points[lo == x->shard_npoints ? 0 : lo].conn;
+}
+
+static const t_redis_keyspec * redis_keyspec(const char * cmd, size_t len)
+{
+    const t_redis_keyspec * spec;
+    for (spec = redis_keyspecs; spec->name; spec++) {
+        size_t i;
+        if (strlen(spec->name) != len) continue;
+        for (i = 0; i < len; i++) {
+            char c = cmd[i];
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+            if (c != spec->name[i]) break;
+        }
+        if (i == len) return spec;
+    }
+    return NULL;
+}
+
+/* shard of a command: -1 for keyless commands sent to every shard, -2 when
+ * its keys are on different shards (slots in cluster mode), -3 when it can
+ * not be routed at all, commands not listed have one key first */
+static int redis_shardRoute(t_redis *x, int argc, const char ** vector, const size_t * lengths)
+{
+    t_redis_route route = { x, -1 };
+    int r = redis_eachKey(argc, vector, lengths, redis_routeKey, &route);
+    
+    if (r == -2) return -3;
+    if (r < 0) return -1;
+    if (r > 0) return -2;
+    if (route.shard < 0) return 0;
+    if (x->cluster) return x->slot_conn[route.shard] >= 0 ? x->slot_conn[route.shard] : 0;
+    return route.shard;
+}
+
+/* key walk callback of redis_shardRoute, stops on a second shard */
+static int redis_routeKey(void * data, const char * key, size_t len)
+{
+    t_redis_route * route = (t_redis_route*)data;
+    int s = route->x->cluster ? redis_keySlot(key, len) : redis_shardOf(route->x, key, len);
+    if (route->shard >= 0 && s != route->shard) return 1;
+    route->shard = s;
+    return 0;
+}
+
+/* calls fn on every key of a command, -1 for keyless commands, -2 for
+ * rejected ones, a nonzero fn result stops the walk and is returned */
+static int redis_eachKey(int argc, const char ** vector, const size_t * lengths, int (*fn)(void *, const char *, size_t), void * data)
+{
+    const t_redis_keyspec * spec = redis_keyspec(vector[0], lengths[0]);
+    int first = 1, last = 1, step = 1, i, r;
+    
+    if (spec) {
+        if (spec->step == 0) return -1;
+        if (spec->flags & KEYS_REJECT) return -2;
+        first = spec->first; step = spec->step;
+        last = spec->last == -1 ? argc - 1 : spec->last == -2 ? argc - 2 : spec->last;
+    }
+    if (spec && (spec->flags & KEYS_STREAMS)) {
+        /* STREAMS key ... id ..., the same number of keys and ids */
+        for (first = 1; first < argc; first++) {
+            if (lengths[first] == 7 && strncasecmp(vector[first], "streams", 7) == 0) break;
+        }
+        first++;
+        last = first + (argc - first) / 2 - 1;
+    }
+    if (spec && (spec->flags & KEYS_STORE)) {
+        for (i = first + 1; i + 1 < argc; i++) {
+            if ((lengths[i] == 5 && strncasecmp(vector[i], "store", 5) == 0) ||
+                (lengths[i] == 9 && strncasecmp(vector[i], "storedist", 9) == 0)) {
+                if ((r = fn(data, vector[i + 1], lengths[i + 1])) != 0) return r;
+            }
+        }
+    }
+    if (spec && spec->numkeys) {
+        int numkeys = spec->numkeys < argc ? atoi(vector[spec->numkeys]) : 0;
+        for (i = first; i < spec->numkeys && i < argc; i++) {
+            if ((r = fn(data, vector[i], lengths[i])) != 0) return r;
+        }
+        first = spec->numkeys + 1;
+        last = spec->numkeys + numkeys;
+    }
+    for (i = first; i <= last && i < argc; i += step) {
+        if ((r = fn(data, vector[i], lengths[i])) != 0) return r;
+    }
+    return 0;
+}
+
+/* records the sequence number of an entry waiting for a reply from c */
+static int redis_seqPush(t_redis_conn * c, unsigned long seq)
+{
+    if (c->seq_count == c->seq_size) {
+        int i, size = c->seq_size ? c->seq_size * 2 : 64;
+        unsigned long * seqs = malloc(size * sizeof(unsigned long));
+        if (seqs == NULL) return 0;
+        for (i = 0; i < c->seq_count; i++) {
+            seqs[i] = c->seqs[(c->seq_head + i) % c->seq_size];
+        }
+        free(c->seqs);
+        c->seqs = seqs;
+        c->seq_size = size;
+        c->seq_head = 0;
+    }
+    c->seqs[(c->seq_head + c->seq_count) % c->seq_size] = seq;
+    c->seq_count++;
+    return 1;
+}
+
+/* error reply standing in for the reply of a broken connection */
+static redisReply * redis_errorReply(const char * msg)
+{
+    redisReply * r = calloc(1, sizeof(redisReply));
+    if (r == NULL) return NULL;
+    r->type = REDIS_REPLY_ERROR;
+    r->len = strlen(msg);
+    if ((r->str = malloc(r->len + 1)) == NULL) {
+        free(r); return NULL;
+    }
+    memcpy(r->str, msg, r->len + 1);
+    return r;
+}
+
+/* combines the replies of a command sent to every shard: arrays are
+ * concatenated, integers summed, an error wins, otherwise the first stays */
+static redisReply * redis_mergeReply(redisReply * a, redisReply * b)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    if (b->type == REDIS_REPLY_ERROR && a->type != REDIS_REPLY_ERROR) {
+        freeReplyObject(a);
+        return b;
+    }
+    if (a->type == REDIS_REPLY_INTEGER && b->type == REDIS_REPLY_INTEGER) {
+        a->integer += b->integer;
+    } else if (a->type == REDIS_REPLY_ARRAY && b->type == REDIS_REPLY_ARRAY && b->elements > 0) {
+        redisReply ** element = realloc(a->element, (a->elements + b->elements) * sizeof(redisReply*));
+        if (element) {
+            memcpy(element + a->elements, b->element, b->elements * sizeof(redisReply*));
+            a->element = element;
+            a->elements += b->elements;
+            b->elements = 0;
+        }
+    }
+    freeReplyObject(b);
+    return a;
+}
+
+/* queues a command on the shard of its keys, or on every shard */
+static void redis_shardSend(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array)
+{
+    int shard = redis_shardRoute(x, argc, vector, lengths);
+    int i, first = shard < 0 ? 0 : shard, last = shard < 0 ? x->nconns - 1 : shard;
+    unsigned long seq;
+    t_redis_entry * e;
+    
+    if (!x->async && x->chunk_reply && !x->out_busy) redis_chunkFlush(x);
+    if (!redis_pendPush(x, kind, array)) return;
+    seq = x->pend_seq + x->pend_count - 1;
+    e = &x->pend[(x->pend_head + x->pend_count - 1) % x->pend_size];
+    e->slots = last - first + 1;
+    if (shard < -1) {
+        /* answered right away with an error, in its place in the reply order */
+        char msg[128];
+        if (shard == -2) {
+            snprintf(msg, sizeof(msg), "%.*s keys are on different %s, use {hash tags}", (int)lengths[0], vector[0],
+                x->cluster ? "slots" : "shards");
+        } else {
+            snprintf(msg, sizeof(msg), "%.*s can not be routed to %s", (int)lengths[0], vector[0],
+                x->cluster ? "cluster nodes" : "shards");
+        }
+        e->slots = 1;
+        redis_shardReplyAt(x, seq, redis_errorReply(msg));
+        first = 0; last = -1;
+    }
+    if (x->cluster && shard >= 0) {
+        int len = redisFormatCommandArgv(&e->cmd, argc, vector, lengths);
+        e->cmdlen = len > 0 ? (size_t)len : 0;
+    }
+    
+    for (i = first; i <= last; i++) {
+        t_redis_conn * c = &x->conns[i];
+        if (c->redis->err || !redis_seqPush(c, seq)) {
+            redis_shardReplyAt(x, seq, redis_errorReply(c->redis->err ? c->redis->errstr : "out of memory"));
+            continue;
+        }
+        if (e->cmd) {
+            redis_appendRaw(c->redis, e->cmd, e->cmdlen);
+        } else {
+            redisAppendCommandArgv(c->redis, argc, vector, lengths);
+        }
+    }
+    
+    if (x->async) {
+        x->async_num++;
+        apuredis_q_out(x);
+        /* an entry failed right away is output on the next tick */
+        if (x->pend[x->pend_head].slots <= 0) x->drain_more = 1;
+        apuredis_schedule(x);
+        return;
+    }
+    redis_shardWait(x);
+}
+
+/* sync shard reading: waits for every reply owed, following redirects */
+static void redis_shardWait(t_redis *x)
+{
+    int i, busy = 1;
+    while (busy) {
+        for (i = 0; i < x->nconns; i++) {
+            t_redis_conn * c = &x->conns[i];
+            while (c->seq_count > 0) {
+                void * reply = NULL;
+                if (redis_getReply(c->redis, &reply, &x->stat_written, &x->stat_read) == REDIS_ERR || reply == NULL) {
+                    redis_connError(x, c);
+                    break;
+                }
+                redis_shardReply(x, c, (redisReply*)reply);
+            }
+        }
+        busy = redis_clusterFollow(x);
+    }
+    redis_shardOutput(x);
+}
+
+/* takes the next reply owed by a shard */
+static void redis_shardReply(t_redis *x, t_redis_conn * c, redisReply * reply)
+{
+    unsigned long seq;
+    
+    if (c->seq_count == 0) {
+        if (reply) freeReplyObject(reply);
+        return;
+    }
+    seq = c->seqs[c->seq_head];
+    c->seq_head = (c->seq_head + 1) % c->seq_size;
+    c->seq_count--;
+    if (seq == SEQ_DISCARD) {
+        if (reply) freeReplyObject(reply);
+        return;
+    }
+    if (seq == SEQ_SLOTS) {
+        /* read by redis_clusterFollow, once the shards are not walked anymore */
+        if (x->slots_reply) freeReplyObject(x->slots_reply);
+        x->slots_reply = reply;
+        return;
+    }
+    if (x->cluster && reply && redis_clusterRedirect(x, seq, reply)) return;
+    redis_shardReplyAt(x, seq, reply);
+}
+
+/* stores a shard reply in its entry */
+static void redis_shardReplyAt(t_redis *x, unsigned long seq, redisReply * reply)
+{
+    t_redis_entry * e = &x->pend[(x->pend_head + (seq - x->pend_seq)) % x->pend_size];
+    e->reply = redis_mergeReply(e->reply, reply);
+    e->slots--;
+}
+
+/* outputs the entries complete at the head of the queue, in command order */
+static void redis_shardOutput(t_redis *x)
+{
+    int count = 0;
+    double start = sys_getrealtime();
+    
+    while (x->pend_count > 0 && x->chunk_reply == NULL && x->pend[x->pend_head].slots <= 0) {
+        t_redis_entry e;
+        redis_pendPop(x, &e);
+        free(e.cmd);
+        if (x->async_num > 0) x->async_num--;
+        redis_statEnd(x, e.stat, e.start, e.reply);
+        if (e.reply) {
+            redis_handleReply(x, e.kind, e.array, e.reply);
+        } else {
+            outlet_symbol(x->x_obj.ob_outlet, gensym("error"));
+        }
+        count++;
+        if (x->async && ((x->drain_max > 0 && count >= x->drain_max) ||
+            (x->drain_budget > 0 && sys_getrealtime() - start >= x->drain_budget))) {
+            x->drain_more = (x->pend_count > 0 && x->pend[x->pend_head].slots <= 0);
+            return;
+        }
+    }
+}
+
+/* apuredis shard yielding: writes and reads every shard, then outputs */
+static void redis_shardYield(t_redis *x)
+{
+    int i;
+    redis_flush(x);
+    for (i = 0; i < x->nconns; i++) {
+        t_redis_conn * c = &x->conns[i];
+        void * reply = NULL;
+        if (c->redis->err) continue;
+        if (redis_bufferRead(c->redis, &x->stat_read) == REDIS_ERR) {
+            redis_connError(x, c);
+            continue;
+        }
+        while (c->seq_count > 0 && redisGetReplyFromReader(c->redis, &reply) == REDIS_OK && reply != NULL) {
+            redis_shardReply(x, c, (redisReply*)reply);
+        }
+    }
+    redis_clusterFollow(x);
+    redis_shardOutput(x);
+}
+
+/* opens the connection of a shard or cluster node, without blocking for
+ * apuredis and for at most the connection timeout for puredis, a previous
+ * context is replaced, 0 when none could be allocated */
+static int redis_connOpen(t_redis *x, t_redis_conn * c)
+{
+    struct timeval timeout = { x->conn_timeout / 1000, (x->conn_timeout % 1000) * 1000 };
+    redisContext * redis = x->async ? redisConnectNonBlock(c->host, c->port) : redisConnectWithTimeout(c->host, c->port, timeout);
+    
+    if (redis == NULL) return 0;
+    if (c->poll_fd >= 0) {
+        sys_rmpollfn(c->poll_fd);
+        c->poll_fd = -1;
+    }
+    if (c->redis) redisFree(c->redis);
+    c->redis = redis;
+    return 1;
+}
+
+/* a broken shard stops polling and fails the commands it still owes */
+static void redis_connError(t_redis *x, t_redis_conn * c)
+{
+    post("puredis: redis shard %s:%d error: %s", c->host, c->port, c->redis->errstr);
+    if (c->poll_fd >= 0) {
+        sys_rmpollfn(c->poll_fd);
+        c->poll_fd = -1;
+    }
+    while (c->seq_count > 0) {
+        redis_shardReply(x, c, redis_errorReply(c->redis->errstr[0] ? c->redis->errstr : "connection lost"));
+    }
+}
+
+/* cluster: an object created with cluster and seed host:port arguments
+ * routes commands by hash slot to one connection per master node, using a
+ * slot map read from CLUSTER SLOTS and following MOVED/ASK redirects, the
+ * redirected commands keep their place in the reply order */
+static int redis_clusterNew(t_redis *x, int argc, t_atom *argv)
+{
+    int i;
+    
+    x->cluster = 1;
+    if ((x->slot_conn = malloc(CLUSTER_SLOTS * sizeof(short))) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    for (i = 0; i < CLUSTER_SLOTS; i++) x->slot_conn[i] = -1;
+    x->cluster_clock = clock_new(x, (t_method)redis_clusterRefresh);
+    
+    for (i = 0; i < argc; i++) {
+        char host[MAXPDSTRING];
+        char * colon;
+        atom_string(argv + i, host, MAXPDSTRING);
+        if ((colon = strrchr(host, ':')) == NULL) {
+            post("puredis: cluster node %s is not host:port", host); return 0;
+        }
+        *colon = '\0';
+        if (redis_clusterConn(x, host, atoi(colon + 1)) < 0) return 0;
+    }
+    redis_clusterRefresh(x);
+    x->r_host = x->conns[0].host;
+    x->r_port = x->conns[0].port;
+    return 1;
+}
+
+/* connection to a cluster node, opened on first use */
+static int redis_clusterConn(t_redis *x, const char * host, int port)
+{
+    t_redis_conn * conns;
+    t_redis_conn * c;
+    int i;
+    
+    for (i = 0; i < x->nconns; i++) {
+        c = &x->conns[i];
+        if (c->port != port || strcmp(c->host, host) != 0) continue;
+        /* a node that failed is connected again once it owes nothing */
+        if (c->redis->err && c->seq_count == 0 && redis_connOpen(x, c)) {
+            if (c->redis->err) {
+                post("puredis: could not connect to cluster node %s:%d: %s", c->host, c->port, c->redis->errstr);
+            } else {
+                post("Puredis %i.%i.%i connected to redis cluster node host: %s port: %u", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH, c->host, c->port);
+            }
+        }
+        return i;
+    }
+    if ((conns = realloc(x->conns, (x->nconns + 1) * sizeof(t_redis_conn))) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return -1;
+    }
+    x->conns = conns;
+    c = &x->conns[x->nconns];
+    memset(c, 0, sizeof(t_redis_conn));
+    c->host = gensym(host)->s_name;
+    c->port = port;
+    c->poll_fd = -1;
+    if (!redis_connOpen(x, c)) {
+        post("puredis: can not proceed!!  Memory Error!"); return -1;
+    }
+    if (c->redis->err) {
+        post("puredis: could not connect to cluster node %s:%d: %s", c->host, c->port, c->redis->errstr);
+    } else {
+        post("Puredis %i.%i.%i connected to redis cluster node host: %s port: %u", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH, c->host, c->port);
+    }
+    return x->nconns++;
+}
+
+/* CRC16-CCITT (XMODEM), the redis cluster key hash */
+static uint16_t redis_crc16(const char * s, size_t len)
+{
+    uint16_t crc = 0;
+    size_t i;
+    int j;
+    for (i = 0; i < len; i++) {
+        crc ^= (uint16_t)((unsigned char)s[i]) << 8;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* cluster hash slot of a key, hash tags included */
+static int redis_keySlot(const char * key, size_t len)
+{
+    redis_hashTag(&key, &len);
+    return redis_crc16(key, len) & (CLUSTER_SLOTS - 1);
+}
+
+/* asks a node for the slot map, CLUSTER SLOTS is queued on its connection
+ * like any command and its reply read by redis_clusterSlots, at most once
+ * per CLUSTER_REFRESH ms */
+static void redis_clusterRefresh(t_redis *x)
+{
+    int i;
+    
+    if (x->slots_pending) return;
+    if (x->slots_time > 0 && clock_gettimesince(x->slots_time) < CLUSTER_REFRESH) {
+        clock_delay(x->cluster_clock, CLUSTER_REFRESH - clock_gettimesince(x->slots_time));
+        return;
+    }
+    x->slots_time = clock_getlogicaltime();
+    for (i = 0; i < x->nconns; i++) {
+        t_redis_conn * c = &x->conns[i];
+        if (c->redis->err || !redis_seqPush(c, SEQ_SLOTS)) continue;
+        redis_appendRaw(c->redis, "*2\r\n$7\r\nCLUSTER\r\n$5\r\nSLOTS\r\n", 28);
+        x->slots_pending = 1;
+        redis_flush(x);
+        return;
+    }
+    x->slots_stale = 0;
+    post("puredis: could not read the cluster slot map");
+}
+
+/* takes the CLUSTER SLOTS reply, a failed refresh is tried again on the
+ * next MOVED */
+static void redis_clusterSlots(t_redis *x)
+{
+    redisReply * reply = x->slots_reply;
+    size_t j;
+    
+    x->slots_reply = NULL;
+    x->slots_pending = 0;
+    x->slots_stale = 0;
+    if (reply->type != REDIS_REPLY_ARRAY) {
+        post("puredis: CLUSTER SLOTS: %s", reply->type == REDIS_REPLY_ERROR ? reply->str : "bad reply");
+        post("puredis: could not read the cluster slot map");
+        freeReplyObject(reply);
+        return;
+    }
+    /* [[start, end, [host, port, id], replicas...], ...] */
+    for (j = 0; j < reply->elements; j++) {
+        redisReply * range = reply->element[j];
+        redisReply * master;
+        int k, conn;
+        if (range->type != REDIS_REPLY_ARRAY || range->elements < 3) continue;
+        master = range->element[2];
+        if (master->type != REDIS_REPLY_ARRAY || master->elements < 2 ||
+            master->element[0]->type != REDIS_REPLY_STRING) continue;
+        conn = redis_clusterConn(x, master->element[0]->str, (int)master->element[1]->integer);
+        if (conn < 0) continue;
+        for (k = (int)range->element[0]->integer; k <= (int)range->element[1]->integer && k < CLUSTER_SLOTS; k++) {
+            if (k >= 0) x->slot_conn[k] = conn;
+        }
+    }
+    freeReplyObject(reply);
+}
+
+/* takes a MOVED/ASK error reply for a command with a kept copy, the
+ * command is sent again by redis_clusterFollow */
+static int redis_clusterRedirect(t_redis *x, unsigned long seq, redisReply * reply)
+{
+    t_redis_entry * e = &x->pend[(x->pend_head + (seq - x->pend_seq)) % x->pend_size];
+    t_redis_redirect * r;
+    int ask;
+    const char * p;
+    char * colon;
+    
+    if (reply->type != REDIS_REPLY_ERROR || e->cmd == NULL || e->redirects >= CLUSTER_REDIRECTS) return 0;
+    if (strncmp(reply->str, "MOVED ", 6) == 0) ask = 0;
+    else if (strncmp(reply->str, "ASK ", 4) == 0) ask = 1;
+    else return 0;
+    
+    if (x->nredirects == x->redirects_size) {
+        int size = x->redirects_size ? x->redirects_size * 2 : 16;
+        t_redis_redirect * redirects = realloc(x->redirects, size * sizeof(t_redis_redirect));
+        if (redirects == NULL) return 0;
+        x->redirects = redirects;
+        x->redirects_size = size;
+    }
+    /* MOVED <slot> <host>:<port> */
+    r = &x->redirects[x->nredirects];
+    p = strchr(reply->str, ' ') + 1;
+    r->slot = atoi(p);
+    if (r->slot < 0 || r->slot >= CLUSTER_SLOTS || (p = strchr(p, ' ')) == NULL) return 0;
+    strncpy(r->host, p + 1, sizeof(r->host) - 1);
+    r->host[sizeof(r->host) - 1] = '\0';
+    if ((colon = strrchr(r->host, ':')) == NULL) return 0;
+    *colon = '\0';
+    r->port = atoi(colon + 1);
+    r->ask = ask;
+    r->seq = seq;
+    x->nredirects++;
+    e->redirects++;
+    freeReplyObject(reply);
+    return 1;
+}
+
+/* sends redirected commands to their new node, MOVED also updates the slot
+ * map and schedules a full refresh, ASK goes once through ASKING, a slot
+ * map read meanwhile is taken first */
+static int redis_clusterFollow(t_redis *x)
+{
+    int i, n = x->nredirects;
+    
+    if (x->slots_reply) redis_clusterSlots(x);
+    for (i = 0; i < n; i++) {
+        t_redis_redirect * r = &x->redirects[i];
+        t_redis_entry * e = &x->pend[(x->pend_head + (r->seq - x->pend_seq)) % x->pend_size];
+        int conn = redis_clusterConn(x, r->host, r->port);
+        t_redis_conn * c;
+        
+        if (conn < 0) {
+            redis_shardReplyAt(x, r->seq, redis_errorReply("cluster redirect failed"));
+            continue;
+        }
+        c = &x->conns[conn];
+        if (!r->ask) {
+            x->slot_conn[r->slot] = conn;
+            if (!x->slots_stale) {
+                x->slots_stale = 1;
+                clock_delay(x->cluster_clock, 0);
+            }
+        }
+        if (c->redis->err) {
+            redis_shardReplyAt(x, r->seq, redis_errorReply(c->redis->errstr));
+            continue;
+        }
+        if (r->ask) {
+            if (!redis_seqPush(c, SEQ_DISCARD)) {
+                redis_shardReplyAt(x, r->seq, redis_errorReply("out of memory"));
+                continue;
+            }
+            redis_appendRaw(c->redis, "*1\r\n$6\r\nASKING\r\n", 16);
+        }
+        if (!redis_seqPush(c, r->seq)) {
+            redis_shardReplyAt(x, r->seq, redis_errorReply("out of memory"));
+            continue;
+        }
+        redis_appendRaw(c->redis, e->cmd, e->cmdlen);
+    }
+    x->nredirects = 0;
+    return n;
+}
+
+/* appends a command already in protocol form to the hiredis output buffer */
+static void redis_appendRaw(redisContext * c, const char * cmd, size_t len)
+{
+    sds obuf = sdscatlen(c->obuf, cmd, len);
+    if (obuf) c->obuf = obuf;
+}
+
+/* redisBufferRead adding what it fed the reader to *bytes, the reader
+ * buffer only drops parsed data while parsing */
+static int redis_bufferRead(redisContext * c, double * bytes)
+{
+    size_t len = c->reader->len;
+    int status = redisBufferRead(c);
+    if (c->reader->len > len) *bytes += c->reader->len - len;
+    return status;
+}
+
+/* redisBufferWrite adding what left the output buffer to *bytes */
+static int redis_bufferWrite(redisContext * c, int * done, double * bytes)
+{
+    size_t len = c->obuf ? sdslen(c->obuf) : 0;
+    int status = redisBufferWrite(c, done);
+    size_t left = c->obuf ? sdslen(c->obuf) : 0;
+    if (left < len) *bytes += len - left;
+    return status;
+}
+
+/* redisGetReply through the counting reads and writes, safe to call from
+ * the io thread with its own counters */
+static int redis_getReply(redisContext * c, void ** reply, double * written, double * read)
+{
+    int wdone = 0;
+    
+    if (redisGetReplyFromReader(c, reply) == REDIS_ERR) return REDIS_ERR;
+    if (*reply != NULL || !(c->flags & REDIS_BLOCK)) return REDIS_OK;
+    do {
+        if (redis_bufferWrite(c, &wdone, written) == REDIS_ERR) return REDIS_ERR;
+    } while (!wdone);
+    do {
+        if (redis_bufferRead(c, read) == REDIS_ERR) return REDIS_ERR;
+        if (redisGetReplyFromReader(c, reply) == REDIS_ERR) return REDIS_ERR;
+    } while (*reply == NULL);
+    return REDIS_OK;
+}
+
+/* redisCommandArgv on the object connection, counted in its stats */
+static redisReply * redis_commandSync(t_redis *x, int argc, const char ** vector, const size_t * lengths)
+{
+    void * reply = NULL;
+    if (redisAppendCommandArgv(x->redis, argc, vector, lengths) != REDIS_OK) return NULL;
+    if (redis_getReply(x->redis, &reply, &x->stat_written, &x->stat_read) == REDIS_ERR) return NULL;
+    return (redisReply*)reply;
+}
+
+/* shared connections: a registry of refcounted connections keyed by
+ * host:port:db, every command queues its object so the multiplexed
+ * pipeline hands each reply back to its sender */
+static t_redis_shared * redis_shareds = NULL;
+
+/* finds or registers a shared connection, nothing is opened yet */
+static t_redis_shared * redis_sharedGet(const char * host, int port, int db)
+{
+    char key[MAXPDSTRING];
+    t_symbol * sym;
+    t_redis_shared * s;
+    
+    snprintf(key, MAXPDSTRING, "%s:%d:%d", host, port, db);
+    sym = gensym(key);
+    for (s = redis_shareds; s; s = s->next) {
+        if (s->key == sym) {
+            s->refs++;
+            return s;
+        }
+    }
+    if ((s = calloc(1, sizeof(t_redis_shared))) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return NULL;
+    }
+    s->key = sym;
+    s->host = gensym(host)->s_name;
+    s->port = port;
+    s->db = db;
+    s->refs = 1;
+    s->poll_fd = -1;
+    s->clock = clock_new(s, (t_method)redis_sharedFlush);
+    s->next = redis_shareds;
+    redis_shareds = s;
+    return s;
+}
+
+/* an object leaves its shared connection, the last one closes it */
+static void redis_sharedRelease(t_redis *x)
+{
+    t_redis_shared * s = x->shared;
+    t_redis_shared ** p;
+    int i;
+    
+    /* replies still owed to this object are dropped */
+    for (i = 0; i < s->owners_count; i++) {
+        t_redis_owner * o = &s->owners[(s->owners_head + i) % s->owners_size];
+        if (o->owner == x) o->owner = NULL;
+    }
+    x->shared = NULL;
+    if (--s->refs > 0) return;
+    
+    for (p = &redis_shareds; *p != s; p = &(*p)->next);
+    *p = s->next;
+    if (s->poll_fd >= 0) sys_rmpollfn(s->poll_fd);
+    if (s->redis) redisFree(s->redis);
+    clock_free(s->clock);
+    free(s->owners);
+    free(s);
+}
+
+/* opens the connection without blocking on first use, SELECT goes first */
+static int redis_sharedOpen(t_redis_shared * s)
+{
+    if (s->redis) return 1;
+    if ((s->redis = redisConnectNonBlock(s->host, s->port)) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    if (s->redis->err) {
+        post("puredis: could not connect to redis host: %s port: %u: %s", s->host, s->port, s->redis->errstr);
+        redisFree(s->redis);
+        s->redis = NULL;
+        return 0;
+    }
+    post("Puredis %i.%i.%i shares redis host: %s port: %u db: %d", PUREDIS_MAJOR, PUREDIS_MINOR, PUREDIS_PATCH, s->host, s->port, s->db);
+    s->connecting = 1;
+    s->started = clock_getlogicaltime();
+    s->poll_fd = s->redis->fd;
+    sys_addpollfn(s->poll_fd, (t_fdpollfn)redis_sharedPollread, s);
+    if (s->db != 0) {
+        redisAppendCommand(s->redis, "SELECT %d", s->db);
+        redis_sharedPush(s, NULL, 0);
+    }
+    return 1;
+}
+
+/* queues the object owed the next reply */
+static int redis_sharedPush(t_redis_shared * s, t_redis * owner, unsigned long seq)
+{
+    t_redis_owner * o;
+    if (s->owners_count == s->owners_size) {
+        int i, size = s->owners_size ? s->owners_size * 2 : 64;
+        t_redis_owner * owners = malloc(size * sizeof(t_redis_owner));
+        if (owners == NULL) {
+            post("puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        for (i = 0; i < s->owners_count; i++) {
+            owners[i] = s->owners[(s->owners_head + i) % s->owners_size];
+        }
+        free(s->owners);
+        s->owners = owners;
+        s->owners_size = size;
+        s->owners_head = 0;
+    }
+    o = &s->owners[(s->owners_head + s->owners_count) % s->owners_size];
+    o->owner = owner;
+    o->seq = seq;
+    s->owners_count++;
+    return 1;
+}
+
+/* appends a command to the shared pipeline, puredis waits for its reply */
+static void redis_sharedSend(t_redis *x, int argc, const char ** vector, const size_t * lengths, int kind, t_symbol * array)
+{
+    t_redis_shared * s = x->shared;
+    unsigned long seq;
+    
+    if (!x->async && x->chunk_reply && !x->out_busy) redis_chunkFlush(x);
+    if (!redis_sharedOpen(s)) {
+        outlet_symbol(x->x_obj.ob_outlet, gensym("error"));
+        return;
+    }
+    if (!redis_pendPush(x, kind, array)) return;
+    seq = x->pend_seq + x->pend_count - 1;
+    if (!redis_sharedPush(s, x, seq)) {
+        redis_shardReplyAt(x, seq, redis_errorReply("out of memory"));
+        redis_sharedNotify(x);
+    } else {
+        /* the socket is shared, bytes are credited as appended and parsed */
+        size_t len = sdslen(s->redis->obuf);
+        redisAppendCommandArgv(s->redis, argc, vector, lengths);
+        if (s->redis->obuf && sdslen(s->redis->obuf) > len) x->stat_written += sdslen(s->redis->obuf) - len;
+    }
+    
+    if (x->async) {
+        x->async_num++;
+        apuredis_q_out(x);
+        clock_delay(s->clock, 0);
+    } else {
+        redis_sharedWait(s, x);
+        redis_shardOutput(x);
+    }
+}
+
+/* puredis: writes and reads the shared socket until its reply is in,
+ * replies for other objects are kept for their next tick */
+static void redis_sharedWait(t_redis_shared * s, t_redis *x)
+{
+    while (s->redis && x->pend_count > 0 && x->pend[x->pend_head].slots > 0) {
+        fd_set rfds, wfds;
+        struct timeval timeout = { CONNECT_TIMEOUT / 1000, (CONNECT_TIMEOUT % 1000) * 1000 };
+        int fd = s->redis->fd, n, wdone = 1;
+        
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(fd, &rfds);
+        if (sdslen(s->redis->obuf) > 0) FD_SET(fd, &wfds);
+        /* a command may block as long as it likes, connecting may not */
+        n = select(fd + 1, &rfds, &wfds, NULL, s->connecting ? &timeout : NULL);
+        if (n == 0) {
+            redis_sharedError(s, "connection timeout");
+        } else if (n > 0 && FD_ISSET(fd, &wfds)) {
+            if (redisBufferWrite(s->redis, &wdone) == REDIS_ERR) {
+                redis_sharedError(s, s->redis->errstr);
+            } else if (wdone) {
+                s->connecting = 0;
+            }
+        }
+        if (n > 0 && s->redis && FD_ISSET(fd, &rfds)) redis_sharedRead(s);
+    }
+}
+
+/* clock: writes what the socket takes, a connection attempt times out */
+static void redis_sharedFlush(t_redis_shared * s)
+{
+    int wdone = 1;
+    if (s->redis == NULL) return;
+    if (redisBufferWrite(s->redis, &wdone) == REDIS_ERR) {
+        redis_sharedError(s, s->redis->errstr);
+    } else if (!wdone) {
+        if (s->connecting && clock_gettimesince(s->started) >= CONNECT_TIMEOUT) {
+            redis_sharedError(s, "connection timeout");
+        } else {
+            clock_delay(s->clock, 1);
+        }
+    } else {
+        s->connecting = 0;
+    }
+}
+
+/* reads the shared socket and hands every reply to its object */
+static void redis_sharedRead(t_redis_shared * s)
+{
+    void * reply = NULL;
+    
+    if (redisBufferRead(s->redis) == REDIS_ERR) {
+        redis_sharedError(s, s->redis->errstr);
+        return;
+    }
+    s->connecting = 0;
+    while (s->owners_count > 0) {
+        t_redis_owner o;
+        size_t unread = s->redis->reader->len - s->redis->reader->pos;
+        if (redisGetReplyFromReader(s->redis, &reply) == REDIS_ERR) {
+            redis_sharedError(s, s->redis->errstr);
+            return;
+        }
+        if (reply == NULL) break;
+        o = s->owners[s->owners_head];
+        if (o.owner) o.owner->stat_read += unread - (s->redis->reader->len - s->redis->reader->pos);
+        s->owners_head = (s->owners_head + 1) % s->owners_size;
+        s->owners_count--;
+        if (o.owner == NULL) {
+            if (((redisReply*)reply)->type == REDIS_REPLY_ERROR) post("puredis: %s", ((redisReply*)reply)->str);
+            freeReplyObject(reply);
+            continue;
+        }
+        redis_shardReplyAt(o.owner, o.seq, (redisReply*)reply);
+        redis_sharedNotify(o.owner);
+    }
+}
+
+/* shared socket readable callback */
+static void redis_sharedPollread(t_redis_shared * s, int fd)
+{
+    (void)fd;
+    redis_sharedRead(s);
+}
+
+/* apuredis outputs its replies on its next tick */
+static void redis_sharedNotify(t_redis * owner)
+{
+    if (owner->async && owner->async_run) clock_delay(owner->async_clock, 0);
+}
+
+/* a broken shared connection fails every reply it owes and is opened
+ * again by the next command */
+static void redis_sharedError(t_redis_shared * s, const char * reason)
+{
+    char errstr[128];
+    
+    snprintf(errstr, sizeof(errstr), "%s", reason[0] ? reason : "connection lost");
+    post("puredis: shared redis connection %s error: %s", s->key->s_name, errstr);
+    if (s->poll_fd >= 0) {
+        sys_rmpollfn(s->poll_fd);
+        s->poll_fd = -1;
+    }
+    clock_unset(s->clock);
+    redisFree(s->redis);
+    s->redis = NULL;
+    while (s->owners_count > 0) {
+        t_redis_owner o = s->owners[s->owners_head];
+        s->owners_head = (s->owners_head + 1) % s->owners_size;
+        s->owners_count--;
+        if (o.owner == NULL) continue;
+        redis_shardReplyAt(o.owner, o.seq, redis_errorReply(errstr));
+        redis_sharedNotify(o.owner);
+    }
+}
+
+/* puredis */
+
+/* puredis setup method */
+static void setup_puredis(void)
+{
+    puredis_class = class_new(gensym("puredis"),
+        (t_newmethod)redis_new,
+        (t_method)redis_free,
+        sizeof(t_redis),
+        CLASS_DEFAULT,
+        A_GIMME, 0);
+    
+    class_addmethod(puredis_class,
+        (t_method)redis_command, gensym("command"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)puredis_csv, gensym("csv"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)puredis_csvopt, gensym("csvopt"),
+        A_SYMBOL, A_FLOAT, 0);
+    class_addmethod(puredis_class,
+        (t_method)puredis_csvdump, gensym("csvdump"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)puredis_thread, gensym("thread"),
+        A_FLOAT, A_DEFFLOAT, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_chunk, gensym("chunk"),
+        A_FLOAT, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_decode, gensym("decode"),
+        A_SYMBOL, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_symbols, gensym("symbols"), A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_stats, gensym("stats"), 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_toarray, gensym("toarray"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_fromarray, gensym("fromarray"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_timeout, gensym("timeout"),
+        A_FLOAT, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_replay, gensym("replay"),
+        A_FLOAT, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_batch, gensym("batch"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)redis_script, gensym("script"),
+        A_GIMME, 0);
+    class_addmethod(puredis_class,
+        (t_method)puredis_cache, gensym("cache"),
+        A_GIMME, 0);
+    class_sethelpsymbol(puredis_class, gensym("puredis-help"));
+}
+
+/* hands a command to the io thread, the reply is output by puredis_thread_run */
+static int puredis_postCommandThread(t_redis * x, int argc, const char ** vector, const size_t * lengths)
+{
+    int i;
+    size_t size = sizeof(t_redis_job) + argc * (sizeof(char*) + sizeof(size_t));
+    char * data;
+    t_redis_job * job;
+    
+    for (i = 0; i < argc; i++) size += lengths[i] + 1;
+    if ((job = malloc(size)) == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    job->argc = argc;
+    job->lengths = (size_t*)(job + 1);
+    job->argv = (const char**)(job->lengths + argc);
+    job->reply = NULL;
+    job->written = job->read = 0;
+    job->errstr[0] = '\0';
+    data = (char*)(job->argv + argc);
+    for (i = 0; i < argc; i++) {
+        memcpy(data, vector[i], lengths[i]);
+        data[lengths[i]] = '\0';
+        job->argv[i] = data;
+        job->lengths[i] = lengths[i];
+        data += lengths[i] + 1;
+    }
+    
+    if (!ring_push(&x->thread_cmds, job)) {
+        free(job);
+        post("puredis: io thread queue full, command dropped");
+        return 0;
+    }
+    pthread_mutex_lock(&x->thread_mutex);
+    pthread_cond_signal(&x->thread_cond);
+    pthread_mutex_unlock(&x->thread_mutex);
+    
+    x->async_num++;
+    if (x->async_num == 1) clock_delay(x->async_clock, 1);
+    return 1;
+}
+
+/* io thread: pipelines every queued command on its own connection and
+ * returns the jobs with their replies in order, never touching pd */
+static void * puredis_thread_main(void * data)
+{
+    t_redis * x = (t_redis*)data;
+    redisContext * redis = NULL;
+    t_redis_job * batch[64];
+    struct timeval timeout = { 1, 0 };
+    struct timespec pause = { 0, 1000000 };
+    
+    while (1) {
+        int i, n = 0;
+        
+        batch[0] = NULL;
+        pthread_mutex_lock(&x->thread_mutex);
+        while (!x->thread_stop && (batch[0] = ring_pop(&x->thread_cmds)) == NULL)
+            pthread_cond_wait(&x->thread_cond, &x->thread_mutex);
+        pthread_mutex_unlock(&x->thread_mutex);
+        if (x->thread_stop) {
+            free(batch[0]);
+            break;
+        }
+        
+        n = 1;
+        while (n < 64 && (batch[n] = ring_pop(&x->thread_cmds)) != NULL) n++;
+        
+        if (redis == NULL || redis->err) {
+            if (redis) redisFree(redis);
+            redis = redisConnectWithTimeout(x->r_host, x->r_port, timeout);
+        }
+        for (i = 0; redis && i < n; i++) {
+            redisAppendCommandArgv(redis, batch[i]->argc, batch[i]->argv, batch[i]->lengths);
+        }
+        for (i = 0; i < n; i++) {
+            void * reply = NULL;
+            if (redis == NULL) {
+                strcpy(batch[i]->errstr, "out of memory");
+            } else if (redis->err || redis_getReply(redis, &reply, &batch[i]->written, &batch[i]->read) == REDIS_ERR) {
+                strncpy(batch[i]->errstr, redis->errstr, sizeof(batch[i]->errstr) - 1);
+                batch[i]->errstr[sizeof(batch[i]->errstr) - 1] = '\0';
+            }
+            batch[i]->reply = (redisReply*)reply;
+            while (!ring_push(&x->thread_replies, batch[i])) nanosleep(&pause, NULL);
+        }
+    }
+    if (redis) redisFree(redis);
+    return NULL;
+}
+
+/* outputs every reply returned by the io thread, in command order */
+static void puredis_thread_run(t_redis *x)
+{
+    t_redis_job * job;
+    while (x->async_num > 0 && x->chunk_reply == NULL &&
+           (job = ring_pop(&x->thread_replies)) != NULL) {
+        x->async_num--;
+        x->stat_written += job->written;
+        x->stat_read += job->read;
+        if (job->reply) {
+            redis_dispatchReply(x, job->reply);
+        } else {
+            redis_pendPop(x, NULL);
+            post("puredis: io thread redis error: %s", job->errstr);
+            outlet_symbol(x->x_obj.ob_outlet, gensym("error"));
+        }
+        free(job);
+    }
+    if (x->async_num > 0 && x->chunk_reply == NULL) clock_delay(x->async_clock, 1);
+}
+
+/* joins the io thread, outstanding replies are dropped */
+static void puredis_thread_stop(t_redis *x)
+{
+    t_redis_job * job;
+    pthread_mutex_lock(&x->thread_mutex);
+    x->thread_stop = 1;
+    pthread_cond_signal(&x->thread_cond);
+    pthread_mutex_unlock(&x->thread_mutex);
+    pthread_join(x->thread, NULL);
+    
+    while ((job = ring_pop(&x->thread_cmds)) != NULL) free(job);
+    while ((job = ring_pop(&x->thread_replies)) != NULL) {
+        if (job->reply) freeReplyObject(job->reply);
+        free(job);
+    }
+    ring_free(&x->thread_cmds);
+    ring_free(&x->thread_replies);
+    pthread_cond_destroy(&x->thread_cond);
+    pthread_mutex_destroy(&x->thread_mutex);
+    clock_unset(x->async_clock);
+    x->async_num = 0;
+    x->pend_count = 0;
+    x->thread_on = 0;
+}
+
+/* puredis thread message method: 1 moves commands to an io thread, 0 back to blocking calls */
+void puredis_thread(t_redis *x, t_floatarg on, t_floatarg size)
+{
+    if (on == 0) {
+        if (x->thread_on) {
+            puredis_thread_run(x);
+            puredis_thread_stop(x);
+        }
+        return;
+    }
+    if (x->thread_on) return;
+    if (x->nconns || x->shared) {
+        post("puredis: thread mode is not available with shards or shared connections"); return;
+    }
+    if (x->cache_max) {
+        post("puredis: thread mode is not available with the cache on"); return;
+    }
+    
+    if (!ring_init(&x->thread_cmds, size > 0 ? (unsigned int)size : THREAD_RING_SIZE) ||
+        !ring_init(&x->thread_replies, size > 0 ? (unsigned int)size : THREAD_RING_SIZE)) {
+        ring_free(&x->thread_cmds);
+        post("puredis: can not proceed!!  Memory Error!"); return;
+    }
+    if (x->async_clock == NULL) x->async_clock = clock_new(x, (t_method)puredis_thread_run);
+    pthread_mutex_init(&x->thread_mutex, NULL);
+    pthread_cond_init(&x->thread_cond, NULL);
+    x->thread_stop = 0;
+    x->async_num = 0;
+    if (pthread_create(&x->thread, NULL, puredis_thread_main, x) != 0) {
+        ring_free(&x->thread_cmds);
+        ring_free(&x->thread_replies);
+        pthread_cond_destroy(&x->thread_cond);
+        pthread_mutex_destroy(&x->thread_mutex);
+        post("puredis: could not start io thread");
+        return;
+    }
+    x->thread_on = 1;
+}
+
+/* client cache: cache <n> keeps up to n GET/HGET replies in the object,
+ * the server tracks the keys read (CLIENT TRACKING) and sends their
+ * invalidations to a second connection subscribed to __redis__:invalidate,
+ * hits never touch the network */
+void puredis_cache(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    if (argc > 0 && argv[0].a_type == A_FLOAT) {
+        int max = (int)atom_getfloat(argv);
+        if (x->cache_max) puredis_cacheOff(x);
+        if (max > 0) puredis_cacheOn(x, max);
+    } else if (argc > 0 && atom_getsymbol(argv) == gensym("clear")) {
+        if (x->cache_max) puredis_cacheClear(x);
+    } else {
+        t_atom stats[10];
+        SETSYMBOL(&stats[0], gensym("hits")); SETFLOAT(&stats[1], x->cache_hits);
+        SETSYMBOL(&stats[2], gensym("misses")); SETFLOAT(&stats[3], x->cache_misses);
+        SETSYMBOL(&stats[4], gensym("evictions")); SETFLOAT(&stats[5], x->cache_evictions);
+        SETSYMBOL(&stats[6], gensym("invalidations")); SETFLOAT(&stats[7], x->cache_invalidations);
+        SETSYMBOL(&stats[8], gensym("entries")); SETFLOAT(&stats[9], x->cache_count);
+        outlet_anything(x->x_obj.ob_outlet, gensym("cache"), 10, stats);
+    }
+}
+
+/* allocates the cache and opens the invalidation connection */
+static int puredis_cacheOn(t_redis *x, int max)
+{
+    struct timeval timeout = { x->conn_timeout / 1000, (x->conn_timeout % 1000) * 1000 };
+    int buckets = 16;
+    redisReply * reply;
+    
+    if (x->nconns || x->shared || x->thread_on) {
+        post("puredis: the cache is not available with shards, shared connections or thread mode"); return 0;
+    }
+    while (buckets < max * 2) buckets <<= 1;
+    x->cached = calloc(max, sizeof(t_redis_cached));
+    x->cache_buckets = malloc(buckets * sizeof(int));
+    if (x->cached == NULL || x->cache_buckets == NULL) {
+        free(x->cached); free(x->cache_buckets);
+        x->cached = NULL; x->cache_buckets = NULL;
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    x->cache_max = max;
+    x->cache_mask = buckets - 1;
+    x->cache_multi = 0;
+    x->cache_hits = x->cache_misses = x->cache_evictions = x->cache_invalidations = 0;
+    x->cache_fd = -1;
+    puredis_cacheClear(x);
+    
+    /* CLIENT ID then SUBSCRIBE, RESP2 redirect mode */
+    x->cache_redis = redisConnectWithTimeout(x->r_host, x->r_port, timeout);
+    if (x->cache_redis == NULL || x->cache_redis->err) {
+        post("puredis: cache invalidation connection failed: %s", x->cache_redis ? x->cache_redis->errstr : "out of memory");
+        puredis_cacheOff(x);
+        return 0;
+    }
+    reply = redisCommand(x->cache_redis, "CLIENT ID");
+    if (reply == NULL || reply->type != REDIS_REPLY_INTEGER) {
+        post("puredis: the cache needs CLIENT TRACKING, redis 6 or newer");
+        if (reply) freeReplyObject(reply);
+        puredis_cacheOff(x);
+        return 0;
+    }
+    x->cache_id = reply->integer;
+    freeReplyObject(reply);
+    reply = redisCommand(x->cache_redis, "SUBSCRIBE __redis__:invalidate");
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY) {
+        post("puredis: cache invalidation subscription failed");
+        if (reply) freeReplyObject(reply);
+        puredis_cacheOff(x);
+        return 0;
+    }
+    freeReplyObject(reply);
+    x->cache_fd = x->cache_redis->fd;
+    sys_addpollfn(x->cache_fd, (t_fdpollfn)puredis_cachePollread, x);
+    if (x->conn_state == CONN_UP) puredis_cacheTrack(x);
+    return 1;
+}
+
+/* drops the cache, tracking and the invalidation connection */
+static void puredis_cacheOff(t_redis *x)
+{
+    if (x->cache_redis && x->redis && x->conn_state == CONN_UP && !x->redis->err) {
+        redisReply * reply = redisCommand(x->redis, "CLIENT TRACKING off");
+        if (reply) freeReplyObject(reply);
+    }
+    if (x->cached) puredis_cacheClear(x);
+    if (x->cache_fd >= 0) sys_rmpollfn(x->cache_fd);
+    if (x->cache_redis) redisFree(x->cache_redis);
+    free(x->cached);
+    free(x->cache_buckets);
+    x->cached = NULL;
+    x->cache_buckets = NULL;
+    x->cache_redis = NULL;
+    x->cache_fd = -1;
+    x->cache_max = 0;
+}
+
+/* turns tracking on for the main connection, invalidations go to the
+ * subscribed one named by its CLIENT ID */
+static void puredis_cacheTrack(t_redis *x)
+{
+    redisReply * reply;
+    
+    if (x->cache_redis == NULL) return;
+    puredis_cacheClear(x);
+    reply = redisCommand(x->redis, "CLIENT TRACKING on REDIRECT %lld", x->cache_id);
+    if (reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+        post("puredis: client tracking failed: %s", reply ? reply->str : x->redis->errstr);
+        if (reply) freeReplyObject(reply);
+        puredis_cacheOff(x);
+        return;
+    }
+    freeReplyObject(reply);
+}
+
+/* empties the cache, every slot back on the free list */
+static void puredis_cacheClear(t_redis *x)
+{
+    int i;
+    for (i = 0; i < x->cache_max; i++) {
+        free(x->cached[i].key);
+        x->cached[i].key = NULL;
+        x->cached[i].next = i + 1 < x->cache_max ? i + 1 : -1;
+    }
+    for (i = 0; i <= x->cache_mask; i++) x->cache_buckets[i] = -1;
+    x->cache_free = 0;
+    x->cache_count = 0;
+    x->cache_newest = -1;
+    x->cache_oldest = -1;
+}
+
+/* FNV-1a of the key, fields of a hash share their key's bucket */
+static uint32_t puredis_cacheHash(const char * key, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++) hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+    return hash;
+}
+
+static int puredis_cacheFind(t_redis *x, int hget, const char * key, size_t keylen, const char * field, size_t fieldlen, uint32_t hash)
+{
+    int i;
+    for (i = x->cache_buckets[hash & x->cache_mask]; i >= 0; i = x->cached[i].next) {
+        t_redis_cached * c = &x->cached[i];
+        if (c->hash == hash && c->hget == hget && c->keylen == keylen && c->fieldlen == fieldlen &&
+            memcmp(c->key, key, keylen) == 0 && (!hget || memcmp(c->key + keylen + 1, field, fieldlen) == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* takes an entry out of the least recently used order */
+static void puredis_cacheUnlink(t_redis *x, int i)
+{
+    t_redis_cached * c = &x->cached[i];
+    if (c->older >= 0) x->cached[c->older].newer = c->newer; else x->cache_oldest = c->newer;
+    if (c->newer >= 0) x->cached[c->newer].older = c->older; else x->cache_newest = c->older;
+}
+
+static void puredis_cacheLink(t_redis *x, int i)
+{
+    t_redis_cached * c = &x->cached[i];
+    c->older = x->cache_newest;
+    c->newer = -1;
+    if (x->cache_newest >= 0) x->cached[x->cache_newest].newer = i; else x->cache_oldest = i;
+    x->cache_newest = i;
+}
+
+static void puredis_cacheRemove(t_redis *x, int i)
+{
+    t_redis_cached * c = &x->cached[i];
+    int * link = &x->cache_buckets[c->hash & x->cache_mask];
+    
+    while (*link != i) link = &x->cached[*link].next;
+    *link = c->next;
+    puredis_cacheUnlink(x, i);
+    free(c->key);
+    c->key = NULL;
+    c->next = x->cache_free;
+    x->cache_free = i;
+    x->cache_count--;
+}
+
+/* GET key or HGET key field, a hit is output here and skips the network */
+static int puredis_cacheGet(t_redis *x, int argc, const char ** vector, const size_t * lengths)
+{
+    int hget = argc == 3 && lengths[0] == 4 && strncasecmp(vector[0], "hget", 4) == 0;
+    int i;
+    t_atom value;
+    
+    if (!hget && !(argc == 2 && lengths[0] == 3 && strncasecmp(vector[0], "get", 3) == 0)) return 0;
+    i = puredis_cacheFind(x, hget, vector[1], lengths[1], hget ? vector[2] : NULL, hget ? lengths[2] : 0,
+        puredis_cacheHash(vector[1], lengths[1]));
+    if (i < 0) {
+        x->cache_misses++;
+        return 0;
+    }
+    x->cache_hits++;
+    puredis_cacheUnlink(x, i);
+    puredis_cacheLink(x, i);
+    if (x->cached[i].type == REDIS_REPLY_NIL) {
+        outlet_symbol(x->x_obj.ob_outlet, redis_gensym(x,"nil"));
+        return 1;
+    }
+    {
+        redisReply reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = REDIS_REPLY_STRING;
+        reply.str = x->cached[i].str;
+        reply.len = x->cached[i].len;
+        redis_decodeString(x, &reply, &value);
+    }
+    if (value.a_type == A_FLOAT) {
+        outlet_float(x->x_obj.ob_outlet, atom_getfloat(&value));
+    } else {
+        outlet_symbol(x->x_obj.ob_outlet, atom_getsymbol(&value));
+    }
+    return 1;
+}
+
+/* keeps a GET/HGET reply, any other keyed command drops its keys */
+static void puredis_cachePut(t_redis *x, int argc, const char ** vector, const size_t * lengths, redisReply * reply)
+{
+    int hget = argc == 3 && lengths[0] == 4 && strncasecmp(vector[0], "hget", 4) == 0;
+    size_t fieldlen = hget ? lengths[2] : 0;
+    t_redis_cached * c;
+    uint32_t hash;
+    int i;
+    
+    if (!hget && !(argc == 2 && lengths[0] == 3 && strncasecmp(vector[0], "get", 3) == 0)) {
+        puredis_cacheWrite(x, argc, vector, lengths);
+        return;
+    }
+    if (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL) return;
+    hash = puredis_cacheHash(vector[1], lengths[1]);
+    if (puredis_cacheFind(x, hget, vector[1], lengths[1], hget ? vector[2] : NULL, fieldlen, hash) >= 0) return;
+    if (x->cache_free < 0) {
+        puredis_cacheRemove(x, x->cache_oldest);
+        x->cache_evictions++;
+    }
+    i = x->cache_free;
+    c = &x->cached[i];
+    c->key = malloc(lengths[1] + fieldlen + (reply->type == REDIS_REPLY_STRING ? reply->len : 0) + 3);
+    if (c->key == NULL) return;
+    x->cache_free = c->next;
+    memcpy(c->key, vector[1], lengths[1]);
+    c->key[lengths[1]] = '\0';
+    if (hget) memcpy(c->key + lengths[1] + 1, vector[2], fieldlen);
+    c->key[lengths[1] + 1 + fieldlen] = '\0';
+    c->str = c->key + lengths[1] + fieldlen + 2;
+    c->len = reply->type == REDIS_REPLY_STRING ? reply->len : 0;
+    if (c->len) memcpy(c->str, reply->str, c->len);
+    c->str[c->len] = '\0';
+    c->keylen = lengths[1];
+    c->fieldlen = fieldlen;
+    c->hget = hget;
+    c->type = reply->type;
+    c->hash = hash;
+    c->next = x->cache_buckets[hash & x->cache_mask];
+    x->cache_buckets[hash & x->cache_mask] = i;
+    puredis_cacheLink(x, i);
+    x->cache_count++;
+}
+
+/* drops the keys of a command that is not a cached read, everything on a
+ * flush or SELECT, and notes an open MULTI or WATCH: reads are then sent */
+static void puredis_cacheWrite(t_redis *x, int argc, const char ** vector, const size_t * lengths)
+{
+    if ((lengths[0] == 5 && strncasecmp(vector[0], "multi", 5) == 0) ||
+        (lengths[0] == 5 && strncasecmp(vector[0], "watch", 5) == 0)) {
+        x->cache_multi = 1;
+    } else if ((lengths[0] == 4 && strncasecmp(vector[0], "exec", 4) == 0) ||
+        (lengths[0] == 7 && strncasecmp(vector[0], "discard", 7) == 0) ||
+        (lengths[0] == 7 && strncasecmp(vector[0], "unwatch", 7) == 0)) {
+        x->cache_multi = 0;
+    }
+    if ((lengths[0] == 7 && strncasecmp(vector[0], "flushdb", 7) == 0) ||
+        (lengths[0] == 8 && strncasecmp(vector[0], "flushall", 8) == 0) ||
+        (lengths[0] == 6 && strncasecmp(vector[0], "select", 6) == 0)) {
+        puredis_cacheClear(x);
+    } else {
+        redis_eachKey(argc, vector, lengths, puredis_cacheKey, x);
+    }
+}
+
+/* key walk callback of puredis_cacheWrite */
+static int puredis_cacheKey(void * data, const char * key, size_t len)
+{
+    puredis_cacheInvalidate((t_redis*)data, key, len);
+    return 0;
+}
+
+/* drops every entry of a key, GET and all HGET fields */
+static void puredis_cacheInvalidate(t_redis *x, const char * key, size_t len)
+{
+    uint32_t hash = puredis_cacheHash(key, len);
+    int i = x->cache_buckets[hash & x->cache_mask];
+    
+    while (i >= 0) {
+        t_redis_cached * c = &x->cached[i];
+        int next = c->next;
+        if (c->hash == hash && c->keylen == len && memcmp(c->key, key, len) == 0) {
+            puredis_cacheRemove(x, i);
+            x->cache_invalidations++;
+        }
+        i = next;
+    }
+}
+
+/* reads invalidation messages, a nil payload means everything (flush) */
+static void puredis_cachePollread(t_redis *x, int fd)
+{
+    void * reply = NULL;
+    (void)fd;
+    
+    if (redisBufferRead(x->cache_redis) == REDIS_ERR) {
+        post("puredis: cache invalidation connection lost, cache off: %s", x->cache_redis->errstr);
+        puredis_cacheOff(x);
+        return;
+    }
+    while (redisGetReplyFromReader(x->cache_redis, &reply) == REDIS_OK && reply != NULL) {
+        redisReply * r = (redisReply*)reply;
+        if (r->type == REDIS_REPLY_ARRAY && r->elements == 3 && r->element[0]->type == REDIS_REPLY_STRING &&
+            strcmp(r->element[0]->str, "message") == 0) {
+            redisReply * keys = r->element[2];
+            size_t i;
+            if (keys->type == REDIS_REPLY_ARRAY) {
+                for (i = 0; i < keys->elements; i++) {
+                    if (keys->element[i]->type == REDIS_REPLY_STRING) {
+                        puredis_cacheInvalidate(x, keys->element[i]->str, keys->element[i]->len);
+                    }
+                }
+            } else {
+                x->cache_invalidations += x->cache_count;
+                puredis_cacheClear(x);
+            }
+        }
+        freeReplyObject(reply);
+    }
+}
+
+/* reports a csv load error, kept for the pd thread when loading from a worker */
+static void puredis_csv_error(t_redis_loader * l, const char * fmt, ...)
+{
+    char buf[MAXPDSTRING];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, MAXPDSTRING, fmt, ap);
+    va_end(ap);
+    if (l->lworker) {
+        l->lerrcount++;
+        strcpy(l->lerrstr, buf);
+    } else {
+        post("%s", buf);
+    }
+}
+
+/* makes the load counters visible to the pd thread */
+static void puredis_csv_publish(t_redis_loader * l)
+{
+    __atomic_store_n(&l->lpublines, l->lcount, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->lpubload, l->lnumload, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->lpuberror, l->lnumerror, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->lpubbytes, l->lbytes, __ATOMIC_RELAXED);
+}
+
+/* pipelines the command built from a csv row, replies are reaped
+ * once the in-flight window is full */
+static void puredis_csv_postCommand(t_redis_loader * l)
+{
+    int i;
+    for (i = 0; i < l->largc; i++) {
+        if (l->loffsets[i] != (size_t)-1) l->largv[i] = l->larena + l->loffsets[i];
+    }
+    redisAppendCommandArgv(l->redis, l->largc, l->largv, l->llengths);
+    l->lvalues[(l->lvhead + l->linflight) % l->lwindow] = l->lvals;
+    l->linflight++;
+    
+    /* keep command and key for the rest of a split row */
+    l->largc = 2;
+    l->larenapos = l->lkeyend;
+    l->lvals = 0;
+    
+    if (l->linflight >= l->lwindow) puredis_csv_reap(l);
+}
+
+/* reads the replies of every in-flight csv command and counts the values they carried */
+static void puredis_csv_reap(t_redis_loader * l)
+{
+    while (l->linflight > 0) {
+        void * tmpreply = NULL;
+        int values = l->lvalues[l->lvhead];
+        if (redisGetReply(l->redis, &tmpreply) == REDIS_ERR) {
+            puredis_csv_error(l, "Puredis csv load Redis error: %s", l->redis->errstr);
+            while (l->linflight > 0) {
+                l->lnumerror += l->lvalues[l->lvhead];
+                l->lvhead = (l->lvhead + 1) % l->lwindow;
+                l->linflight--;
+            }
+            puredis_csv_publish(l);
+            return;
+        }
+        redisReply * reply = (redisReply*)tmpreply;
+        l->lvhead = (l->lvhead + 1) % l->lwindow;
+        l->linflight--;
+        if (reply->type == REDIS_REPLY_ERROR) {
+            l->lnumerror += values;
+            puredis_csv_error(l, "Puredis csv load Redis error: %s", reply->str);
+        } else {
+            l->lnumload += values;
+        }
+        freeReplyObject(reply);
+    }
+    puredis_csv_publish(l);
+}
+
+/* appends an argument to the command being built, copied into the arena
+ * unless the caller keeps it alive until the command is sent */
+static int puredis_csv_arg(t_redis_loader * l, const char * s, size_t i, int copy)
+{
+    if (l->largc == l->largsize) {
+        int size = l->largsize * 2;
+        const char ** argv = realloc(l->largv, size * sizeof(char*));
+        size_t * lengths = argv ? realloc(l->llengths, size * sizeof(size_t)) : NULL;
+        size_t * offsets = lengths ? realloc(l->loffsets, size * sizeof(size_t)) : NULL;
+        if (argv) l->largv = argv;
+        if (lengths) l->llengths = lengths;
+        if (offsets == NULL) {
+            puredis_csv_error(l, "puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        l->loffsets = offsets;
+        l->largsize = size;
+    }
+    if (copy) {
+        if (l->larenapos + i + 1 > l->larenasize) {
+            size_t size = l->larenasize * 2;
+            char * arena;
+            while (size < l->larenapos + i + 1) size *= 2;
+            if ((arena = realloc(l->larena, size)) == NULL) {
+                puredis_csv_error(l, "puredis: can not proceed!!  Memory Error!"); return 0;
+            }
+            l->larena = arena;
+            l->larenasize = size;
+        }
+        memcpy(l->larena + l->larenapos, s, i);
+        l->larena[l->larenapos + i] = '\0';
+        l->loffsets[l->largc] = l->larenapos;
+        l->larenapos += i + 1;
+    } else {
+        l->largv[l->largc] = s;
+        l->loffsets[l->largc] = (size_t)-1;
+    }
+    l->llengths[l->largc] = i;
+    l->largc++;
+    return 1;
+}
+
+/* adds a csv value to its row command: SET key value, RPUSH/SADD key values...,
+ * HMSET key field value..., ZADD key score member... */
+static void puredis_csv_parse(t_redis_loader * l, const char * s, size_t i, int copy)
+{
+    if (l->lkind == LOAD_STRING) {
+        if (!puredis_csv_arg(l, s, i, copy)) return;
+        l->lvals = 1;
+        puredis_csv_postCommand(l);
+    } else if (l->lkind == LOAD_HASH) {
+        if (l->hcount >= l->hargc) return;  /* no header for this column */
+        if (!puredis_csv_arg(l, l->hheaders[l->hcount], l->hlengths[l->hcount], 0)) return;
+        if (!puredis_csv_arg(l, s, i, copy)) return;
+        l->hcount++;
+        l->lvals++;
+        if (l->largc + 2 > l->largcap) puredis_csv_postCommand(l);
+    } else if (l->lkind == LOAD_ZSET) {
+        if (!puredis_csv_arg(l, s, i, copy)) return;
+        l->zcount = !l->zcount;
+        if (!l->zcount) {
+            l->lvals++;
+            if (l->largc + 2 > l->largcap) puredis_csv_postCommand(l);
+        }
+    } else {
+        if (!puredis_csv_arg(l, s, i, copy)) return;
+        l->lvals++;
+        if (l->largc + 1 > l->largcap) puredis_csv_postCommand(l);
+    }
+}
+
+/* sends what is left of the current row, a zset score without member is dropped */
+static void puredis_csv_endrow(t_redis_loader * l)
+{
+    if (l->zcount) {
+        l->largc--;
+        l->zcount = 0;
+    }
+    if (l->lvals > 0) puredis_csv_postCommand(l);
+}
+
+/* stores a hash field name from the csv header line */
+static void puredis_csv_header(t_redis_loader * l, const char * s, size_t i)
+{
+    if (l->hbufsize == l->hargc) {
+        int size = l->hbufsize * 2;
+        char ** headers = realloc(l->hheaders, size * sizeof(char*));
+        size_t * lengths = headers ? realloc(l->hlengths, size * sizeof(size_t)) : NULL;
+        if (headers) l->hheaders = headers;
+        if (lengths == NULL) {
+            puredis_csv_error(l, "puredis: can not proceed!!  Memory Error!"); return;
+        }
+        l->hlengths = lengths;
+        l->hbufsize = size;
+    }
+    if ((l->hheaders[l->hargc] = malloc(i+1)) == NULL) {
+        puredis_csv_error(l, "puredis: can not proceed!!  Memory Error!"); return;
+    }
+    memcpy(l->hheaders[l->hargc], s, i);
+    l->hheaders[l->hargc][i] = '\0';
+    l->hlengths[l->hargc] = i;
+    l->hargc++;
+}
+
+/* handles a csv value: the first of a row is the key, the others are loaded */
+static void puredis_csv_field(t_redis_loader * l, const char * s, size_t i, int copy)
+{
+    if (l->lskip) return;
+    
+    if (l->lheader) {
+        /* first line holds the hash field names */
+        puredis_csv_header(l, s, i);
+    } else if (l->lnew) {
+        puredis_csv_parse(l, s, i, copy);
+    } else {
+        l->lnew = 1;
+        if (i > 0 && s[0] == '#') {
+            l->lskip = 1;
+            return;
+        }
+        l->largc = 0;
+        l->larenapos = 0;
+        l->lvals = 0;
+        l->hcount = 1;
+        l->zcount = 0;
+        puredis_csv_arg(l, l->lcmd, strlen(l->lcmd), 0);
+        puredis_csv_arg(l, s, i, copy);
+        l->lkeyend = l->larenapos;
+    }
+}
+
+/* handles the end of a csv row */
+static void puredis_csv_row(t_redis_loader * l)
+{
+    if (l->lnew && !l->lskip) puredis_csv_endrow(l);
+    l->lnew = 0;
+    l->lskip = 0;
+    l->lheader = 0;
+    l->lcount++;
+}
+
+/* libcsv callback for each values in csv data */
+static void puredis_csv_cb1 (void *s, size_t i, void *userdata)
+{
+    puredis_csv_field((t_redis_loader *)userdata, (const char*)s, i, 1);
+}
+
+/* libcsv callback for each line change in csv data */
+static void puredis_csv_cb2 (int c, void *userdata)
+{
+    (void)c;
+    puredis_csv_row((t_redis_loader *)userdata);
+}
+
+/* returns the first occurrence of c1, c2 or c3 in [p, end), or end */
+static const char * puredis_csv_find(const char * p, const char * end, char c1, char c2, char c3)
+{
+#if defined(__AVX2__)
+    const __m256i v1 = _mm256_set1_epi8(c1);
+    const __m256i v2 = _mm256_set1_epi8(c2);
+    const __m256i v3 = _mm256_set1_epi8(c3);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, v1), _mm256_cmpeq_epi8(v, v2)),
+            _mm256_cmpeq_epi8(v, v3)));
+        if (m) return p + __builtin_ctz(m);
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    const __m128i v3 = _mm_set1_epi8(c3);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)),
+            _mm_cmpeq_epi8(v, v3)));
+        if (m) return p + __builtin_ctz(m);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != c1 && *p != c2 && *p != c3) p++;
+    return p;
+}
+
+/* splits csv data in place and hands field slices to the command builder
+ * without copying them.  Fields are trimmed and blank lines skipped like
+ * libcsv does; lines holding a quote are fed to libcsv until it completes
+ * the row, as quoted fields may hold delimiters and newlines */
+static int puredis_csv_scan(t_redis_loader * l, struct csv_parser * p, const char * data, size_t size)
+{
+    const char * pos = data;
+    const char * end = data + size;
+    
+    while (pos < end) {
+        const char * stop = puredis_csv_find(pos, end, '"', '\r', '\n');
+        
+        l->lbytes = pos - data;
+        if (l->labort && __atomic_load_n(l->labort, __ATOMIC_RELAXED)) return 0;
+        
+        if (stop < end && *stop == '"') {
+            int rows = l->lcount;
+            while (l->lcount == rows && pos < end) {
+                const char * nl = puredis_csv_find(stop, end, '\r', '\n', '\n');
+                size_t n = (nl < end ? nl + 1 : end) - pos;
+                if (csv_parse(p, pos, n, puredis_csv_cb1, puredis_csv_cb2, l) != n) {
+                    puredis_csv_error(l, "Puredis error parsing csv file: %s", csv_strerror(csv_error(p)));
+                    return 0;
+                }
+                pos += n;
+                stop = pos;
+            }
+            continue;
+        }
+        
+        const char * f = pos;
+        while (f < stop && (*f == ' ' || *f == '\t')) f++;
+        if (f < stop) {
+            f = pos;
+            while (1) {
+                const char * c = puredis_csv_find(f, stop, ',', ',', ',');
+                const char * e = c;
+                while (f < e && (*f == ' ' || *f == '\t')) f++;
+                while (e > f && (e[-1] == ' ' || e[-1] == '\t')) e--;
+                puredis_csv_field(l, f, e - f, 0);
+                if (c == stop) break;
+                f = c + 1;
+            }
+            puredis_csv_row(l);
+        }
+        pos = stop < end ? stop + 1 : end;
+    }
+    l->lbytes = size;
+    return 1;
+}
+
+/* maps a csv file in memory, returns NULL if it can not be mapped */
+static const char * puredis_csv_map(const char * filename, size_t * size)
+{
+#ifdef _WIN32
+    (void)filename; (void)size;
+    return NULL;
+#else
+    struct stat st;
+    void * data;
+    int fd;
+    
+    if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+#ifdef MADV_SEQUENTIAL
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+    *size = (size_t)st.st_size;
+    return (const char*)data;
+#endif
+}
+
+static void puredis_csv_unmap(const char * data, size_t size)
+{
+#ifdef _WIN32
+    (void)data; (void)size;
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+/* maps the csv file in memory and scans it, returns -1 if mapping is not possible */
+static int puredis_csv_mmap(t_redis_loader * l, struct csv_parser * p, const char * filename)
+{
+    size_t size = 0;
+    const char * data = puredis_csv_map(filename, &size);
+    int ok;
+    if (data == NULL) return -1;
+    ok = puredis_csv_scan(l, p, data, size);
+    /* arguments point into the mapping until their command is appended */
+    puredis_csv_unmap(data, size);
+    return ok;
+}
+
+/* reads the csv file through libcsv, for files that can not be mapped */
+static int puredis_csv_read(t_redis_loader * l, struct csv_parser * p, const char * filename)
+{
+    char buf[1024]; size_t i;
+    FILE *csvfile = fopen(filename, "rb");
+    if (csvfile == NULL) {
+        post("Puredis failed to open csv file: %s", filename);
+        return 0;
+    }
+    while ((i=fread(buf, 1, 1024, csvfile)) > 0) {
+        if (csv_parse(p, buf, i, puredis_csv_cb1, puredis_csv_cb2, l) != i) {
+            post("Puredis error parsing csv file: %s", csv_strerror(csv_error(p)));
+            fclose(csvfile);
+            return 0;
+        }
+    }
+    fclose(csvfile);
+    return 1;
+}
+
+/* libcsv csv data parsing initialization */
+static int puredis_csv_init(t_redis_loader * l)
+{
+    l->lcount = 0; l->lnew = 0; l->lskip = 0;
+    l->lbytes = 0; l->lerrcount = 0;
+    l->lnumload = 0; l->lnumerror = 0;
+    l->linflight = 0; l->lvhead = 0;
+    l->largc = 0; l->lvals = 0;
+    l->largsize = 16;
+    l->larenasize = 1024; l->larenapos = 0;
+    l->hargc = 0; l->hcount = 0; l->hbufsize = 2;
+    l->lheader = 0;
+    l->zcount = 0;
+    if (l->largcap < 4) l->largcap = 4;
+    
+    if (l->ltype == gensym("string")) {
+        l->lkind = LOAD_STRING; l->lcmd = "SET";
+    } else if (l->ltype == gensym("list")) {
+        l->lkind = LOAD_LIST; l->lcmd = "RPUSH";
+    } else if (l->ltype == gensym("set")) {
+        l->lkind = LOAD_SET; l->lcmd = "SADD";
+    } else if (l->ltype == gensym("zset")) {
+        l->lkind = LOAD_ZSET; l->lcmd = "ZADD";
+    } else if (l->ltype == gensym("hash")) {
+        l->lkind = LOAD_HASH; l->lcmd = "HMSET";
+        l->lheader = 1;
+    } else {
+        post("Puredis unknown csv load type: %s", l->ltype->s_name);
+        return 0;
+    }
+    
+    l->lvalues = malloc(l->lwindow * sizeof(int));
+    l->largv = malloc(l->largsize * sizeof(char*));
+    l->llengths = malloc(l->largsize * sizeof(size_t));
+    l->loffsets = malloc(l->largsize * sizeof(size_t));
+    l->larena = malloc(l->larenasize);
+    l->hheaders = malloc(l->hbufsize * sizeof(char*));
+    l->hlengths = malloc(l->hbufsize * sizeof(size_t));
+    if (!l->lvalues || !l->largv || !l->llengths || !l->loffsets || !l->larena ||
+        !l->hheaders || !l->hlengths) {
+        puredis_csv_free(l);
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    return 1;
+}
+
+/* libcsv cleanup */
+static void puredis_csv_free(t_redis_loader * l)
+{
+    int i;
+    for (i = 0; i < l->hargc; i++) free(l->hheaders[i]);
+    free(l->hheaders); l->hheaders = NULL; l->hargc = 0;
+    free(l->hlengths); l->hlengths = NULL;
+    free(l->lvalues); l->lvalues = NULL;
+    free(l->largv); l->largv = NULL;
+    free(l->llengths); l->llengths = NULL;
+    free(l->loffsets); l->loffsets = NULL;
+    free(l->larena); l->larena = NULL;
+}
+
+/* csv worker thread: loads its chunk of the mapped file on its own connection */
+static void * puredis_csv_worker(void * data)
+{
+    t_redis_csvworker * w = (t_redis_csvworker*)data;
+    t_redis_loader * l = &w->loader;
+    struct csv_parser p;
+    struct timeval timeout = { 5, 0 };
+    
+    l->redis = redisConnectWithTimeout(w->host, w->port, timeout);
+    if (l->redis == NULL || l->redis->err) {
+        puredis_csv_error(l, "Puredis csv load could not connect to redis: %s",
+            l->redis ? l->redis->errstr : "out of memory");
+    } else {
+        csv_init(&p, 0);
+        csv_set_opts(&p, CSV_APPEND_NULL);
+        if (puredis_csv_scan(l, &p, w->data, w->size))
+            csv_fini(&p, puredis_csv_cb1, puredis_csv_cb2, l);
+        csv_free(&p);
+        puredis_csv_reap(l);
+    }
+    puredis_csv_publish(l);
+    if (l->redis) redisFree(l->redis);
+    l->redis = NULL;
+    __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* splits the mapped csv file at line boundaries among worker threads,
+ * returns -1 if the file can not be mapped */
+static int puredis_csv_threaded(t_redis *x, const char * filename)
+{
+    t_redis_loader * l = &x->loader;
+    t_redis_csvload * load;
+    struct csv_parser p;
+    const char * pos, * end;
+    size_t size = 0;
+    int i;
+    
+    const char * data = puredis_csv_map(filename, &size);
+    if (data == NULL) return -1;
+    if (!puredis_csv_init(l)) {
+        puredis_csv_unmap(data, size);
+        return 0;
+    }
+    if ((load = calloc(1, sizeof(t_redis_csvload))) == NULL ||
+        (load->workers = calloc(x->lthreads, sizeof(t_redis_csvworker))) == NULL) {
+        free(load);
+        puredis_csv_free(l);
+        puredis_csv_unmap(data, size);
+        post("puredis: can not proceed!!  Memory Error!"); return 0;
+    }
+    load->map = data;
+    load->mapsize = size;
+    
+    /* hash field names are read here and copied to every worker */
+    pos = data; end = data + size;
+    csv_init(&p, 0);
+    csv_set_opts(&p, CSV_APPEND_NULL);
+    while (l->lheader && pos < end) {
+        const char * nl = puredis_csv_find(pos, end, '\n', '\n', '\n');
+        nl = nl < end ? nl + 1 : end;
+        puredis_csv_scan(l, &p, pos, nl - pos);
+        pos = nl;
+    }
+    csv_free(&p);
+    load->headerlines = l->lcount;
+    
+    for (i = 0; i < x->lthreads && pos < end; i++) {
+        t_redis_csvworker * w = &load->workers[i];
+        t_redis_loader * wl = &w->loader;
+        const char * stop = end;
+        int h;
+        if (i < x->lthreads - 1) {
+            stop = pos + (end - pos) / (x->lthreads - i);
+            stop = puredis_csv_find(stop, end, '\n', '\n', '\n');
+            stop = stop < end ? stop + 1 : end;
+        }
+        wl->ltype = l->ltype;
+        wl->lwindow = l->lwindow;
+        wl->largcap = l->largcap;
+        if (!puredis_csv_init(wl)) break;
+        wl->lheader = 0;
+        wl->lworker = 1;
+        wl->labort = &load->abort;
+        for (h = 0; h < l->hargc; h++) puredis_csv_header(wl, l->hheaders[h], l->hlengths[h]);
+        w->data = pos;
+        w->size = stop - pos;
+        w->host = x->r_host;
+        w->port = x->r_port;
+        if (pthread_create(&w->thread, NULL, puredis_csv_worker, w) != 0) {
+            puredis_csv_free(wl);
+            post("puredis: could not start csv load thread");
+            break;
+        }
+        load->nworkers++;
+        pos = stop;
+    }
+    puredis_csv_free(l);
+    /* the part of a worker that could not start is not loaded, its lines
+     * are reported as errors rather than silently lost */
+    while (pos < end) {
+        const char * nl = puredis_csv_find(pos, end, '\n', '\n', '\n');
+        load->skipped++;
+        pos = nl < end ? nl + 1 : end;
+    }
+    if (load->skipped > 0) post("puredis: %d csv lines not loaded, no load thread for them", load->skipped);
+    
+    load->running = 1;
+    load->last = sys_getrealtime();
+    x->csvload = load;
+    if (x->csv_clock == NULL) x->csv_clock = clock_new(x, (t_method)puredis_csv_progress);
+    clock_delay(x->csv_clock, x->lprogress);
+    return 1;
+}
+
+/* outputs threaded csv load progress and the final status once every worker is done */
+static void puredis_csv_progress(t_redis *x)
+{
+    t_redis_csvload * load = x->csvload;
+    int i, done = 1, lines = load->headerlines + load->skipped, entries = 0, errors = load->skipped;
+    size_t bytes = 0;
+    double now = sys_getrealtime();
+    
+    for (i = 0; i < load->nworkers; i++) {
+        t_redis_loader * wl = &load->workers[i].loader;
+        done &= __atomic_load_n(&load->workers[i].done, __ATOMIC_ACQUIRE);
+        lines += __atomic_load_n(&wl->lpublines, __ATOMIC_RELAXED);
+        entries += __atomic_load_n(&wl->lpubload, __ATOMIC_RELAXED);
+        errors += __atomic_load_n(&wl->lpuberror, __ATOMIC_RELAXED);
+        bytes += __atomic_load_n(&wl->lpubbytes, __ATOMIC_RELAXED);
+    }
+    
+    if (!done) {
+        t_atom progress[11];
+        double rate = now > load->last ? (bytes - load->lastbytes) / (now - load->last) : 0;
+        SETSYMBOL(&progress[0], gensym("csv-load-progress"));
+        SETSYMBOL(&progress[1], gensym("lines"));
+        SETFLOAT(&progress[2], lines);
+        SETSYMBOL(&progress[3], gensym("entries"));
+        SETFLOAT(&progress[4], entries);
+        SETSYMBOL(&progress[5], gensym("error"));
+        SETFLOAT(&progress[6], errors);
+        SETSYMBOL(&progress[7], gensym("bytes"));
+        SETFLOAT(&progress[8], bytes);
+        SETSYMBOL(&progress[9], gensym("rate"));
+        SETFLOAT(&progress[10], rate);
+        load->last = now;
+        load->lastbytes = bytes;
+        outlet_list(x->x_obj.ob_outlet, &s_list, 11, &progress[0]);
+        clock_delay(x->csv_clock, x->lprogress);
+        return;
+    }
+    
+    for (i = 0; i < load->nworkers; i++) {
+        t_redis_loader * wl = &load->workers[i].loader;
+        if (wl->lerrcount > 0)
+            post("Puredis csv load thread %d: %d error(s), last: %s", i, wl->lerrcount, wl->lerrstr);
+    }
+    puredis_csv_unload(x);
+    puredis_csv_status(x, gensym("csv-load-status"), lines, entries, errors);
+}
+
+/* joins the csv worker threads and releases the mapped file */
+static void puredis_csv_unload(t_redis *x)
+{
+    t_redis_csvload * load = x->csvload;
+    int i;
+    __atomic_store_n(&load->abort, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < load->nworkers; i++) {
+        pthread_join(load->workers[i].thread, NULL);
+        puredis_csv_free(&load->workers[i].loader);
+    }
+    puredis_csv_unmap(load->map, load->mapsize);
+    free(load->workers);
+    free(load);
+    x->csvload = NULL;
+    if (x->csv_clock) clock_unset(x->csv_clock);
+}
+
+/* outputs csv load counters */
+static void puredis_csv_status(t_redis *x, t_symbol *s, int lines, int entries, int errors)
+{
+    t_atom stats[7];
+    SETSYMBOL(&stats[0], s);
+    SETSYMBOL(&stats[1], gensym("lines"));
+    SETFLOAT(&stats[2], lines);
+    SETSYMBOL(&stats[3], gensym("entries"));
+    SETFLOAT(&stats[4], entries);
+    SETSYMBOL(&stats[5], gensym("error"));
+    SETFLOAT(&stats[6], errors);
+    outlet_list(x->x_obj.ob_outlet, &s_list, 7, &stats[0]);
+}
+
+/* puredis csv data load method */
+void puredis_csv(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s; (void)argc;
+    char filename[256];
+    int ok;
+    t_redis_loader * l = &x->loader;
+    if (x->thread_on) {
+        post("puredis: csv loading is not available in thread mode"); return;
+    }
+    if (x->nconns || x->shared) {
+        post("puredis: csv loading is not available with shards or shared connections"); return;
+    }
+    if (x->conn_state != CONN_UP) {
+        post("puredis: csv loading needs a redis connection"); return;
+    }
+    if (x->csvload) {
+        post("puredis: a csv load is already running"); return;
+    }
+    atom_string(argv, filename, 256);
+    l->ltype = atom_getsymbol(argv+1);
+    l->redis = x->redis;
+    
+    if (x->lthreads > 0 && puredis_csv_threaded(x, filename) >= 0) return;
+    
+    struct csv_parser p;
+    if (!puredis_csv_init(l)) return;
+    csv_init(&p, 0);
+    csv_set_opts(&p, CSV_APPEND_NULL);
+    
+    if ((ok = puredis_csv_mmap(l, &p, filename)) < 0)
+        ok = puredis_csv_read(l, &p, filename);
+    if (ok) csv_fini(&p, puredis_csv_cb1, puredis_csv_cb2, l);
+    csv_free(&p);
+    puredis_csv_reap(l);
+    puredis_csv_free(l);
+    if (!ok) return;
+    
+    puredis_csv_status(x, gensym("csv-load-status"), l->lcount, l->lnumload, l->lnumerror);
+}
+
+/* puredis csvopt message method: window sets the number of csv commands in flight,
+ * argcap the maximum arguments of a row command before it is split, threads the
+ * number of worker connections loading in the background (0 loads in place) and
+ * progress the period of their progress messages in ms */
+void puredis_csvopt(t_redis *x, t_symbol *s, t_floatarg value)
+{
+    if (s == gensym("window")) {
+        x->loader.lwindow = value < 1 ? 1 : (int)value;
+    } else if (s == gensym("argcap")) {
+        x->loader.largcap = value < 4 ? 4 : (int)value;
+    } else if (s == gensym("threads")) {
+        x->lthreads = value < 0 ? 0 : (int)value;
+    } else if (s == gensym("progress")) {
+        x->lprogress = value < 10 ? 10 : (int)value;
+    } else {
+        post("puredis: unknown csv option %s", s->s_name);
+    }
+}
+
+/* reports a csv dump error, the last one is kept for the pd thread */
+static void puredis_csvdump_error(t_redis_csvdump * d, const char * fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(d->errstr, MAXPDSTRING, fmt, ap);
+    va_end(ap);
+    d->errors++;
+}
+
+/* makes the dump counters visible to the pd thread */
+static void puredis_csvdump_publish(t_redis_csvdump * d)
+{
+    __atomic_store_n(&d->pubkeys, d->keys, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->pubrows, d->rows, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->pubentries, d->entries, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->puberrors, d->errors, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->pubbytes, d->bytes, __ATOMIC_RELAXED);
+}
+
+/* writes the buffered csv text to the file, or aside for hashes */
+static void puredis_csvdump_flush(t_redis_csvdump * d)
+{
+    if (d->buflen && fwrite(d->buf, 1, d->buflen, d->body) != d->buflen) {
+        puredis_csvdump_error(d, "Puredis csv dump write failed: %s", strerror(errno));
+        __atomic_store_n(&d->abort, 1, __ATOMIC_RELAXED);
+    }
+    d->bytes += d->buflen;
+    d->buflen = 0;
+}
+
+/* buffered csv writer */
+static void puredis_csvdump_write(t_redis_csvdump * d, const char * s, size_t len)
+{
+    if (d->buflen + len > CSVDUMP_BUFFER) {
+        puredis_csvdump_flush(d);
+        if (len > CSVDUMP_BUFFER) {
+            if (fwrite(s, 1, len, d->body) != len) {
+                puredis_csvdump_error(d, "Puredis csv dump write failed: %s", strerror(errno));
+                __atomic_store_n(&d->abort, 1, __ATOMIC_RELAXED);
+            }
+            d->bytes += len;
+            return;
+        }
+    }
+    memcpy(d->buf + d->buflen, s, len);
+    d->buflen += len;
+}
+
+/* writes one csv value, quoted when the loader would otherwise split it,
+ * end its row or trim its spaces */
+static void puredis_csvdump_field(t_redis_csvdump * d, const char * s, size_t len, int first)
+{
+    int quote = len > 0 && (s[0] == ' ' || s[0] == '\t' || s[len-1] == ' ' || s[len-1] == '\t');
+    size_t i;
+    if (!first) puredis_csvdump_write(d, ",", 1);
+    for (i = 0; i < len && !quote; i++)
+        quote = s[i] == ',' || s[i] == '"' || s[i] == '\n' || s[i] == '\r';
+    if (!quote) {
+        puredis_csvdump_write(d, s, len);
+        return;
+    }
+    puredis_csvdump_write(d, "\"", 1);
+    while (len > 0) {
+        const char * q = memchr(s, '"', len);
+        size_t n = q ? (size_t)(q - s) + 1 : len;
+        puredis_csvdump_write(d, s, n);
+        if (q) puredis_csvdump_write(d, "\"", 1);
+        s += n; len -= n;
+    }
+    puredis_csvdump_write(d, "\"", 1);
+}
+
+/* returns the header column of a hash field, added if it is new, hint is
+ * tried first since the hashes of a dataset mostly share their field order */
+static int puredis_csvdump_column(t_redis_csvdump * d, const char * s, size_t len, int hint)
+{
+    int i;
+    if (hint < d->hcount && d->hlengths[hint] == len && memcmp(d->hfields[hint], s, len) == 0)
+        return hint;
+    for (i = 0; i < d->hcount; i++) {
+        if (d->hlengths[i] == len && memcmp(d->hfields[i], s, len) == 0) return i;
+    }
+    if (d->hcount == d->hsize) {
+        int size = d->hsize ? d->hsize * 2 : 16;
+        char ** fields = realloc(d->hfields, size * sizeof(char*));
+        size_t * lengths = fields ? realloc(d->hlengths, size * sizeof(size_t)) : NULL;
+        redisReply ** row = lengths ? realloc(d->hrow, size * sizeof(redisReply*)) : NULL;
+        if (fields) d->hfields = fields;
+        if (lengths) d->hlengths = lengths;
+        if (row == NULL) return -1;
+        d->hrow = row;
+        d->hsize = size;
+    }
+    if ((d->hfields[d->hcount] = malloc(len ? len : 1)) == NULL) return -1;
+    memcpy(d->hfields[d->hcount], s, len);
+    d->hlengths[d->hcount] = len;
+    d->hrow[d->hcount] = NULL;
+    return d->hcount++;
+}
+
+/* 1 if a key was dumped already, else it is added and 0, -1 on memory error */
+static int puredis_csvdump_seen(t_redis_csvdump * d, const char * key, size_t len)
+{
+    size_t i, mask;
+    
+    if (d->seencount * 2 >= d->seensize) {
+        size_t j, size = d->seensize ? d->seensize * 2 : 1024;
+        char ** seen = calloc(size, sizeof(char*));
+        size_t * lengths = seen ? malloc(size * sizeof(size_t)) : NULL;
+        if (lengths == NULL) {
+            free(seen); return -1;
+        }
+        for (j = 0; j < d->seensize; j++) {
+            if (d->seen[j] == NULL) continue;
+            i = puredis_cacheHash(d->seen[j], d->seenlengths[j]) & (size - 1);
+            while (seen[i]) i = (i + 1) & (size - 1);
+            seen[i] = d->seen[j];
+            lengths[i] = d->seenlengths[j];
+        }
+        free(d->seen);
+        free(d->seenlengths);
+        d->seen = seen;
+        d->seenlengths = lengths;
+        d->seensize = size;
+    }
+    mask = d->seensize - 1;
+    for (i = puredis_cacheHash(key, len) & mask; d->seen[i]; i = (i + 1) & mask) {
+        if (d->seenlengths[i] == len && memcmp(d->seen[i], key, len) == 0) return 1;
+    }
+    if ((d->seen[i] = malloc(len ? len : 1)) == NULL) return -1;
+    memcpy(d->seen[i], key, len);
+    d->seenlengths[i] = len;
+    d->seencount++;
+    return 0;
+}
+
+/* writes the row of a key from its GET/LRANGE/SMEMBERS/ZRANGE/HGETALL reply:
+ * KEY,VALUE  NAME,ITEM,...  NAME,SCORE,MEMBER,...  NAME,VALUE,... in header order */
+static void puredis_csvdump_row(t_redis_csvdump * d, redisReply * key, redisReply * reply)
+{
+    size_t i;
+    if (reply->type == REDIS_REPLY_ERROR) {
+        puredis_csvdump_error(d, "Puredis csv dump error on %s: %s", key->str, reply->str);
+        return;
+    }
+    /* deleted since its TYPE */
+    if (reply->type == REDIS_REPLY_NIL || (reply->type == REDIS_REPLY_ARRAY && reply->elements == 0)) return;
+    if (key->len > 0 && key->str[0] == '#') {
+        /* would be read back as a comment line */
+        puredis_csvdump_error(d, "Puredis csv dump skipped key %s", key->str);
+        return;
+    }
+    puredis_csvdump_field(d, key->str, (size_t)key->len, 1);
+    if (d->kind == LOAD_STRING) {
+        puredis_csvdump_field(d, reply->str, (size_t)reply->len, 0);
+        d->entries++;
+    } else if (d->kind == LOAD_ZSET) {
+        for (i = 0; i + 1 < reply->elements; i += 2) {
+            puredis_csvdump_field(d, reply->element[i+1]->str, (size_t)reply->element[i+1]->len, 0);
+            puredis_csvdump_field(d, reply->element[i]->str, (size_t)reply->element[i]->len, 0);
+            d->entries++;
+        }
+    } else if (d->kind == LOAD_HASH) {
+        int col = -1, last = -1;
+        for (i = 0; i + 1 < reply->elements; i += 2) {
+            col = puredis_csvdump_column(d, reply->element[i]->str, (size_t)reply->element[i]->len, col + 1);
+            if (col < 0) {
+                puredis_csvdump_error(d, "puredis: can not proceed!!  Memory Error!");
+                __atomic_store_n(&d->abort, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            d->hrow[col] = reply->element[i+1];
+            if (col > last) last = col;
+        }
+        /* columns of fields this hash does not have are left empty */
+        for (col = 0; col <= last; col++) {
+            redisReply * value = d->hrow[col];
+            puredis_csvdump_field(d, value ? value->str : "", value ? (size_t)value->len : 0, 0);
+            if (value) d->entries++;
+            d->hrow[col] = NULL;
+        }
+    } else {
+        for (i = 0; i < reply->elements; i++) {
+            puredis_csvdump_field(d, reply->element[i]->str, (size_t)reply->element[i]->len, 0);
+            d->entries++;
+        }
+    }
+    puredis_csvdump_write(d, "\n", 1);
+    d->rows++;
+}
+
+/* pipelines TYPE for the keys of a SCAN batch, then the fetch of those holding the dumped type */
+static int puredis_csvdump_batch(t_redis_csvdump * d, redisReply * keys)
+{
+    static const char * fetch[] = {
+        "GET %b", "LRANGE %b 0 -1", "SMEMBERS %b", "ZRANGE %b 0 -1 WITHSCORES", "HGETALL %b"
+    };
+    void * reply;
+    size_t i;
+    
+    if (keys->elements > d->matchsize) {
+        char * match = realloc(d->match, keys->elements);
+        if (match == NULL) {
+            puredis_csvdump_error(d, "puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        d->match = match;
+        d->matchsize = keys->elements;
+    }
+    for (i = 0; i < keys->elements; i++)
+        redisAppendCommand(d->redis, "TYPE %b", keys->element[i]->str, (size_t)keys->element[i]->len);
+    for (i = 0; i < keys->elements; i++) {
+        redisReply * type;
+        if (redisGetReply(d->redis, &reply) != REDIS_OK) {
+            puredis_csvdump_error(d, "Puredis csv dump lost redis: %s", d->redis->errstr); return 0;
+        }
+        type = (redisReply*)reply;
+        d->match[i] = type->type == REDIS_REPLY_STATUS && strcmp(type->str, d->type) == 0;
+        freeReplyObject(reply);
+    }
+    /* a key SCAN returned again would make a second row, a list doubled on load */
+    for (i = 0; i < keys->elements; i++) {
+        int seen;
+        if (!d->match[i]) continue;
+        if ((seen = puredis_csvdump_seen(d, keys->element[i]->str, (size_t)keys->element[i]->len)) < 0) {
+            puredis_csvdump_error(d, "puredis: can not proceed!!  Memory Error!"); return 0;
+        }
+        d->match[i] = !seen;
+    }
+    for (i = 0; i < keys->elements; i++) {
+        if (d->match[i])
+            redisAppendCommand(d->redis, fetch[d->kind], keys->element[i]->str, (size_t)keys->element[i]->len);
+    }
+    for (i = 0; i < keys->elements; i++) {
+        if (!d->match[i]) continue;
+        if (redisGetReply(d->redis, &reply) != REDIS_OK) {
+            puredis_csvdump_error(d, "Puredis csv dump lost redis: %s", d->redis->errstr); return 0;
+        }
+        puredis_csvdump_row(d, keys->element[i], (redisReply*)reply);
+        freeReplyObject(reply);
+    }
+    d->keys += (int)keys->elements;
+    return 1;
+}
+
+/* writes the hash header line, counted as a row like the loader does,
+ * then the rows kept aside while it grew */
+static void puredis_csvdump_header(t_redis_csvdump * d)
+{
+    FILE * rows = d->body;
+    size_t n;
+    int i;
+    puredis_csvdump_flush(d);
+    d->body = d->out;
+    if (__atomic_load_n(&d->abort, __ATOMIC_RELAXED) || d->hcount == 0) {
+        fclose(rows);
+        return;
+    }
+    puredis_csvdump_field(d, "KEY", 3, 1);
+    for (i = 0; i < d->hcount; i++) puredis_csvdump_field(d, d->hfields[i], d->hlengths[i], 0);
+    puredis_csvdump_write(d, "\n", 1);
+    puredis_csvdump_flush(d);
+    d->rows++;
+    rewind(rows);
+    while ((n = fread(d->buf, 1, CSVDUMP_BUFFER, rows)) > 0) {
+        if (fwrite(d->buf, 1, n, d->out) != n) {
+            puredis_csvdump_error(d, "Puredis csv dump write failed: %s", strerror(errno));
+            break;
+        }
+    }
+    fclose(rows);
+}
+
+/* csv dump thread: SCAN batches of the pattern on its own connection */
+static void * puredis_csvdump_worker(void * data)
+{
+    t_redis_csvdump * d = (t_redis_csvdump*)data;
+    struct timeval timeout = { 5, 0 };
+    char cursor[32] = "0";
+    
+    d->redis = redisConnectWithTimeout(d->host, d->port, timeout);
+    if (d->redis == NULL || d->redis->err) {
+        puredis_csvdump_error(d, "Puredis csv dump could not connect to redis: %s",
+            d->redis ? d->redis->errstr : "out of memory");
+    } else {
+        do {
+            redisReply * scan = redisCommand(d->redis, "SCAN %s MATCH %s COUNT %d",
+                cursor, d->pattern, CSVDUMP_COUNT);
+            int ok = scan && scan->type == REDIS_REPLY_ARRAY && scan->elements == 2 &&
+                scan->element[0]->type == REDIS_REPLY_STRING && scan->element[1]->type == REDIS_REPLY_ARRAY;
+            if (!ok) {
+                puredis_csvdump_error(d, "Puredis csv dump SCAN failed: %s",
+                    scan == NULL ? d->redis->errstr : scan->type == REDIS_REPLY_ERROR ? scan->str : "unexpected reply");
+            } else {
+                snprintf(cursor, sizeof(cursor), "%s", scan->element[0]->str);
+                ok = puredis_csvdump_batch(d, scan->element[1]);
+            }
+            if (scan) freeReplyObject(scan);
+            puredis_csvdump_publish(d);
+            if (!ok) break;
+        } while (strcmp(cursor, "0") != 0 && !__atomic_load_n(&d->abort, __ATOMIC_RELAXED));
+    }
+    if (d->kind == LOAD_HASH) {
+        puredis_csvdump_header(d);
+    } else {
+        puredis_csvdump_flush(d);
+    }
+    if (fclose(d->out) != 0) puredis_csvdump_error(d, "Puredis csv dump write failed: %s", strerror(errno));
+    d->out = d->body = NULL;
+    puredis_csvdump_publish(d);
+    if (d->redis) redisFree(d->redis);
+    d->redis = NULL;
+    __atomic_store_n(&d->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* releases a csv dump, its files are closed by the worker */
+static void puredis_csvdump_free(t_redis_csvdump * d)
+{
+    int i;
+    for (i = 0; i < d->hcount; i++) free(d->hfields[i]);
+    free(d->hfields);
+    free(d->hlengths);
+    free(d->hrow);
+    for (i = 0; i < (int)d->seensize; i++) free(d->seen[i]);
+    free(d->seen);
+    free(d->seenlengths);
+    free(d->match);
+    free(d->buf);
+    free(d->pattern);
+    free(d);
+}
+
+/* outputs csv dump progress and the final status once the worker is done */
+static void puredis_csvdump_progress(t_redis *x)
+{
+    t_redis_csvdump * d = x->csvdump;
+    int done = __atomic_load_n(&d->done, __ATOMIC_ACQUIRE);
+    int keys = __atomic_load_n(&d->pubkeys, __ATOMIC_RELAXED);
+    int rows = __atomic_load_n(&d->pubrows, __ATOMIC_RELAXED);
+    int entries = __atomic_load_n(&d->pubentries, __ATOMIC_RELAXED);
+    int errors = __atomic_load_n(&d->puberrors, __ATOMIC_RELAXED);
+    size_t bytes = __atomic_load_n(&d->pubbytes, __ATOMIC_RELAXED);
+    double now = sys_getrealtime();
+    
+    if (!done) {
+        t_atom progress[13];
+        double rate = now > d->last ? (bytes - d->lastbytes) / (now - d->last) : 0;
+        SETSYMBOL(&progress[0], gensym("csv-dump-progress"));
+        SETSYMBOL(&progress[1], gensym("keys"));
+        SETFLOAT(&progress[2], keys);
+        SETSYMBOL(&progress[3], gensym("lines"));
+        SETFLOAT(&progress[4], rows);
+        SETSYMBOL(&progress[5], gensym("entries"));
+        SETFLOAT(&progress[6], entries);
+        SETSYMBOL(&progress[7], gensym("error"));
+        SETFLOAT(&progress[8], errors);
+        SETSYMBOL(&progress[9], gensym("bytes"));
+        SETFLOAT(&progress[10], bytes);
+        SETSYMBOL(&progress[11], gensym("rate"));
+        SETFLOAT(&progress[12], rate);
+        d->last = now;
+        d->lastbytes = bytes;
+        outlet_list(x->x_obj.ob_outlet, &s_list, 13, &progress[0]);
+        clock_delay(x->dump_clock, x->lprogress);
+        return;
+    }
+    
+    if (errors > 0) post("Puredis csv dump: %d error(s), last: %s", errors, d->errstr);
+    puredis_csvdump_unload(x);
+    puredis_csv_status(x, gensym("csv-dump-status"), rows, entries, errors);
+}
+
+/* stops and joins the csv dump thread */
+static void puredis_csvdump_unload(t_redis *x)
+{
+    t_redis_csvdump * d = x->csvdump;
+    __atomic_store_n(&d->abort, 1, __ATOMIC_RELAXED);
+    pthread_join(d->thread, NULL);
+    puredis_csvdump_free(d);
+    x->csvdump = NULL;
+    if (x->dump_clock) clock_unset(x->dump_clock);
+}
+
+/* puredis csvdump message method: csvdump file type [pattern] writes every
+ * key of the type matching the pattern (all by default) in the format the
+ * csv message loads, from a worker thread on its own connection */
+void puredis_csvdump(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    static const char * types[] = { "string", "list", "set", "zset", "hash" };
+    char filename[MAXPDSTRING], pattern[MAXPDSTRING];
+    t_redis_csvdump * d;
+    t_symbol * type;
+    int kind;
+    
+    if (argc < 2) {
+        post("puredis: csvdump needs a file and a type"); return;
+    }
+    if (x->nconns || x->shared) {
+        post("puredis: csv dumps are not available with shards or shared connections"); return;
+    }
+    if (x->conn_state != CONN_UP) {
+        post("puredis: csv dumps need a redis connection"); return;
+    }
+    if (x->csvdump) {
+        post("puredis: a csv dump is already running"); return;
+    }
+    type = atom_getsymbol(argv+1);
+    for (kind = LOAD_STRING; kind <= LOAD_HASH && type != gensym(types[kind]); kind++);
+    if (kind > LOAD_HASH) {
+        post("Puredis unknown csv dump type: %s", type->s_name); return;
+    }
+    atom_string(argv, filename, MAXPDSTRING);
+    if (argc > 2) {
+        atom_string(argv+2, pattern, MAXPDSTRING);
+    } else {
+        strcpy(pattern, "*");
+    }
+    
+    if ((d = calloc(1, sizeof(t_redis_csvdump))) == NULL ||
+        (d->buf = malloc(CSVDUMP_BUFFER)) == NULL || (d->pattern = strdup(pattern)) == NULL) {
+        if (d) puredis_csvdump_free(d);
+        post("puredis: can not proceed!!  Memory Error!"); return;
+    }
+    if ((d->out = fopen(filename, "wb")) == NULL) {
+        puredis_csvdump_free(d);
+        post("Puredis failed to open csv file: %s", filename); return;
+    }
+    /* hash rows are written once the header holds all their fields */
+    d->body = kind == LOAD_HASH ? tmpfile() : d->out;
+    if (d->body == NULL) {
+        fclose(d->out);
+        puredis_csvdump_free(d);
+        post("Puredis csv dump could not create a temporary file"); return;
+    }
+    d->kind = kind;
+    d->type = types[kind];
+    d->host = x->r_host;
+    d->port = x->r_port;
+    d->last = sys_getrealtime();
+    if (pthread_create(&d->thread, NULL, puredis_csvdump_worker, d) != 0) {
+        if (d->body != d->out) fclose(d->body);
+        fclose(d->out);
+        puredis_csvdump_free(d);
+        post("puredis: could not start csv dump thread"); return;
+    }
+    x->csvdump = d;
+    if (x->dump_clock == NULL) x->dump_clock = clock_new(x, (t_method)puredis_csvdump_progress);
+    clock_delay(x->dump_clock, x->lprogress);
+}
+
+/* apuredis */
+
+/* apuredis setup method */
+static void setup_apuredis(void)
+{
+    apuredis_class = class_new(gensym("apuredis"),
+        (t_newmethod)redis_new,
+        (t_method)redis_free,
+        sizeof(t_redis),
+        CLASS_DEFAULT,
+        A_GIMME, 0);
+    
+    class_addbang(apuredis_class,apuredis_bang);
+    class_addmethod(apuredis_class,
+        (t_method)apuredis_stop, gensym("stop"),0);
+    class_addmethod(apuredis_class,
+        (t_method)apuredis_start, gensym("start"),0);
+    class_addmethod(apuredis_class,
+        (t_method)apuredis_drain, gensym("drain"),
+        A_GIMME, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_mode, gensym("mode"),
+        A_SYMBOL, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_chunk, gensym("chunk"),
+        A_FLOAT, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_decode, gensym("decode"),
+        A_SYMBOL, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_symbols, gensym("symbols"), A_GIMME, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_stats, gensym("stats"), 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_toarray, gensym("toarray"),
+        A_GIMME, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_fromarray, gensym("fromarray"),
+        A_GIMME, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_command, gensym("command"),
+        A_GIMME, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_timeout, gensym("timeout"),
+        A_FLOAT, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_replay, gensym("replay"),
+        A_FLOAT, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_batch, gensym("batch"),
+        A_GIMME, 0);
+    class_addmethod(apuredis_class,
+        (t_method)redis_script, gensym("script"),
+        A_GIMME, 0);
+    class_sethelpsymbol(apuredis_class, gensym("apuredis-help"));
+}
+
+/* apuredis data yielding callback
+ * drains every reply already buffered by hiredis, reading the socket again
+ * as long as it keeps delivering complete replies, until the queue is empty
+ * or the per tick reply count or time budget is spent */
+static void apuredis_yield(t_redis * x)
+{
+    x->drain_more = 0;
+    if (x->nconns) {
+        redis_shardYield(x);
+    } else if (x->shared) {
+        redis_shardOutput(x);
+    } else if (x->async_num > 0) {
+        int count = 0;
+        int parsed = 1;
+        double start = sys_getrealtime();
+        void * tmpreply = NULL;
+        
+        redis_flush(x);
+        
+        if (x->chunk_reply) {
+            /* replies wait behind a chunked one, only empty the socket */
+            if (redis_bufferRead(x->redis, &x->stat_read) == REDIS_ERR) redis_ioerror(x);
+            goto done;
+        }
+        
+        while (x->async_num > 0 && parsed) {
+            if (redis_bufferRead(x->redis, &x->stat_read) == REDIS_ERR) {
+                redis_ioerror(x);
+                break;
+            }
+            parsed = 0;
+            while (x->async_num > 0) {
+                if (redisGetReplyFromReader(x->redis,&tmpreply) == REDIS_ERR)
+                    goto done;
+                if (tmpreply == NULL) break;
+                
+                x->async_num--;
+                parsed++; count++;
+                redis_dispatchReply(x, (redisReply*)tmpreply);
+                if (x->chunk_reply) goto done;
+                
+                if ((x->drain_max > 0 && count >= x->drain_max) ||
+                    (x->drain_budget > 0 && sys_getrealtime() - start >= x->drain_budget)) {
+                    x->drain_more = (x->async_num > 0);
+                    goto done;
+                }
+            }
+        }
+    }
+done:
+    if (x->async_prev_num != x->async_num) apuredis_q_out(x);
+}
+
+/* apuredis socket readable callback, an idle socket is read once so that
+ * an EOF or a reset ends the connection instead of waking us up forever */
+static void apuredis_pollread(t_redis *x, int fd)
+{
+    (void)fd;
+    if (!x->nconns && !x->shared && x->async_num < 1) {
+        if (x->conn_state == CONN_UP && redis_bufferRead(x->redis, &x->stat_read) == REDIS_ERR) redis_ioerror(x);
+    } else {
+        apuredis_yield(x);
+    }
+    apuredis_schedule(x);
+}
+
+/* apuredis outputs queue lenght on second outlet */
+static void apuredis_q_out(t_redis * x)
+{
+    t_atom value;
+    x->async_prev_num = x->async_num;
+    SETFLOAT(&value, x->async_num);
+    outlet_float(x->q_out, atom_getfloat(&value));
+}
+
+/* apuredis scheduled callback */
+static void apuredis_run(t_redis *x)
+{
+    apuredis_yield(x);
+    apuredis_schedule(x);
+}
+
+/* apuredis (re-)scheduling method
+ * in poll mode the socket wakes us up for reading, the clock only runs to
+ * flush new commands or to finish a drain cut short by its budget */
+static void apuredis_schedule(t_redis *x)
+{
+    if (x->poll_mode) {
+        if (!x->async_run) {
+            redis_polloff(x);
+            clock_unset(x->async_clock);
+            return;
+        }
+        redis_pollon(x, (t_fdpollfn)apuredis_pollread);
+        if (x->drain_more || x->flush_more) {
+            clock_delay(x->async_clock, 1);
+        } else if (x->async_num > 0 && redis_hasOutput(x)) {
+            clock_delay(x->async_clock, 0);
+        } else {
+            clock_unset(x->async_clock);
+        }
+    } else if ((!x->async_run) || x->async_num < 1) {
+        clock_unset(x->async_clock);
+    } else if (x->async_run && x->async_num > 0) {
+        clock_delay(x->async_clock, 1);
+    }
+}
+
+/* apuredis manual yielding method w/bang */
+void apuredis_bang(t_redis *x)
+{
+    apuredis_yield(x);
+}
+
+/* apuredis start message method */
+void apuredis_start(t_redis *x, t_symbol *s)
+{
+    (void)s;
+    x->async_run = 1;
+    apuredis_schedule(x);
+}
+
+/* apuredis stop message method */
+void apuredis_stop(t_redis *x, t_symbol *s)
+{
+    (void)s;
+    x->async_run = 0;
+    apuredis_schedule(x);
+}
+
+/* apuredis and spuredis drain message method: max replies and microseconds per tick,
+ * 0 is unlimited, the time budget is left as is when only the replies are given */
+void apuredis_drain(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    if (argc < 1) {
+        post("apuredis: drain needs a number of replies and optionally microseconds"); return;
+    }
+    x->drain_max = atom_getfloat(argv) < 0 ? 0 : (int)atom_getfloat(argv);
+    if (argc > 1) {
+        t_float usec = atom_getfloat(argv + 1);
+        x->drain_budget = usec < 0 ? 0 : usec / 1000000.;
+    }
+}
+
+/* spuredis */
+
+/* spuredis setup method */
+static void setup_spuredis(void)
+{
+    spuredis_class = class_new(gensym("spuredis"),
+        (t_newmethod)redis_new,
+        (t_method)redis_free,
+        sizeof(t_redis),
+        CLASS_DEFAULT,
+        A_GIMME, 0);
+    
+    class_addbang(spuredis_class,spuredis_bang);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_stop, gensym("stop"),0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_start, gensym("start"),0);
+    class_addmethod(spuredis_class,
+        (t_method)redis_mode, gensym("mode"),
+        A_SYMBOL, 0);
+    class_addmethod(spuredis_class,
+        (t_method)apuredis_drain, gensym("drain"),
+        A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)redis_decode, gensym("decode"),
+        A_SYMBOL, 0);
+    class_addmethod(spuredis_class,
+        (t_method)redis_symbols, gensym("symbols"), A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_subscribe, gensym("subscribe"),
+        A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_subscribe, gensym("unsubscribe"),
+        A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_subscribe, gensym("psubscribe"),
+        A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_subscribe, gensym("punsubscribe"),
+        A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_bind, gensym("bind"),
+        A_SYMBOL, A_SYMBOL, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_unbind, gensym("unbind"),
+        A_SYMBOL, 0);
+    class_addmethod(spuredis_class,
+        (t_method)spuredis_conflate, gensym("conflate"),
+        A_GIMME, 0);
+    class_addmethod(spuredis_class,
+        (t_method)redis_timeout, gensym("timeout"),
+        A_FLOAT, 0);
+    class_sethelpsymbol(spuredis_class, gensym("spuredis-help"));
+}
+
+/* spuredis outputs every message available on the socket, reading it
+ * again as long as it keeps delivering complete messages, until the per
+ * tick message count or time budget is spent (drain_more is then set), in
+ * conflate mode only the newest of each channel at the end of the slice */
+static void spuredis_yield(t_redis *x)
+{
+    void * tmpreply = NULL;
+    int parsed = 1;
+    int count = 0;
+    double start = sys_getrealtime();
+    
+    x->drain_more = 0;
+    while (parsed && x->conn_state == CONN_UP) {
+        if (redisBufferRead(x->redis) == REDIS_ERR) {
+            redis_ioerror(x);
+            break;
+        }
+        parsed = 0;
+        while (redisGetReplyFromReader(x->redis,&tmpreply) == REDIS_OK && tmpreply != NULL) {
+            parsed++; count++;
+            if (x->conflate) {
+                spuredis_conflateKeep(x, (redisReply*)tmpreply);
             } else {
-                x->lnew = 1;
-                x->hcount = 0;
-                free(x->lkey);
-                if ((x->lkey = malloc(i+1)) == NULL) {
-                    post("puredis: can not proceed!!  Memory Error!"); return;
-                }
-                strcpy(x->lkey, (char*)s);
+                spuredis_dispatch(x, (redisReply*)tmpreply);
             }
-        } else {
-            if ((x->hheaders[x->hcount] = malloc(i+1)) == NULL) {
-                post("puredis: can not proceed!!  Memory Error!"); return;
-            }
-            strcpy(x->hheaders[x->hcount], (char*)s);
-            x->hcount++;
-            x->hargc++;
-            if (x->hbufsize == x->hargc) {
-                x->hbufsize += x->hbufsize / 2;
-                x->hheaders = realloc(x->hheaders, x->hbufsize * sizeof(char*));
-            }
-        }
-    } else if (x->ltype == gensym("zset")) {
-        if (x->lnew) {
-            if (x->zcount) {
-                puredis_csv_parse(x, 4, s,i);
-                x->zcount = 0;
-            } else {
-                x->zcount = 1;
-                free(x->zscore);
-                if ((x->zscore = malloc(i+1)) == NULL) {
-                    post("puredis: can not proceed!!  Memory Error!"); return;
-                }
-                strcpy(x->zscore, (char*)s);
+            if ((x->drain_max > 0 && count >= x->drain_max) ||
+                (x->drain_budget > 0 && sys_getrealtime() - start >= x->drain_budget)) {
+                x->drain_more = 1;
+                goto done;
             }
-        } else {
-            x->lnew = 1;
-            x->zcount = 0;
-            free(x->lkey);
-            if ((x->lkey = malloc(i+1)) == NULL) {
-                post("puredis: can not proceed!!  Memory Error!"); return;
+        }
+    }
+done:
+    if (x->conflate_count) spuredis_conflateOut(x);
+    /* messages kept while our own outlet re-entered wait for the next slice */
+    if (x->conflate_count && !x->conflate_busy) x->drain_more = 1;
+}
+
+/* spuredis socket readable callback, a drain cut short by its budget goes
+ * on at the next tick since the rest may already be off the socket */
+static void spuredis_pollread(t_redis *x, int fd)
+{
+    (void)fd;
+    if (x->async_run) {
+        spuredis_yield(x);
+        if (x->drain_more) clock_delay(x->async_clock, 1);
+    }
+}
+
+/* spuredis scheduled callback */
+static void spuredis_run(t_redis *x)
+{
+    if (x->conn_state != CONN_UP) {
+        /* reconnecting, subscriptions are sent again once connected */
+        if (x->async_run && !x->poll_mode) clock_delay(x->async_clock, 100);
+    } else if (x->async_run && x->poll_mode) {
+        redis_flush(x);
+        if (x->drain_more) spuredis_yield(x);
+        if (x->flush_more || x->drain_more) clock_delay(x->async_clock, 1);
+    } else if (x->async_run) {
+        redis_flush(x);
+        spuredis_yield(x);
+        if (x->async_run) clock_delay(x->async_clock, x->drain_more ? 1 : 100);
+    }
+}
+
+/* spuredis (re-)scheduling method */
+static void spuredis_schedule(t_redis *x)
+{
+    if (x->async_run && x->async_num < 1) {
+        x->async_run = 0;
+        clock_unset(x->async_clock);
+    } else if ((!x->async_run) && x->async_num > 0) {
+        x->async_run = 1;
+        clock_delay(x->async_clock, 0);
+    }
+    if (x->poll_mode && x->async_run) {
+        redis_pollon(x, (t_fdpollfn)spuredis_pollread);
+    } else {
+        redis_polloff(x);
+    }
+}
+
+/* spuredis subscriptions management: the kept channels and patterns are
+ * what the server will count, its (un)subscribe replies then set the
+ * exact number (spuredis_dispatch) */
+static void spuredis_manage(t_redis *x, t_symbol *s, int argc)
+{
+    (void)argc;
+    if (s == gensym("subscribe") || s == gensym("psubscribe") || x->conn_state != CONN_UP) {
+        x->async_num = x->nsubs + x->npsubs;
+    }
+    
+    spuredis_schedule(x);
+}
+
+/* apuredis alternate start method with bang */
+void spuredis_bang(t_redis *x)
+{
+    spuredis_schedule(x);
+}
+
+/* apuredis start message method */
+void spuredis_start(t_redis *x, t_symbol *s)
+{
+    (void)s;
+    spuredis_schedule(x);
+}
+
+/* apuredis stop message  method */
+void spuredis_stop(t_redis *x, t_symbol *s)
+{
+    (void)s;
+    x->async_run = 0;
+    redis_polloff(x);
+}
+
+/* apuredis subscribe message  method */
+void spuredis_subscribe(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    if (argc < 1 && (s == gensym("subscribe") || s == gensym("psubscribe"))) {
+        post("spuredis: %s need at least one channel", s->s_name); return;
+    }
+    
+    /* (p)subscribe or (p)unsubscribe is the redis first command part,
+     * unsubscribing without channels drops them all */
+    if (!redis_buildCommand(x, s, argc, argv)) return;
+    spuredis_keep(x, s, argc, argv);
+    if (x->conn_state == CONN_UP) {
+        redis_postCommandAsync(x, argc+1, x->cmd_argv, x->cmd_lengths);
+        if (x->poll_mode) redis_flush(x);
+    }
+    spuredis_manage(x, s, argc);
+}
+
+/* remembers the subscribed channels and patterns to subscribe again after a reconnection */
+static void spuredis_keep(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    int pattern = s == gensym("psubscribe") || s == gensym("punsubscribe");
+    int add = s == gensym("subscribe") || s == gensym("psubscribe");
+    t_symbol *** subs = pattern ? &x->psubs : &x->subs;
+    int * nsubs = pattern ? &x->npsubs : &x->nsubs;
+    int * subs_size = pattern ? &x->psubs_size : &x->subs_size;
+    int i, j;
+    
+    if (!add && argc == 0) *nsubs = 0;
+    for (i = 0; i < argc; i++) {
+        t_symbol * channel = atom_getsymbol(argv + i);
+        for (j = 0; j < *nsubs && (*subs)[j] != channel; j++);
+        if (add && j == *nsubs) {
+            if (*nsubs == *subs_size) {
+                int size = *subs_size ? *subs_size * 2 : 16;
+                t_symbol ** list = realloc(*subs, size * sizeof(t_symbol*));
+                if (list == NULL) return;
+                *subs = list;
+                *subs_size = size;
+            }
+            (*subs)[(*nsubs)++] = channel;
+        } else if (!add && j < *nsubs) {
+            (*subs)[j] = (*subs)[--(*nsubs)];
+        }
+    }
+}
+
+/* spuredis replies: (un)subscribe confirmations carry the server's count
+ * of subscriptions, messages of a bound channel or pattern are sent to its
+ * receivers, everything else comes out of the outlet */
+static void spuredis_dispatch(t_redis *x, redisReply * reply)
+{
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 3 &&
+        reply->element[0]->type == REDIS_REPLY_STRING && reply->element[1]->type == REDIS_REPLY_STRING) {
+        const char * kind = reply->element[0]->str;
+        if (reply->element[2]->type == REDIS_REPLY_INTEGER && strstr(kind, "subscribe")) {
+            x->async_num = (int)reply->element[2]->integer;
+            spuredis_schedule(x);
+        } else if (x->binds_count && (strcmp(kind, "message") == 0 ||
+                   (strcmp(kind, "pmessage") == 0 && reply->elements == 4))) {
+            int i = spuredis_bindSlot(x, redis_gensym(x, reply->element[1]->str));
+            t_symbol * recv = x->binds[i].name ? x->binds[i].recv : NULL;
+            redisReply * payload = reply->element[reply->elements - 1];
+            if (recv && recv->s_thing && payload->type == REDIS_REPLY_STRING) {
+                t_atom out[2];
+                redis_decodeString(x, payload, &out[1]);
+                if (reply->elements == 4) {
+                    SETSYMBOL(&out[0], redis_gensym(x, reply->element[2]->str));
+                    pd_list(recv->s_thing, &s_list, 2, out);
+                } else if (out[1].a_type == A_FLOAT) {
+                    pd_float(recv->s_thing, atom_getfloat(&out[1]));
+                } else {
+                    pd_symbol(recv->s_thing, atom_getsymbol(&out[1]));
+                }
+                freeReplyObject(reply);
+                return;
             }
-            strcpy(x->lkey, (char*)s);
         }
+    }
+    redis_parseReply(x, reply);
+}
+
+/* conflate message method: 1 keeps only the newest message of each channel
+ * (and pattern) per drain, 0 outputs them all, no argument outputs the
+ * count of messages dropped so far */
+void spuredis_conflate(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+{
+    (void)s;
+    if (argc > 0) {
+        x->conflate = atom_getfloat(argv) != 0;
+    } else {
+        t_atom stats[2];
+        SETSYMBOL(&stats[0], gensym("dropped"));
+        SETFLOAT(&stats[1], x->conflate_dropped);
+        outlet_anything(x->x_obj.ob_outlet, gensym("conflate"), 2, stats);
+    }
+}
+
+/* holds a message until the end of the drain, replacing an older one of its channel */
+static void spuredis_conflateKeep(t_redis *x, redisReply * reply)
+{
+    int pmessage, i;
+    t_symbol * pattern;
+    t_symbol * channel;
+    
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 3 || reply->element[0]->type != REDIS_REPLY_STRING) {
+        spuredis_dispatch(x, reply); return;
+    }
+    pmessage = strcmp(reply->element[0]->str, "pmessage") == 0 && reply->elements == 4;
+    if ((!pmessage && strcmp(reply->element[0]->str, "message") != 0) ||
+        reply->element[1]->type != REDIS_REPLY_STRING || reply->element[2]->type != REDIS_REPLY_STRING) {
+        spuredis_dispatch(x, reply); return;
+    }
+    pattern = pmessage ? redis_gensym(x, reply->element[1]->str) : NULL;
+    channel = redis_gensym(x, reply->element[pmessage ? 2 : 1]->str);
+    
+    if ((x->conflate_count + 1) * 2 > x->conflate_size) {
+        int size = x->conflate_size ? x->conflate_size * 2 : 64;
+        t_redis_conflated * conflated = calloc(size, sizeof(t_redis_conflated));
+        int * order = malloc(size * sizeof(int));
+        t_redis_conflated * old = x->conflated;
+        int * old_order = x->conflate_order;
+        if (conflated == NULL || order == NULL) {
+            free(conflated); free(order);
+            spuredis_dispatch(x, reply); return;
+        }
+        x->conflated = conflated;
+        x->conflate_order = order;
+        x->conflate_size = size;
+        for (i = 0; i < x->conflate_count; i++) {
+            /* entries already output by a running spuredis_conflateOut have no reply */
+            t_redis_conflated * c = &old[old_order[i]];
+            int slot = spuredis_conflateSlot(x, c->pattern, c->channel);
+            if (c->reply) x->conflated[slot] = *c;
+            x->conflate_order[i] = slot;
+        }
+        free(old);
+        free(old_order);
+    }
+    i = spuredis_conflateSlot(x, pattern, channel);
+    if (x->conflated[i].reply) {
+        freeReplyObject(x->conflated[i].reply);
+        x->conflate_dropped++;
     } else {
-        if (x->lnew) {
-            puredis_csv_parse(x, 3, s,i);
+        x->conflated[i].pattern = pattern;
+        x->conflated[i].channel = channel;
+        x->conflate_order[x->conflate_count++] = i;
+    }
+    x->conflated[i].reply = reply;
+}
+
+/* slot of a channel and pattern in the conflation table, or the empty slot ending its probe */
+static int spuredis_conflateSlot(t_redis *x, t_symbol * pattern, t_symbol * channel)
+{
+    int i = (int)((((size_t)channel >> 3) ^ ((size_t)pattern >> 3)) * 2654435761u & (x->conflate_size - 1));
+    while (x->conflated[i].reply &&
+        (x->conflated[i].channel != channel || x->conflated[i].pattern != pattern)) {
+        i = (i + 1) & (x->conflate_size - 1);
+    }
+    return i;
+}
+
+/* outputs the messages kept during the drain in order of first arrival,
+ * those kept meanwhile from our own outlet stay for the next call */
+static void spuredis_conflateOut(t_redis *x)
+{
+    int i, count = x->conflate_count;
+    
+    if (x->conflate_busy) return;
+    x->conflate_busy = 1;
+    for (i = 0; i < count; i++) {
+        t_redis_conflated * c = &x->conflated[x->conflate_order[i]];
+        redisReply * reply = c->reply;
+        c->reply = NULL;
+        spuredis_dispatch(x, reply);
+    }
+    x->conflate_busy = 0;
+    x->conflate_count -= count;
+    memmove(x->conflate_order, x->conflate_order + count, x->conflate_count * sizeof(int));
+}
+
+/* slot of a channel or pattern in the binding table, or the empty slot ending its probe */
+static int spuredis_bindSlot(t_redis *x, t_symbol * name)
+{
+    int i = (int)(((size_t)name >> 3) * 2654435761u & (x->binds_size - 1));
+    while (x->binds[i].name && x->binds[i].name != name) i = (i + 1) & (x->binds_size - 1);
+    return i;
+}
+
+/* bind message method: messages of a channel, or of the channels matching
+ * a pattern, go to a receive name instead of the outlet, a pattern as
+ * <channel> <message> lists */
+void spuredis_bind(t_redis *x, t_symbol *name, t_symbol *recv)
+{
+    int i;
+    
+    if ((x->binds_count + 1) * 2 > x->binds_size) {
+        int size = x->binds_size ? x->binds_size * 2 : 64;
+        t_redis_bind * binds = calloc(size, sizeof(t_redis_bind));
+        t_redis_bind * old = x->binds;
+        int old_size = x->binds_size;
+        if (binds == NULL) {
+            post("puredis: can not proceed!!  Memory Error!"); return;
+        }
+        x->binds = binds;
+        x->binds_size = size;
+        for (i = 0; i < old_size; i++) {
+            if (old[i].name) x->binds[spuredis_bindSlot(x, old[i].name)] = old[i];
+        }
+        free(old);
+    }
+    i = spuredis_bindSlot(x, name);
+    if (x->binds[i].name == NULL) x->binds_count++;
+    x->binds[i].name = name;
+    x->binds[i].recv = recv;
+}
+
+/* unbind message method: the channel or pattern comes out of the outlet again */
+void spuredis_unbind(t_redis *x, t_symbol *name)
+{
+    int i, j;
+    
+    if (x->binds_count == 0) return;
+    i = spuredis_bindSlot(x, name);
+    if (x->binds[i].name == NULL) return;
+    x->binds[i].name = NULL;
+    x->binds_count--;
+    /* shifts back the entries probed past the freed slot */
+    for (j = (i + 1) & (x->binds_size - 1); x->binds[j].name; j = (j + 1) & (x->binds_size - 1)) {
+        int k = spuredis_bindSlot(x, x->binds[j].name);
+        if (k == i) {
+            x->binds[i] = x->binds[j];
+            x->binds[j].name = NULL;
+            i = j;
+        }
+    }
+}
+
+
+/* xpuredis */
+
+/* xpuredis setup method */
+static void setup_xpuredis(void)
+{
+    xpuredis_class = class_new(gensym("xpuredis"),
+        (t_newmethod)redis_new,
+        (t_method)redis_free,
+        sizeof(t_redis),
+        CLASS_DEFAULT,
+        A_GIMME, 0);
+    
+    class_addbang(xpuredis_class, xpuredis_start);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_start, gensym("start"), 0);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_stop, gensym("stop"), 0);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_ack, gensym("ack"),
+        A_GIMME, 0);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_autoack, gensym("autoack"),
+        A_FLOAT, 0);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_count, gensym("count"),
+        A_FLOAT, 0);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_output, gensym("output"),
+        A_SYMBOL, 0);
+    class_addmethod(xpuredis_class,
+        (t_method)xpuredis_info, gensym("info"), 0);
+    class_addmethod(xpuredis_class,
+        (t_method)redis_decode, gensym("decode"),
+        A_SYMBOL, 0);
+    class_addmethod(xpuredis_class,
+        (t_method)redis_symbols, gensym("symbols"), A_GIMME, 0);
+    class_addmethod(xpuredis_class,
+        (t_method)redis_timeout, gensym("timeout"),
+        A_FLOAT, 0);
+    class_sethelpsymbol(xpuredis_class, gensym("xpuredis-help"));
+}
+
+static void xpuredis_free(t_redis *x)
+{
+    while (x->xs_nacks > 0) free(x->xs_acks[--x->xs_nacks]);
+    free(x->xs_acks);
+    free(x->xs_kinds);
+    if (x->xs_ack_fd >= 0) sys_rmpollfn(x->xs_ack_fd);
+    if (x->xs_ack) redisFree(x->xs_ack);
+    if (x->xs_clock) clock_free(x->xs_clock);
+}
+
+/* connected: creates the group (BUSYGROUP when it exists) and reads our
+ * own pending entries again before new ones, they were delivered but maybe
+ * never processed */
+static void xpuredis_resume(t_redis *x)
+{
+    redisAppendCommand(x->redis, "XGROUP CREATE %s %s $ MKSTREAM", x->xs_stream->s_name, x->xs_group->s_name);
+    x->xs_skip = 1;
+    x->xs_history = 1;
+    strcpy(x->xs_from, "0");
+    redis_pollon(x, (t_fdpollfn)xpuredis_pollread);
+    xpuredis_read(x);
+    redis_flush(x);
+    if (x->flush_more) clock_delay(x->xs_clock, 1);
+}
+
+/* keeps one XREADGROUP in flight while started, BLOCK 0 waits on the
+ * server, pd only hears of it when the socket becomes readable */
+static void xpuredis_read(t_redis *x)
+{
+    if (!x->async_run || x->xs_reading || x->conn_state != CONN_UP) return;
+    redisAppendCommand(x->redis, "XREADGROUP GROUP %s %s COUNT %d BLOCK 0 STREAMS %s %s",
+        x->xs_group->s_name, x->xs_consumer->s_name, x->xs_count, x->xs_stream->s_name,
+        x->xs_history ? x->xs_from : ">");
+    x->xs_reading = 1;
+}
+
+/* xpuredis socket readable callback */
+static void xpuredis_pollread(t_redis *x, int fd)
+{
+    void * tmpreply = NULL;
+    (void)fd;
+    
+    if (redisBufferRead(x->redis) == REDIS_ERR) {
+        redis_ioerror(x);
+        return;
+    }
+    while (x->conn_state == CONN_UP && redisGetReplyFromReader(x->redis,&tmpreply) == REDIS_OK && tmpreply != NULL) {
+        redisReply * reply = (redisReply*)tmpreply;
+        if (x->xs_skip) {
+            x->xs_skip = 0;
+            if (reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "BUSYGROUP", 9) != 0) post("xpuredis: %s", reply->str);
         } else {
-            x->lnew = 1;
-            
-            free(x->lkey);
-            if ((x->lkey = malloc(i+1)) == NULL) {
-                post("puredis: can not proceed!!  Memory Error!"); return;
+            x->xs_reading = 0;
+            xpuredis_entries(x, reply);
+        }
+        freeReplyObject(reply);
+    }
+    xpuredis_ackFlush(x);
+    xpuredis_read(x);
+    redis_flush(x);
+    if (x->flush_more) clock_delay(x->xs_clock, 1);
+}
+
+/* outputs the entries of an XREADGROUP reply, one list per entry
+ * (<id> <field> <value> ...) or one list for all of them in batch output
+ * (<id> <n> <n atoms> ...), and queues their ids for XACK in autoack */
+static void xpuredis_entries(t_redis *x, redisReply * reply)
+{
+    redisReply * entries;
+    size_t i, count = 0;
+    t_atom * out;
+    
+    if (reply->type == REDIS_REPLY_ERROR) {
+        post("xpuredis: %s", reply->str);
+        if (strncmp(reply->str, "NOGROUP", 7) == 0) {
+            /* the stream or group was deleted meanwhile */
+            redisAppendCommand(x->redis, "XGROUP CREATE %s %s $ MKSTREAM", x->xs_stream->s_name, x->xs_group->s_name);
+            x->xs_skip = 1;
+        }
+        return;
+    }
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 1 || reply->element[0]->type != REDIS_REPLY_ARRAY ||
+        reply->element[0]->elements < 2 || reply->element[0]->element[1]->type != REDIS_REPLY_ARRAY) {
+        x->xs_history = 0;
+        return;
+    }
+    entries = reply->element[0]->element[1];
+    if (entries->elements == 0) {
+        /* own pending entries all read, on to new ones */
+        x->xs_history = 0;
+        return;
+    }
+    for (i = 0; i < entries->elements; i++) {
+        redisReply * entry = entries->element[i];
+        if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 2 || entry->element[0]->type != REDIS_REPLY_STRING) continue;
+        count += 2 + (entry->element[1]->type == REDIS_REPLY_ARRAY ? entry->element[1]->elements : 0);
+        if (x->xs_history && (size_t)entry->element[0]->len < sizeof(x->xs_from)) {
+            memcpy(x->xs_from, entry->element[0]->str, entry->element[0]->len + 1);
+        }
+    }
+    x->xs_read += entries->elements;
+    if (count == 0) return;
+    
+    out = x->out_busy ? malloc(count * sizeof(t_atom)) : redis_reserveOut(x, count);
+    if (out == NULL) {
+        post("puredis: can not proceed!!  Memory Error!"); return;
+    }
+    if (x->xs_batch) {
+        int n = 0;
+        for (i = 0; i < entries->elements; i++) n += xpuredis_entryAtoms(x, entries->element[i], out + n, 1);
+        if (out == x->out) x->out_busy = 1;
+        outlet_list(x->x_obj.ob_outlet, &s_list, n, out);
+    } else {
+        if (out == x->out) x->out_busy = 1;
+        for (i = 0; i < entries->elements; i++) {
+            int n = xpuredis_entryAtoms(x, entries->element[i], out, 0);
+            if (n) outlet_list(x->x_obj.ob_outlet, &s_list, n, out);
+        }
+    }
+    if (out == x->out) {
+        x->out_busy = 0;
+        x->out_count = (int)count;
+        redis_shrinkOut(x);
+    } else {
+        free(out);
+    }
+    if (x->xs_autoack) {
+        for (i = 0; i < entries->elements; i++) {
+            redisReply * entry = entries->element[i];
+            if (entry->type == REDIS_REPLY_ARRAY && entry->elements >= 2 && entry->element[0]->type == REDIS_REPLY_STRING) {
+                xpuredis_ackPush(x, entry->element[0]->str, entry->element[0]->len);
             }
-            strcpy(x->lkey, (char*)s);
         }
     }
 }
 
-/* libcsv callback for each line change in csv data */
-static void puredis_csv_cb2 (int c, void *userdata)
+/* atoms of one entry, with their count after the id when counted, a
+ * deleted entry still pending has no fields */
+static int xpuredis_entryAtoms(t_redis *x, redisReply * entry, t_atom * out, int counted)
 {
-    (void)c;
-    t_redis *x = (t_redis *)userdata;
-    x->lnew = 0;
-    x->lcount++;
+    redisReply * fields;
+    int n = 0;
+    size_t i;
+    
+    if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 2 || entry->element[0]->type != REDIS_REPLY_STRING) return 0;
+    fields = entry->element[1];
+    SETSYMBOL(&out[n], redis_gensym(x, entry->element[0]->str));
+    n++;
+    if (counted) {
+        SETFLOAT(&out[n], fields->type == REDIS_REPLY_ARRAY ? fields->elements : 0);
+        n++;
+    }
+    if (fields->type != REDIS_REPLY_ARRAY) return n;
+    for (i = 0; i < fields->elements; i++) {
+        redisReply * f = fields->element[i];
+        if (f->type == REDIS_REPLY_STRING) {
+            redis_decodeString(x, f, &out[n]);
+        } else if (f->type == REDIS_REPLY_INTEGER) {
+            SETFLOAT(&out[n], f->integer);
+        } else {
+            SETSYMBOL(&out[n], redis_gensym(x, "nil"));
+        }
+        n++;
+    }
+    return n;
+}
+
+/* xpuredis clock: finishes writes the sockets could not take at once */
+static void xpuredis_tick(t_redis *x)
+{
+    if (x->conn_state == CONN_UP) redis_flush(x);
+    xpuredis_ackFlush(x);
+    if (x->flush_more) clock_delay(x->xs_clock, 1);
 }
 
-/* libcsv csv data parsing initialization */
-static void puredis_csv_init(t_redis *x)
+/* queues an entry id for the next XACK */
+static void xpuredis_ackPush(t_redis *x, const char * id, size_t len)
 {
-    x->lcount = 0; x->lnew = 0; x->lnumload = 0; x->lnumerror = 0;
-    if ((x->lkey = malloc(8)) == NULL) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
-    }
-    
-    char * cmd = NULL;
-    if (x->ltype == gensym("string")) {
-        cmd = "SET";
-    } else if (x->ltype == gensym("list")) {
-        cmd = "RPUSH";
-    } else if (x->ltype == gensym("set")) {
-        cmd = "SADD";
-    } else if (x->ltype == gensym("zset")) {
-        if ((x->zscore = malloc(8)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
-        }
-        cmd = "ZADD";
-    } else if (x->ltype == gensym("hash")) {
-        x->hargc = 0;
-        x->hcount = 0;
-        x->hbufsize = 2;
-        x->hheaders = NULL;
-        if ((x->hheaders = calloc(x->hbufsize, sizeof(char*))) == NULL) {
+    char * copy;
+    if (x->xs_nacks == x->xs_acks_size) {
+        int size = x->xs_acks_size ? x->xs_acks_size * 2 : XACK_GROUP;
+        char ** acks = realloc(x->xs_acks, size * sizeof(char*));
+        if (acks == NULL) {
             post("puredis: can not proceed!!  Memory Error!"); return;
         }
-        cmd = "HSET";
+        x->xs_acks = acks;
+        x->xs_acks_size = size;
     }
-    
-    if ((x->lcmd = malloc(strlen(cmd)+1)) == NULL) {
+    if ((copy = malloc(len + 1)) == NULL) {
         post("puredis: can not proceed!!  Memory Error!"); return;
     }
-    strcpy(x->lcmd, cmd);
+    memcpy(copy, id, len);
+    copy[len] = '\0';
+    x->xs_acks[x->xs_nacks++] = copy;
 }
 
-/* libcsv cleanup */
-static void puredis_csv_free(t_redis *x)
+/* opens the ack connection without blocking, the ids wait until it is up */
+static int xpuredis_ackOpen(t_redis *x)
 {
-    free(x->lkey);
-    free(x->lcmd);
-    if (x->ltype == gensym("hash")) {
-        int i;
-        for (i = 0; i < x->hargc; i++) free(x->hheaders[i]);
-        free(x->hheaders);
-    } else if (x->ltype == gensym("zset")) {
-        free(x->zscore);
+    if (x->xs_ack) return 1;
+    x->xs_ack = redisConnectNonBlock(x->r_host, x->r_port);
+    if (x->xs_ack == NULL || x->xs_ack->err) {
+        post("xpuredis: ack connection failed: %s", x->xs_ack ? x->xs_ack->errstr : "out of memory");
+        if (x->xs_ack) redisFree(x->xs_ack);
+        x->xs_ack = NULL;
+        return 0;
     }
+    x->xs_ack_fd = x->xs_ack->fd;
+    sys_addpollfn(x->xs_ack_fd, (t_fdpollfn)xpuredis_ackPollread, x);
+    return 1;
 }
 
-/* puredis csv data load method */
-void puredis_csv(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+/* pipelines the queued ids as XACK commands of XACK_GROUP ids each */
+static void xpuredis_ackFlush(t_redis *x)
 {
-    (void)s; (void)argc;
-    char buf[1024]; size_t i; char filename[256];
-    atom_string(argv, filename, 256);
-    x->ltype = atom_getsymbol(argv+1);
+    const char * argv[XACK_GROUP + 3];
+    size_t lengths[XACK_GROUP + 3];
+    int i, j, wdone = 1;
     
-    struct csv_parser p;
-    FILE *csvfile = NULL;
-    csv_init(&p, 0);
-    csv_set_opts(&p, CSV_APPEND_NULL);
-    puredis_csv_init(x);
+    if (x->xs_nacks > 0 && xpuredis_ackOpen(x)) {
+        argv[0] = "XACK"; lengths[0] = 4;
+        argv[1] = x->xs_stream->s_name; lengths[1] = strlen(argv[1]);
+        argv[2] = x->xs_group->s_name; lengths[2] = strlen(argv[2]);
+        for (i = 0; i < x->xs_nacks; i += XACK_GROUP) {
+            int n = x->xs_nacks - i < XACK_GROUP ? x->xs_nacks - i : XACK_GROUP;
+            for (j = 0; j < n; j++) {
+                argv[3 + j] = x->xs_acks[i + j];
+                lengths[3 + j] = strlen(x->xs_acks[i + j]);
+            }
+            redisAppendCommandArgv(x->xs_ack, n + 3, argv, lengths);
+            xpuredis_kindPush(x, XS_ACK);
+        }
+        while (x->xs_nacks > 0) free(x->xs_acks[--x->xs_nacks]);
+    }
+    if (x->xs_ack && x->xs_ack->obuf != NULL && sdslen(x->xs_ack->obuf) > 0) {
+        if (redisBufferWrite(x->xs_ack, &wdone) == REDIS_ERR) {
+            xpuredis_ackError(x);
+        } else if (!wdone) {
+            clock_delay(x->xs_clock, 1);
+        }
+    }
+}
+
+/* xpuredis ack socket readable callback */
+static void xpuredis_ackPollread(t_redis *x, int fd)
+{
+    void * tmpreply = NULL;
+    (void)fd;
     
-    csvfile = fopen((const char*)filename, "rb");
-    if (csvfile == NULL) {
-        post("Puredis failed to open csv file: %s", csvfile);
-        puredis_csv_free(x);
+    if (redisBufferRead(x->xs_ack) == REDIS_ERR) {
+        xpuredis_ackError(x);
         return;
     }
-    
-    while ((i=fread(buf, 1, 1024, csvfile)) > 0) {
-        if (csv_parse(&p, buf, i, puredis_csv_cb1, puredis_csv_cb2, x) != i) {
-            post("Puredis error parsing csv file: %s", csv_strerror(csv_error(&p)));
-            fclose(csvfile);
-            puredis_csv_free(x);
-            return;
+    while (x->xs_ack && redisGetReplyFromReader(x->xs_ack,&tmpreply) == REDIS_OK && tmpreply != NULL) {
+        redisReply * reply = (redisReply*)tmpreply;
+        int kind = XS_ACK;
+        if (x->xs_kinds_count > 0) {
+            kind = x->xs_kinds[x->xs_kinds_head];
+            x->xs_kinds_head = (x->xs_kinds_head + 1) % x->xs_kinds_size;
+            x->xs_kinds_count--;
         }
+        if (reply->type == REDIS_REPLY_ERROR) {
+            post("xpuredis: %s", reply->str);
+        } else if (kind == XS_ACK && reply->type == REDIS_REPLY_INTEGER) {
+            x->xs_acked += reply->integer;
+        } else if (kind == XS_INFO) {
+            xpuredis_infoOut(x, reply);
+        }
+        freeReplyObject(reply);
     }
-    
-    csv_fini(&p, puredis_csv_cb1, puredis_csv_cb2, x);
-    csv_free(&p);
-    puredis_csv_free(x);
-    
-    t_atom stats[7];
-    SETSYMBOL(&stats[0], gensym("csv-load-status"));
-    SETSYMBOL(&stats[1], gensym("lines"));
-    SETFLOAT(&stats[2], x->lcount);
-    SETSYMBOL(&stats[3], gensym("entries"));
-    SETFLOAT(&stats[4], x->lnumload);
-    SETSYMBOL(&stats[5], gensym("error"));
-    SETFLOAT(&stats[6], x->lnumerror);
-    outlet_list(x->x_obj.ob_outlet, &s_list, 7, &stats[0]);
 }
 
-/* apuredis */
+/* a lost ack connection leaves its ids pending on the server, the next
+ * read goes through our pending entries again to deliver them once more */
+static void xpuredis_ackError(t_redis *x)
+{
+    post("xpuredis: ack connection lost: %s", x->xs_ack->errstr[0] ? x->xs_ack->errstr : "connection closed");
+    sys_rmpollfn(x->xs_ack_fd);
+    redisFree(x->xs_ack);
+    x->xs_ack = NULL;
+    x->xs_ack_fd = -1;
+    x->xs_kinds_count = 0;
+    x->xs_history = 1;
+    strcpy(x->xs_from, "0");
+}
 
-/* apuredis setup method */
-static void setup_apuredis(void)
+/* remembers what the next reply on the ack connection answers */
+static void xpuredis_kindPush(t_redis *x, int kind)
 {
-    apuredis_class = class_new(gensym("apuredis"),
-        (t_newmethod)redis_new,
-        (t_method)redis_free,
-        sizeof(t_redis),
-        CLASS_DEFAULT,
-        A_GIMME, 0);
-    
-    class_addbang(apuredis_class,apuredis_bang);
-    class_addmethod(apuredis_class,
-        (t_method)apuredis_stop, gensym("stop"),0);
-    class_addmethod(apuredis_class,
-        (t_method)apuredis_start, gensym("start"),0);
-    class_addmethod(apuredis_class,
-        (t_method)redis_command, gensym("command"),
-        A_GIMME, 0);
-    class_sethelpsymbol(apuredis_class, gensym("apuredis-help"));
+    if (x->xs_kinds_count == x->xs_kinds_size) {
+        int i, size = x->xs_kinds_size ? x->xs_kinds_size * 2 : 16;
+        int * kinds = malloc(size * sizeof(int));
+        if (kinds == NULL) return;
+        for (i = 0; i < x->xs_kinds_count; i++) kinds[i] = x->xs_kinds[(x->xs_kinds_head + i) % x->xs_kinds_size];
+        free(x->xs_kinds);
+        x->xs_kinds = kinds;
+        x->xs_kinds_size = size;
+        x->xs_kinds_head = 0;
+    }
+    x->xs_kinds[(x->xs_kinds_head + x->xs_kinds_count) % x->xs_kinds_size] = kind;
+    x->xs_kinds_count++;
 }
 
-/* apuredis data yielding callback */ 
-static void apuredis_yield(t_redis * x)
+/* outputs the XINFO GROUPS figures of our group with the local counters:
+ * info pending <n> lag <n> consumers <n> read <n> acked <n>, lag is -1
+ * before redis 7 */
+static void xpuredis_infoOut(t_redis *x, redisReply * reply)
 {
-    if (x->async_num > 0) {
-        void * tmpreply = NULL;
-        if ( redisGetReply(x->redis, &tmpreply) == REDIS_ERR) return;
-        if (tmpreply == NULL) {
-            int wdone = 0;
-            if (redisBufferWrite(x->redis,&wdone) == REDIS_ERR) return;
-            
-            if (redisBufferRead(x->redis) == REDIS_ERR)
-                return;
-            if (redisGetReplyFromReader(x->redis,&tmpreply) == REDIS_ERR)
-                return;
-            
-            if (tmpreply != NULL) {
-                x->async_num--;
-                redisReply * reply = (redisReply*)tmpreply;
-                redis_parseReply(x, reply);
+    double pending = 0, lag = -1, consumers = 0;
+    size_t i, j;
+    t_atom stats[10];
+    
+    for (i = 0; reply->type == REDIS_REPLY_ARRAY && i < reply->elements; i++) {
+        redisReply * g = reply->element[i];
+        int ours = 0;
+        if (g->type != REDIS_REPLY_ARRAY) continue;
+        for (j = 0; j + 1 < g->elements; j += 2) {
+            if (g->element[j]->type == REDIS_REPLY_STRING && strcmp(g->element[j]->str, "name") == 0 &&
+                g->element[j + 1]->type == REDIS_REPLY_STRING) {
+                ours = strcmp(g->element[j + 1]->str, x->xs_group->s_name) == 0;
             }
-        } else {
-            x->async_num--;
-            redisReply * reply = (redisReply*)tmpreply;
-            redis_parseReply(x, reply);
+        }
+        if (!ours) continue;
+        for (j = 0; j + 1 < g->elements; j += 2) {
+            redisReply * value = g->element[j + 1];
+            if (g->element[j]->type != REDIS_REPLY_STRING || value->type != REDIS_REPLY_INTEGER) continue;
+            if (strcmp(g->element[j]->str, "pending") == 0) pending = value->integer;
+            else if (strcmp(g->element[j]->str, "lag") == 0) lag = value->integer;
+            else if (strcmp(g->element[j]->str, "consumers") == 0) consumers = value->integer;
         }
     }
-    
-    if (x->async_prev_num != x->async_num) {
-      x->async_prev_num = x->async_num;
-      apuredis_q_out(x);
+    SETSYMBOL(&stats[0], gensym("pending")); SETFLOAT(&stats[1], pending);
+    SETSYMBOL(&stats[2], gensym("lag")); SETFLOAT(&stats[3], lag);
+    SETSYMBOL(&stats[4], gensym("consumers")); SETFLOAT(&stats[5], consumers);
+    SETSYMBOL(&stats[6], gensym("read")); SETFLOAT(&stats[7], x->xs_read);
+    SETSYMBOL(&stats[8], gensym("acked")); SETFLOAT(&stats[9], x->xs_acked);
+    outlet_anything(x->x_obj.ob_outlet, gensym("info"), 10, stats);
+}
+
+/* xpuredis start message method, also bang */
+void xpuredis_start(t_redis *x)
+{
+    x->async_run = 1;
+    xpuredis_read(x);
+    if (x->conn_state == CONN_UP) {
+        redis_flush(x);
+        if (x->flush_more) clock_delay(x->xs_clock, 1);
     }
 }
 
-/* apuredis outputs queue lenght on second outlet */
-static void apuredis_q_out(t_redis * x)
+/* xpuredis stop message method, a read in flight is still output */
+void xpuredis_stop(t_redis *x)
 {
-    t_atom value;
-    SETFLOAT(&value, x->async_num);
-    outlet_float(x->q_out, atom_getfloat(&value));
+    x->async_run = 0;
 }
 
-/* apuredis scheduled callback */
-static void apuredis_run(t_redis *x)
+/* xpuredis ack message method: acknowledges entry ids, with autoack 0 */
+void xpuredis_ack(t_redis *x, t_symbol *s, int argc, t_atom *argv)
 {
-    apuredis_yield(x);
-    apuredis_schedule(x);
+    int i;
+    (void)s;
+    for (i = 0; i < argc; i++) {
+        t_symbol * id = atom_getsymbol(argv + i);
+        xpuredis_ackPush(x, id->s_name, strlen(id->s_name));
+    }
+    xpuredis_ackFlush(x);
 }
 
-/* apuredis (re-)scheduling method */
-static void apuredis_schedule(t_redis *x)
+/* xpuredis autoack message method: 1 (default) acknowledges entries once output */
+void xpuredis_autoack(t_redis *x, t_floatarg on)
 {
-    if ((!x->async_run) || x->async_num < 1) {
-        clock_unset(x->async_clock);
-    } else if (x->async_run && x->async_num > 0) {
-        clock_delay(x->async_clock, 1);
+    x->xs_autoack = on != 0;
+}
+
+/* xpuredis count message method: entries per XREADGROUP */
+void xpuredis_count(t_redis *x, t_floatarg count)
+{
+    x->xs_count = count < 1 ? 1 : (int)count;
+}
+
+/* xpuredis output message method: entry (default) or batch */
+void xpuredis_output(t_redis *x, t_symbol *s)
+{
+    if (s == gensym("batch")) {
+        x->xs_batch = 1;
+    } else if (s == gensym("entry")) {
+        x->xs_batch = 0;
+    } else {
+        post("xpuredis: output entry or batch");
     }
 }
 
-/* apuredis manual yielding method w/bang */
-void apuredis_bang(t_redis *x)
+/* xpuredis info message method: group pending count and lag, on the ack connection */
+void xpuredis_info(t_redis *x)
 {
-    apuredis_yield(x);
+    if (!xpuredis_ackOpen(x)) return;
+    redisAppendCommand(x->xs_ack, "XINFO GROUPS %s", x->xs_stream->s_name);
+    xpuredis_kindPush(x, XS_INFO);
+    xpuredis_ackFlush(x);
 }
 
-/* apuredis start message method */
-void apuredis_start(t_redis *x, t_symbol *s)
+
+/* redisstream~ / redisplay~ */
+
+/* sample ring of at least size samples, rounded up to a power of two */
+static int sring_init(t_redis_sring * r, size_t size)
 {
-    (void)s;
-    x->async_run = 1;
-    apuredis_schedule(x);
+    size_t n = 1;
+    while (n < size) n <<= 1;
+    if ((r->buf = calloc(n, sizeof(t_sample))) == NULL) return 0;
+    r->mask = n - 1;
+    r->head = r->tail = 0;
+    return 1;
 }
 
-/* apuredis stop message method */
-void apuredis_stop(t_redis *x, t_symbol *s)
+/* releases the samples of a ring */
+static void sring_free(t_redis_sring * r)
 {
-    (void)s;
-    x->async_run = 0;
-    apuredis_schedule(x);
+    free(r->buf);
+    r->buf = NULL;
 }
 
-/* spuredis */
+/* samples waiting in the ring, seen from either side */
+static size_t sring_count(t_redis_sring * r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
 
-/* spuredis setup method */
-static void setup_spuredis(void)
+/* producer side: writes all n samples or none */
+static int sring_write(t_redis_sring * r, const t_sample * in, size_t n)
 {
-    spuredis_class = class_new(gensym("spuredis"),
-        (t_newmethod)redis_new,
-        (t_method)redis_free,
-        sizeof(t_redis),
-        CLASS_DEFAULT,
-        A_GIMME, 0);
+    size_t head = r->head;
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    size_t pos = head & r->mask;
+    size_t first = r->mask + 1 - pos;
     
-    class_addbang(spuredis_class,spuredis_bang);
-    class_addmethod(spuredis_class,
-        (t_method)spuredis_stop, gensym("stop"),0);
-    class_addmethod(spuredis_class,
-        (t_method)spuredis_start, gensym("start"),0);
-    class_addmethod(spuredis_class,
-        (t_method)spuredis_subscribe, gensym("subscribe"),
-        A_GIMME, 0);
-    class_addmethod(spuredis_class,
-        (t_method)spuredis_subscribe, gensym("unsubscribe"),
-        A_GIMME, 0);
-    class_sethelpsymbol(spuredis_class, gensym("spuredis-help"));
+    if (r->mask + 1 - (head - tail) < n) return 0;
+    if (first > n) first = n;
+    memcpy(r->buf + pos, in, first * sizeof(t_sample));
+    memcpy(r->buf, in + first, (n - first) * sizeof(t_sample));
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return 1;
 }
 
-/* spuredis scheduled callback */
-static void spuredis_run(t_redis *x)
+/* consumer side: reads up to n samples, returns how many */
+static size_t sring_read(t_redis_sring * r, t_sample * out, size_t n)
 {
-    if (x->async_run) {
-        void * tmpreply = NULL;
-        if ( redisGetReply(x->redis, &tmpreply) == REDIS_ERR) return;
-        if (tmpreply == NULL) {
-            int wdone = 0;
-            if (redisBufferWrite(x->redis,&wdone) == REDIS_ERR) return;
-            
-            if (redisBufferRead(x->redis) == REDIS_ERR)
-                return;
-            if (redisGetReplyFromReader(x->redis,&tmpreply) == REDIS_ERR)
-                return;
-            
-            if (tmpreply != NULL) {
-                redisReply * reply = (redisReply*)tmpreply;
-                redis_parseReply(x, reply);
-            }
-        } else {
-            redisReply * reply = (redisReply*)tmpreply;
-            redis_parseReply(x, reply);
-        }
-        
-        clock_delay(x->async_clock, 100);
+    size_t tail = r->tail;
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t pos = tail & r->mask;
+    size_t first = r->mask + 1 - pos;
+    
+    if (head - tail < n) n = head - tail;
+    if (first > n) first = n;
+    memcpy(out, r->buf + pos, first * sizeof(t_sample));
+    memcpy(out + first, r->buf, (n - first) * sizeof(t_sample));
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* samples to little endian float32, a plain copy on little endian float hosts */
+static void redis_packSamples(const t_sample * in, size_t n, unsigned char * buf)
+{
+    size_t i;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (sizeof(t_sample) == 4) {
+        memcpy(buf, in, n * 4);
+        return;
+    }
+#endif
+    for (i = 0; i < n; i++) {
+        float f = in[i];
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        buf[4 * i] = bits & 0xff;
+        buf[4 * i + 1] = (bits >> 8) & 0xff;
+        buf[4 * i + 2] = (bits >> 16) & 0xff;
+        buf[4 * i + 3] = (bits >> 24) & 0xff;
     }
 }
 
-/* spuredis (re-)scheduling method */
-static void spuredis_schedule(t_redis *x)
+/* little endian float32 to samples */
+static void redis_unpackSamples(const unsigned char * buf, size_t n, t_sample * out)
 {
-    if (x->async_run && x->async_num < 1) {
-        x->async_run = 0;
-        clock_unset(x->async_clock);
-    } else if ((!x->async_run) && x->async_num > 0) {
-        x->async_run = 1;
-        clock_delay(x->async_clock, 0);
+    size_t i;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (sizeof(t_sample) == 4) {
+        memcpy(out, buf, n * 4);
+        return;
+    }
+#endif
+    for (i = 0; i < n; i++) {
+        float f;
+        uint32_t bits = (uint32_t)buf[4 * i] | (uint32_t)buf[4 * i + 1] << 8 |
+            (uint32_t)buf[4 * i + 2] << 16 | (uint32_t)buf[4 * i + 3] << 24;
+        memcpy(&f, &bits, 4);
+        out[i] = f;
     }
 }
 
-/* spuredis subscriptions management */
-static void spuredis_manage(t_redis *x, t_symbol *s, int argc)
+/* redisstream~ and redisplay~ setup method */
+static void setup_redisstream(void)
+{
+    redisstream_class = class_new(gensym("redisstream~"),
+        (t_newmethod)redisstream_new,
+        (t_method)redisstream_free,
+        sizeof(t_redisstream),
+        CLASS_DEFAULT,
+        A_GIMME, 0);
+    
+    CLASS_MAINSIGNALIN(redisstream_class, t_redisstream, x_f);
+    class_addbang(redisstream_class, redisstream_bang);
+    class_addmethod(redisstream_class,
+        (t_method)redisstream_dsp, gensym("dsp"), 0);
+    class_addmethod(redisstream_class,
+        (t_method)redisstream_maxlen, gensym("maxlen"),
+        A_FLOAT, 0);
+    class_sethelpsymbol(redisstream_class, gensym("redisstream~-help"));
+    
+    redisplay_class = class_new(gensym("redisplay~"),
+        (t_newmethod)redisstream_new,
+        (t_method)redisstream_free,
+        sizeof(t_redisstream),
+        CLASS_DEFAULT,
+        A_GIMME, 0);
+    
+    class_addbang(redisplay_class, redisplay_bang);
+    class_addmethod(redisplay_class,
+        (t_method)redisplay_dsp, gensym("dsp"), 0);
+    class_addmethod(redisplay_class,
+        (t_method)redisplay_jitter, gensym("jitter"),
+        A_FLOAT, 0);
+    class_sethelpsymbol(redisplay_class, gensym("redisplay~-help"));
+}
+
+/* constructor used by redisstream~ <key> [host] [port] [samples per entry]
+ * and redisplay~ <key> [host] [port] */
+static void * redisstream_new(t_symbol *s, int argc, t_atom *argv)
 {
-    if (s == gensym("subscribe")) {
-        x->async_num = x->async_num + argc;
+    t_redisstream *x;
+    char host[16];
+    int port;
+    
+    if (argc < 1 || argv[0].a_type != A_SYMBOL) {
+        post("%s: stream key argument needed", s->s_name); return NULL;
+    }
+    redis_address(argc > 3 ? 2 : argc - 1, argv + 1, host, &port);
+    
+    if (s == gensym("redisplay~")) {
+        x = (t_redisstream*)pd_new(redisplay_class);
+        outlet_new(&x->x_obj, &s_signal);
+        x->jitter_ms = STREAM_JITTER;
+        x->jitter = STREAM_JITTER * sys_getsr() / 1000;
     } else {
-        x->async_num = x->async_num - argc;
+        x = (t_redisstream*)pd_new(redisstream_class);
+        x->batch = argc > 3 ? (int)atom_getint(argv + 3) : STREAM_BATCH;
+        if (x->batch < 64 || x->batch > STREAM_RING / 4) x->batch = STREAM_BATCH;
+        x->maxlen = STREAM_MAXLEN;
     }
+    x->s_out = outlet_new(&x->x_obj, &s_list);
+    x->key = argv[0].a_w.w_symbol;
+    x->r_host = gensym(host)->s_name;
+    x->r_port = port;
     
-    spuredis_schedule(x);
+    if (!sring_init(&x->ring, STREAM_RING)) {
+        post("puredis: can not proceed!!  Memory Error!");
+        pd_free((t_pd*)x);
+        return NULL;
+    }
+    if (!redisstream_start(x, s == gensym("redisplay~") ? redisplay_reader : redisstream_writer)) {
+        post("%s: could not start stream thread", s->s_name);
+        pd_free((t_pd*)x);
+        return NULL;
+    }
+    return (void*)x;
 }
 
-/* apuredis alternate start method with bang */
-void spuredis_bang(t_redis *x)
+/* destructor: stops and joins the stream thread before the ring goes */
+static void redisstream_free(t_redisstream *x)
 {
-    spuredis_schedule(x);
+    if (x->thread_on) {
+        __atomic_store_n(&x->thread_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(x->thread, NULL);
+    }
+    sring_free(&x->ring);
 }
 
-/* apuredis start message method */
-void spuredis_start(t_redis *x, t_symbol *s)
+/* starts the writer or reader thread of the object */
+static int redisstream_start(t_redisstream *x, void * (*fn)(void *))
 {
-    (void)s;
-    spuredis_schedule(x);
+    x->thread_stop = 0;
+    if (pthread_create(&x->thread, NULL, fn, x) != 0) return 0;
+    x->thread_on = 1;
+    return 1;
 }
 
-/* apuredis stop message  method */
-void spuredis_stop(t_redis *x, t_symbol *s)
+/* stream threads: opens the connection when there is none or it failed,
+ * a second apart, 0 while it is not up */
+static int redisstream_connect(t_redisstream *x, redisContext ** redis)
 {
-    (void)s;
-    x->async_run = 0;
+    struct timeval timeout = { 1, 0 };
+    struct timespec backoff = { 1, 0 };
+    
+    if (*redis && !(*redis)->err) return 1;
+    if (*redis) {
+        redisFree(*redis);
+        nanosleep(&backoff, NULL);
+    }
+    *redis = redisConnectWithTimeout(x->r_host, x->r_port, timeout);
+    if (*redis == NULL) {
+        /* out of memory, wait as after a failed attempt */
+        nanosleep(&backoff, NULL);
+        return 0;
+    }
+    return !(*redis)->err;
 }
 
-/* apuredis subscribe message  method */
-void spuredis_subscribe(t_redis *x, t_symbol *s, int argc, t_atom *argv)
+/* writer thread: XADDs every full batch of samples as one packed entry,
+ * pipelining whatever is waiting, reconnecting after errors */
+static void * redisstream_writer(void * data)
 {
-    if (argc < 1) {
-        post("spuredis: subscribe need at least one channel"); return;
-    }
-    
-    int i;
-    char ** vector = NULL;
-    size_t * lengths = NULL;
+    t_redisstream * x = (t_redisstream*)data;
+    redisContext * redis = NULL;
+    struct timespec pause = { 0, 1000000 };
+    t_sample * samples = malloc(x->batch * sizeof(t_sample));
+    unsigned char * packed = malloc(x->batch * 4);
+    char maxlen[32];
+    const char * argv[8];
+    size_t lengths[8];
+    int i, n, argc;
     
-    if (((vector = malloc((argc+1)*sizeof(char*))) == NULL) || ((lengths = malloc((argc+1)*sizeof(size_t))) == NULL)) {
-        post("puredis: can not proceed!!  Memory Error!"); return;
+    if (samples == NULL || packed == NULL) {
+        free(samples); free(packed);
+        return NULL;
     }
-    
-    /* setting subscribe or unscribe as redis first command part */
-    if (s == gensym("subscribe")) {
-        if ((vector[0] = malloc(strlen("subscribe")+1)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
+    while (!__atomic_load_n(&x->thread_stop, __ATOMIC_ACQUIRE)) {
+        if (sring_count(&x->ring) < (size_t)x->batch) {
+            nanosleep(&pause, NULL);
+            continue;
         }
-        strcpy(vector[0], "subscribe");
-        lengths[0] = strlen(vector[0]);
-    } else {
-        if ((vector[0] = malloc(strlen("unsubscribe")+1)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
+        if (!redisstream_connect(x, &redis)) continue;
+        
+        argc = 0;
+        argv[argc] = "XADD"; lengths[argc++] = 4;
+        argv[argc] = x->key->s_name; lengths[argc++] = strlen(x->key->s_name);
+        if ((i = __atomic_load_n(&x->maxlen, __ATOMIC_RELAXED)) > 0) {
+            argv[argc] = "MAXLEN"; lengths[argc++] = 6;
+            argv[argc] = "~"; lengths[argc++] = 1;
+            lengths[argc] = snprintf(maxlen, sizeof(maxlen), "%d", i);
+            argv[argc++] = maxlen;
+        }
+        argv[argc] = "*"; lengths[argc++] = 1;
+        argv[argc] = "d"; lengths[argc++] = 1;
+        argv[argc] = (const char*)packed; lengths[argc++] = x->batch * 4;
+        
+        /* the packed buffer is copied into the output buffer by each append */
+        for (n = 0; n < 64 && sring_count(&x->ring) >= (size_t)x->batch; n++) {
+            sring_read(&x->ring, samples, x->batch);
+            redis_packSamples(samples, x->batch, packed);
+            redisAppendCommandArgv(redis, argc, argv, lengths);
+        }
+        for (i = 0; i < n; i++) {
+            void * reply = NULL;
+            if (redisGetReply(redis, &reply) == REDIS_ERR) {
+                __atomic_add_fetch(&x->errors, n - i, __ATOMIC_RELAXED);
+                break;
+            }
+            if (((redisReply*)reply)->type == REDIS_REPLY_ERROR) {
+                __atomic_add_fetch(&x->errors, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_add_fetch(&x->entries, 1, __ATOMIC_RELAXED);
+            }
+            freeReplyObject(reply);
         }
-        strcpy(vector[0], "unsubscribe");
-        lengths[0] = strlen(vector[0]);
     }
+    if (redis) redisFree(redis);
+    free(samples);
+    free(packed);
+    return NULL;
+}
+
+/* copies the block to the ring, dropping it when the writer is behind */
+static t_int * redisstream_perform(t_int *w)
+{
+    t_redisstream * x = (t_redisstream*)(w[1]);
+    t_sample * in = (t_sample*)(w[2]);
+    int n = (int)(w[3]);
     
-    for (i = 0; i < argc; i++) {
-        char cmdpart[256];
-        atom_string(argv+i, cmdpart, 256);
+    if (!sring_write(&x->ring, in, n))
+        __atomic_add_fetch(&x->dropped, n, __ATOMIC_RELAXED);
+    return (w+4);
+}
+
+/* redisstream~ dsp method */
+static void redisstream_dsp(t_redisstream *x, t_signal **sp)
+{
+    dsp_add(redisstream_perform, 3, x, sp[0]->s_vec, sp[0]->s_n);
+}
+
+/* redisstream~ bang method: outputs entries written, samples dropped and errors */
+void redisstream_bang(t_redisstream *x)
+{
+    t_atom stats[6];
+    SETSYMBOL(&stats[0], gensym("entries"));
+    SETFLOAT(&stats[1], __atomic_load_n(&x->entries, __ATOMIC_RELAXED));
+    SETSYMBOL(&stats[2], gensym("dropped"));
+    SETFLOAT(&stats[3], __atomic_load_n(&x->dropped, __ATOMIC_RELAXED));
+    SETSYMBOL(&stats[4], gensym("errors"));
+    SETFLOAT(&stats[5], __atomic_load_n(&x->errors, __ATOMIC_RELAXED));
+    outlet_list(x->s_out, &s_list, 6, &stats[0]);
+}
+
+/* redisstream~ maxlen message method: approximate stream length kept, 0 keeps everything */
+void redisstream_maxlen(t_redisstream *x, t_floatarg maxlen)
+{
+    __atomic_store_n(&x->maxlen, maxlen < 0 ? 0 : (int)maxlen, __ATOMIC_RELAXED);
+}
+
+/* reader thread: XREAD BLOCKs on the stream from its end and fills the
+ * ring with the packed entries, dropping what does not fit */
+static void * redisplay_reader(void * data)
+{
+    t_redisstream * x = (t_redisstream*)data;
+    redisContext * redis = NULL;
+    t_sample * samples = NULL;
+    size_t size = 0;
+    char lastid[64] = "$";
+    const char * argv[8] = { "XREAD", "COUNT", "64", "BLOCK", "100", "STREAMS", NULL, lastid };
+    size_t lengths[8] = { 5, 5, 2, 5, 3, 7, 0, 0 };
+    
+    argv[6] = x->key->s_name;
+    lengths[6] = strlen(x->key->s_name);
+    while (!__atomic_load_n(&x->thread_stop, __ATOMIC_ACQUIRE)) {
+        redisReply * reply;
+        size_t i, j;
         
-        if ((vector[i+1] = malloc(strlen(cmdpart)+1)) == NULL) {
-            post("puredis: can not proceed!!  Memory Error!"); return;
+        if (!redisstream_connect(x, &redis)) continue;
+        lengths[7] = strlen(lastid);
+        reply = redisCommandArgv(redis, 8, argv, lengths);
+        if (reply == NULL) {
+            __atomic_add_fetch(&x->errors, 1, __ATOMIC_RELAXED);
+            continue;
         }
-        
-        strcpy(vector[i+1], (char*)cmdpart);
-        lengths[i+1] = strlen(vector[i+1]);
+        /* [[key, [[id, [field, value, ...]], ...]]] */
+        if (reply->type == REDIS_REPLY_ARRAY && reply->elements > 0 &&
+            reply->element[0]->type == REDIS_REPLY_ARRAY && reply->element[0]->elements == 2) {
+            redisReply * entries = reply->element[0]->element[1];
+            for (i = 0; entries->type == REDIS_REPLY_ARRAY && i < entries->elements; i++) {
+                redisReply * id, * fields;
+                if (entries->element[i]->type != REDIS_REPLY_ARRAY || entries->element[i]->elements != 2)
+                    continue;
+                id = entries->element[i]->element[0];
+                fields = entries->element[i]->element[1];
+                for (j = 0; fields->type == REDIS_REPLY_ARRAY && j + 1 < fields->elements; j += 2) {
+                    redisReply * value = fields->element[j + 1];
+                    size_t n = value->len / 4;
+                    if (value->type != REDIS_REPLY_STRING || fields->element[j]->type != REDIS_REPLY_STRING ||
+                        strcmp(fields->element[j]->str, "d") != 0) continue;
+                    if (n > size) {
+                        t_sample * grown = realloc(samples, n * sizeof(t_sample));
+                        if (grown == NULL) continue;
+                        samples = grown;
+                        size = n;
+                    }
+                    redis_unpackSamples((const unsigned char*)value->str, n, samples);
+                    if (!sring_write(&x->ring, samples, n))
+                        __atomic_add_fetch(&x->dropped, n, __ATOMIC_RELAXED);
+                }
+                if ((size_t)id->len < sizeof(lastid)) {
+                    memcpy(lastid, id->str, id->len);
+                    lastid[id->len] = '\0';
+                }
+                __atomic_add_fetch(&x->entries, 1, __ATOMIC_RELAXED);
+            }
+        } else if (reply->type == REDIS_REPLY_ERROR) {
+            __atomic_add_fetch(&x->errors, 1, __ATOMIC_RELAXED);
+        }
+        freeReplyObject(reply);
     }
-    redis_postCommandAsync(x, argc+1, vector, lengths);
-    spuredis_manage(x, s, argc);
+    if (redis) redisFree(redis);
+    free(samples);
+    return NULL;
+}
+
+/* plays the ring once it holds the jitter prebuffer, outputs silence and
+ * prebuffers again after an underrun */
+static t_int * redisplay_perform(t_int *w)
+{
+    t_redisstream * x = (t_redisstream*)(w[1]);
+    t_sample * out = (t_sample*)(w[2]);
+    size_t n = (size_t)(w[3]);
+    size_t got = 0;
+    
+    if (!x->playing && sring_count(&x->ring) >= x->jitter + n) x->playing = 1;
+    if (x->playing) {
+        got = sring_read(&x->ring, out, n);
+        if (got < n) {
+            x->playing = 0;
+            __atomic_add_fetch(&x->underruns, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (got < n) memset(out + got, 0, (n - got) * sizeof(t_sample));
+    return (w+4);
 }
 
+/* redisplay~ dsp method: the jitter prebuffer follows the sample rate */
+static void redisplay_dsp(t_redisstream *x, t_signal **sp)
+{
+    x->jitter = x->jitter_ms * sp[0]->s_sr / 1000;
+    if (x->jitter > x->ring.mask / 2) x->jitter = x->ring.mask / 2;
+    dsp_add(redisplay_perform, 3, x, sp[0]->s_vec, sp[0]->s_n);
+}
+
+/* redisplay~ bang method: outputs samples buffered, entries read, underruns and samples dropped */
+void redisplay_bang(t_redisstream *x)
+{
+    t_atom stats[10];
+    SETSYMBOL(&stats[0], gensym("buffered"));
+    SETFLOAT(&stats[1], sring_count(&x->ring));
+    SETSYMBOL(&stats[2], gensym("entries"));
+    SETFLOAT(&stats[3], __atomic_load_n(&x->entries, __ATOMIC_RELAXED));
+    SETSYMBOL(&stats[4], gensym("underruns"));
+    SETFLOAT(&stats[5], __atomic_load_n(&x->underruns, __ATOMIC_RELAXED));
+    SETSYMBOL(&stats[6], gensym("dropped"));
+    SETFLOAT(&stats[7], __atomic_load_n(&x->dropped, __ATOMIC_RELAXED));
+    SETSYMBOL(&stats[8], gensym("errors"));
+    SETFLOAT(&stats[9], __atomic_load_n(&x->errors, __ATOMIC_RELAXED));
+    outlet_list(x->s_out, &s_list, 10, &stats[0]);
+}
+
+/* redisplay~ jitter message method: milliseconds buffered before playing */
+void redisplay_jitter(t_redisstream *x, t_floatarg ms)
+{
+    x->jitter_ms = ms < 0 ? 0 : (int)ms;
+    x->jitter = x->jitter_ms * sys_getsr() / 1000;
+    if (x->jitter > x->ring.mask / 2) x->jitter = x->ring.mask / 2;
+}
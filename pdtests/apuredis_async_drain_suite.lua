@@ -0,0 +1,17 @@
+local suite = Suite("apuredis async drain")
+suite.teardown(function()
+  _.outlet({"drain",1000,500})
+  _.outlet({"mode","poll"})
+end)
+
+suite.case("drain one reply per tick"
+  ).test(function(test)
+    _.outlet({"drain",1})
+    test({"command","ECHO","drained"})
+  end).should:equal("drained")
+
+suite.case("clock mode"
+  ).test(function(test)
+    _.outlet({"mode","clock"})
+    test({"command","ECHO","clocked"})
+  end).should:equal("clocked")
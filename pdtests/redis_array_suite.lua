@@ -0,0 +1,31 @@
+local suite = Suite("redis array suite")
+suite.setup(function()
+  _.outlet({"command","RPUSH","POINTS","5","6","7","8"})
+end)
+suite.teardown(function()
+  _.outlet({"command","flushdb"})
+end)
+
+suite.case("toarray"
+  ).test({"toarray","pdtest_array","LRANGE","POINTS",0,-1}
+    ).should:equal({"toarray","pdtest_array",4})
+
+suite.case("fromarray list"
+  ).test(function(test)
+    _.outlet({"toarray","pdtest_array","LRANGE","POINTS",0,-1})
+    _.outlet({"fromarray","pdtest_array","COPY"})
+    test({"command","LRANGE","COPY",0,-1})
+  end).should:equal({"5","6","7","8"})
+
+suite.case("fromarray packed"
+  ).test(function(test)
+    _.outlet({"toarray","pdtest_array","LRANGE","POINTS",0,-1})
+    test({"fromarray","pdtest_array","PACKED","packed"})
+  end).should:equal("OK")
+
+suite.case("toarray packed"
+  ).test(function(test)
+    _.outlet({"toarray","pdtest_array","LRANGE","POINTS",0,-1})
+    _.outlet({"fromarray","pdtest_array","PACKED","packed"})
+    test({"toarray","pdtest_array","GET","PACKED"})
+  end).should:equal({"toarray","pdtest_array",4})
@@ -0,0 +1,46 @@
+local suite = Suite("redis batch suite")
+suite.setup(function()
+  _.outlet({"command","SET","KEY1","VALUE1"})
+end)
+suite.teardown(function()
+  _.outlet({"command","flushdb"})
+end)
+
+suite.case("batch"
+  ).test(function(test)
+    _.outlet({"batch","begin"})
+    _.outlet({"command","SET","KEY2","VALUE2"})
+    _.outlet({"command","APPEND","KEY1","_EXTRA"})
+    test({"batch","end"})
+  end).should:equal({"OK",12})
+
+suite.case("batch multi"
+  ).test(function(test)
+    _.outlet({"batch","begin","multi"})
+    _.outlet({"command","SET","KEY2","VALUE2"})
+    _.outlet({"command","APPEND","KEY1","_EXTRA"})
+    test({"batch","end"})
+  end).should:equal({"OK",12})
+
+suite.case("batch tagged"
+  ).test(function(test)
+    _.outlet({"batch","begin"})
+    _.outlet({"command","SET","KEY2","VALUE2"})
+    test({"batch","end","tagged"})
+  end).should:equal({0,"OK"})
+
+suite.case("batch cancel"
+  ).test(function(test)
+    _.outlet({"batch","begin"})
+    _.outlet({"command","SET","KEY2","VALUE2"})
+    _.outlet({"batch","cancel"})
+    test({"command","EXISTS","KEY2"})
+  end).should:equal(0)
+
+suite.case("batch multi tagged"
+  ).test(function(test)
+    _.outlet({"batch","begin","multi"})
+    _.outlet({"command","SET","KEY2","VALUE2"})
+    _.outlet({"command","APPEND","KEY1","_EXTRA"})
+    test({"batch","end","tagged"})
+  end).should:equal({0,"OK"})
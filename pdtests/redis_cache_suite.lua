@@ -0,0 +1,46 @@
+local suite = Suite("redis cache suite")
+suite.setup(function()
+  _.outlet({"cache",16})
+  _.outlet({"command","SET","KEY1","VALUE1"})
+end)
+suite.teardown(function()
+  _.outlet({"cache",0})
+  _.outlet({"command","flushdb"})
+end)
+
+suite.case("cache hit"
+  ).test(function(test)
+    _.outlet({"command","GET","KEY1"})
+    test({"command","GET","KEY1"})
+  end).should:equal("VALUE1")
+
+suite.case("cache hit counters"
+  ).test(function(test)
+    _.outlet({"command","GET","KEY1"})
+    _.outlet({"command","GET","KEY1"})
+    test({"cache","stats"})
+  end).should:equal({"cache","hits",1,"misses",1,"evictions",0,"invalidations",0,"entries",1})
+
+suite.case("cache invalidate"
+  ).test(function(test)
+    _.outlet({"command","GET","KEY1"})
+    _.outlet({"command","SET","KEY1","VALUE2"})
+    test({"command","GET","KEY1"})
+  end).should:equal("VALUE2")
+
+suite.case("cache invalidate counters"
+  ).test(function(test)
+    _.outlet({"command","GET","KEY1"})
+    _.outlet({"command","SET","KEY1","VALUE2"})
+    _.outlet({"command","GET","KEY1"})
+    test({"cache","stats"})
+  end).should:equal({"cache","hits",0,"misses",2,"evictions",0,"invalidations",1,"entries",1})
+
+suite.case("cache batch invalidate"
+  ).test(function(test)
+    _.outlet({"command","GET","KEY1"})
+    _.outlet({"batch","begin"})
+    _.outlet({"command","SET","KEY1","VALUE3"})
+    _.outlet({"batch","end"})
+    test({"command","GET","KEY1"})
+  end).should:equal("VALUE3")
@@ -0,0 +1,24 @@
+local dump = os.tmpname()
+
+local suite = Suite("redis csvdump suite")
+
+suite.case("csvdump list"
+  ).test(function(test)
+    _.outlet({"command","flushdb"})
+    _.outlet({"command","RPUSH","LIST1","a","b"})
+    test({"csvdump",dump,"list"})
+  end).should:equal({"csv-dump-status","lines",1,"entries",2,"error",0})
+
+suite.case("csv load of the dump"
+  ).test(function(test)
+    _.outlet({"command","DEL","LIST1"})
+    test({"csv",dump,"list"})
+  end).should:equal({"csv-load-status","lines",1,"entries",2,"error",0})
+
+suite.case("csvdump round trip"
+  ).test({"command","LRANGE","LIST1",0,-1}
+    ).should:equal({"a","b"})
+
+suite.case("csvdump cleanup"
+  ).test({"command","flushdb"}
+    ).should:equal("OK")
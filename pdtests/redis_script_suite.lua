@@ -0,0 +1,34 @@
+local script = os.tmpname()
+local file = io.open(script, "w")
+file:write("return redis.call('INCRBY', KEYS[1], ARGV[1] or 1)")
+file:close()
+
+local suite = Suite("redis script suite")
+suite.setup(function()
+  _.outlet({"script","load","incrby",script})
+end)
+suite.teardown(function()
+  _.outlet({"command","flushdb"})
+end)
+
+suite.case("script call"
+  ).test({"script","call","incrby","COUNT","--",5}
+    ).should:equal(5)
+
+suite.case("script call keys only"
+  ).test({"script","call","incrby","COUNT"}
+    ).should:equal(1)
+
+suite.case("script NOSCRIPT"
+  ).test(function(test)
+    _.outlet({"command","SCRIPT","FLUSH"})
+    test({"script","call","incrby","COUNT","--",3})
+  end).should:equal(3)
+
+suite.case("script call in a batch"
+  ).test(function(test)
+    _.outlet({"batch","begin"})
+    _.outlet({"script","call","incrby","COUNT","--",3})
+    _.outlet({"script","call","incrby","COUNT","--",2})
+    test({"batch","end"})
+  end).should:equal({3,5})
@@ -0,0 +1,7 @@
+local suite = Suite("redis stats suite")
+
+suite.case("stats resets"
+  ).test(function(test)
+    _.outlet({"stats"})
+    test({"stats"})
+  end).should:equal({"stats","total","commands",0,"rate",0,"errors",0,"written",0,"read",0,"peak",0})
@@ -6,6 +6,7 @@ suite.setup(function()
   _.outlet({"command","SET","BITS","0101"})
 end)
 suite.teardown(function()
+  _.outlet({"decode","symbol"})
   _.outlet({"command","flushdb"})
 end)
 
@@ -87,4 +88,20 @@ suite.case("SETEX"
   ).test(function(test)
     _.outlet({"command","SETEX","KEY3",44,"VALUE3"})
     test({"command","TTL","KEY3"})
-  end).should:equal(44)
\ No newline at end of file
+  end).should:equal(44)
+
+suite.case("GET symbol"
+  ).test({"command","GET","COUNT"}
+    ).should:equal("23")
+
+suite.case("decode numeric"
+  ).test(function(test)
+    _.outlet({"decode","numeric"})
+    test({"command","GET","COUNT"})
+  end).should:equal(23)
+
+suite.case("decode numeric text"
+  ).test(function(test)
+    _.outlet({"decode","numeric"})
+    test({"command","MGET","COUNT","KEY1"})
+  end).should:equal({23,"VALUE1"})
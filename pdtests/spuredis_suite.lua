@@ -7,3 +7,47 @@ suite.case("subscribe"
 suite.case("publish"
   ).test({"puredis","command","publish","TESTCHAN","TESTMSG"}
     ).should:resemble({"message","TESTCHAN","TESTMSG"})
+
+suite.case("psubscribe"
+  ).test({"spuredis","psubscribe","TESTP*"}
+    ).should:resemble({"psubscribe","TESTP*","2"})
+
+suite.case("pmessage"
+  ).test({"puredis","command","publish","TESTPX","TESTMSG"}
+    ).should:resemble({"pmessage","TESTP*","TESTPX","TESTMSG"})
+
+suite.case("bind"
+  ).test(function(test)
+    _.outlet({"spuredis","bind","TESTP*","spuredis_bound"})
+    test({"puredis","command","publish","TESTPY","BOUND"})
+  end).should:resemble({"bound","TESTPY","BOUND"})
+
+suite.case("unbind"
+  ).test(function(test)
+    _.outlet({"spuredis","unbind","TESTP*"})
+    test({"puredis","command","publish","TESTPZ","UNBOUND"})
+  end).should:resemble({"pmessage","TESTP*","TESTPZ","UNBOUND"})
+
+suite.case("conflate"
+  ).test(function(test)
+    _.outlet({"spuredis","conflate",1})
+    _.outlet({"puredis","batch","begin"})
+    _.outlet({"puredis","command","publish","TESTCHAN","FIRST"})
+    _.outlet({"puredis","command","publish","TESTCHAN","SECOND"})
+    _.outlet({"puredis","command","publish","TESTCHAN","LAST"})
+    test({"puredis","batch","end"})
+  end).should:resemble({"message","TESTCHAN","LAST"})
+
+suite.case("conflate dropped"
+  ).test({"spuredis","conflate"}
+    ).should:resemble({"conflate","dropped","2"})
+
+suite.case("conflate off"
+  ).test(function(test)
+    _.outlet({"spuredis","conflate",0})
+    test({"puredis","command","publish","TESTCHAN","ALL"})
+  end).should:resemble({"message","TESTCHAN","ALL"})
+
+suite.case("punsubscribe"
+  ).test({"spuredis","punsubscribe","TESTP*"}
+    ).should:resemble({"punsubscribe","TESTP*","1"})
@@ -0,0 +1,12 @@
+local suite = Suite("xpuredis tests")
+suite.setup(function()
+  _.outlet({"xpuredis","start"})
+end)
+
+suite.case("read"
+  ).test({"puredis","command","XADD","pdtest_stream","*","sensor","v1"}
+    ).should:resemble({"sensor","v1"})
+
+suite.case("ack"
+  ).test({"query","command","XPENDING","pdtest_stream","pdtest_group"}
+    ).should:resemble({0,"nil","nil","nil"})